@@ -0,0 +1,273 @@
+/* SYNAPSE SO - ACPI Table Discovery */
+/* Licensed under GPLv3 */
+
+#include <kernel/acpi.h>
+#include <kernel/vga.h>
+#include <kernel/vmm.h>
+
+/* Root System Description Pointer (ACPI 1.0 part) */
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed)) acpi_rsdp_t;
+
+/* Multiple APIC Description Table */
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+/* MADT entry types */
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_ISO            2
+#define MADT_LAPIC_OVERRIDE 5
+
+/* MADT local APIC flags */
+#define MADT_LAPIC_ENABLED  (1 << 0)
+
+/* BIOS data area word holding the EBDA segment */
+#define ACPI_BDA_EBDA_SEGMENT 0x40E
+
+/* Everything below this is identity mapped by vmm_init() */
+#define ACPI_LOW_MAPPED 0x400000
+
+static acpi_sdt_header_t* rsdt;
+static uint32_t lapic_addr;
+static uint32_t cpu_count;
+static uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+
+static uint32_t ioapic_count;
+static uint32_t ioapic_addrs[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_gsi_bases[ACPI_MAX_IOAPICS];
+
+/* ISA IRQ routing; identity with default flags unless overridden */
+static uint32_t isa_gsi[ACPI_ISA_IRQS];
+static uint16_t isa_flags[ACPI_ISA_IRQS];
+
+static int acpi_checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+
+    return sum == 0;
+}
+
+static int acpi_signature_is(const char* a, const char* b, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Identity map the pages of a table so it can be read through paging */
+static void acpi_map(uint32_t phys, uint32_t length) {
+    uint32_t page = phys & 0xFFFFF000;
+    uint32_t end = phys + length;
+
+    for (; page < end; page += PAGE_SIZE) {
+        if (page >= ACPI_LOW_MAPPED) {
+            vmm_map_page(page, page, PAGE_PRESENT);
+        }
+    }
+}
+
+/* Map a table whose length is only known after reading its header */
+static acpi_sdt_header_t* acpi_map_table(uint32_t phys) {
+    acpi_map(phys, sizeof(acpi_sdt_header_t));
+    acpi_sdt_header_t* header = (acpi_sdt_header_t*)phys;
+    acpi_map(phys, header->length);
+    return header;
+}
+
+/* Scan a memory range for the "RSD PTR " signature on 16-byte boundaries */
+static acpi_rsdp_t* acpi_scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)addr;
+        if (acpi_signature_is(rsdp->signature, "RSD PTR ", 8) &&
+            acpi_checksum_ok(rsdp, sizeof(acpi_rsdp_t))) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static acpi_rsdp_t* acpi_find_rsdp(void) {
+    /* First KB of the EBDA, whose segment is stored in the BDA */
+    uint16_t segment;
+    __asm__ __volatile__("movw (%1), %0" : "=r"(segment)
+                         : "r"(ACPI_BDA_EBDA_SEGMENT) : "memory");
+    uint32_t ebda = (uint32_t)segment << 4;
+    if (ebda != 0) {
+        acpi_rsdp_t* rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+        if (rsdp != 0) {
+            return rsdp;
+        }
+    }
+
+    /* BIOS read-only area */
+    return acpi_scan_rsdp(0xE0000, 0x100000);
+}
+
+acpi_sdt_header_t* acpi_find_table(const char* signature) {
+    if (rsdt == 0) {
+        return 0;
+    }
+
+    uint32_t entries = (rsdt->length - sizeof(acpi_sdt_header_t)) / 4;
+    uint32_t* table_addrs = (uint32_t*)(rsdt + 1);
+
+    for (uint32_t i = 0; i < entries; i++) {
+        acpi_sdt_header_t* table = acpi_map_table(table_addrs[i]);
+        if (acpi_signature_is(table->signature, signature, 4) &&
+            acpi_checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+
+    return 0;
+}
+
+static void acpi_parse_madt(acpi_madt_t* madt) {
+    lapic_addr = madt->lapic_addr;
+    cpu_count = 0;
+    ioapic_count = 0;
+
+    for (uint32_t irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        isa_gsi[irq] = irq;
+        isa_flags[irq] = 0;
+    }
+
+    uint8_t* entry = (uint8_t*)(madt + 1);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+
+    while (entry + 2 <= end && entry[1] >= 2) {
+        switch (entry[0]) {
+            case MADT_LAPIC: {
+                /* processor uid, APIC ID, flags */
+                uint32_t flags = *(uint32_t*)(entry + 4);
+                if ((flags & MADT_LAPIC_ENABLED) && cpu_count < ACPI_MAX_CPUS) {
+                    cpu_apic_ids[cpu_count++] = entry[3];
+                }
+                break;
+            }
+
+            case MADT_IOAPIC: {
+                /* I/O APIC ID, reserved, address, GSI base */
+                if (ioapic_count < ACPI_MAX_IOAPICS) {
+                    ioapic_addrs[ioapic_count] = *(uint32_t*)(entry + 4);
+                    ioapic_gsi_bases[ioapic_count] = *(uint32_t*)(entry + 8);
+                    ioapic_count++;
+                }
+                break;
+            }
+
+            case MADT_ISO: {
+                /* bus (0 = ISA), source IRQ, GSI, flags */
+                uint8_t source = entry[3];
+                if (entry[2] == 0 && source < ACPI_ISA_IRQS) {
+                    isa_gsi[source] = *(uint32_t*)(entry + 4);
+                    isa_flags[source] = *(uint16_t*)(entry + 8);
+                }
+                break;
+            }
+
+            case MADT_LAPIC_OVERRIDE: {
+                /* 64-bit address; only usable below 4GB */
+                uint32_t high = *(uint32_t*)(entry + 8);
+                if (high == 0) {
+                    lapic_addr = *(uint32_t*)(entry + 4);
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        entry += entry[1];
+    }
+}
+
+int acpi_init(void) {
+    vga_print("[+] Initializing ACPI...\n");
+
+    acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (rsdp == 0) {
+        vga_print("[-] ACPI RSDP not found\n");
+        return -1;
+    }
+
+    rsdt = acpi_map_table(rsdp->rsdt_addr);
+    if (!acpi_signature_is(rsdt->signature, "RSDT", 4) ||
+        !acpi_checksum_ok(rsdt, rsdt->length)) {
+        vga_print("[-] ACPI RSDT invalid\n");
+        rsdt = 0;
+        return -1;
+    }
+
+    acpi_madt_t* madt = (acpi_madt_t*)acpi_find_table("APIC");
+    if (madt == 0) {
+        vga_print("[-] ACPI MADT not found\n");
+        return -1;
+    }
+
+    acpi_parse_madt(madt);
+
+    vga_print("    MADT: ");
+    vga_print_dec(cpu_count);
+    vga_print(" CPU(s), LAPIC at ");
+    vga_print_hex(lapic_addr);
+    vga_print(", ");
+    vga_print_dec(ioapic_count);
+    vga_print(" IOAPIC(s)\n");
+
+    return (cpu_count > 0) ? 0 : -1;
+}
+
+uint32_t acpi_get_lapic_addr(void) {
+    return lapic_addr;
+}
+
+uint32_t acpi_get_cpu_count(void) {
+    return cpu_count;
+}
+
+uint8_t acpi_get_cpu_apic_id(uint32_t index) {
+    return (index < cpu_count) ? cpu_apic_ids[index] : 0;
+}
+
+uint32_t acpi_get_ioapic_count(void) {
+    return ioapic_count;
+}
+
+uint32_t acpi_get_ioapic_addr(uint32_t index) {
+    return (index < ioapic_count) ? ioapic_addrs[index] : 0;
+}
+
+uint32_t acpi_get_ioapic_gsi_base(uint32_t index) {
+    return (index < ioapic_count) ? ioapic_gsi_bases[index] : 0;
+}
+
+uint32_t acpi_isa_irq_to_gsi(uint8_t irq, uint16_t* flags) {
+    if (irq >= ACPI_ISA_IRQS) {
+        if (flags != 0) {
+            *flags = 0;
+        }
+        return irq;
+    }
+
+    if (flags != 0) {
+        *flags = isa_flags[irq];
+    }
+    return isa_gsi[irq];
+}
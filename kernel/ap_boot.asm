@@ -0,0 +1,86 @@
+; SYNAPSE SO - Application Processor Boot Trampoline
+; Licensed under GPLv3
+
+section .note.GNU-stack noalloc noexec nowrite progbits
+
+section .text
+
+; smp_init() copies ap_trampoline_start..ap_trampoline_end to this physical
+; address (kernel/include/kernel/smp.h) and fills in the ap_boot_* words
+; before sending the STARTUP IPI. The code runs from the copy, so every
+; absolute reference goes through TRAMP().
+%define AP_TRAMPOLINE_ADDR 0x8000
+%define TRAMP(label) (AP_TRAMPOLINE_ADDR + (label) - ap_trampoline_start)
+
+%define GDT_KERNEL_CODE 0x08
+%define GDT_KERNEL_DATA 0x10
+
+bits 16
+
+; Real mode entry: CS:IP = 0x0800:0000
+global ap_trampoline_start
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    o32 lgdt [TRAMP(ap_gdt_ptr)]
+
+    mov eax, cr0
+    or eax, 1                 ; PE
+    mov cr0, eax
+
+    jmp dword GDT_KERNEL_CODE:TRAMP(ap_protected_mode)
+
+bits 32
+
+ap_protected_mode:
+    mov ax, GDT_KERNEL_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Same address space as the BSP
+    mov eax, [TRAMP(ap_boot_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000        ; PG
+    mov cr0, eax
+
+    ; Run on the idle thread stack of this CPU: ap_main(cpu index)
+    mov esp, [TRAMP(ap_boot_stack)]
+    push dword [TRAMP(ap_boot_cpu)]
+    mov eax, [TRAMP(ap_boot_entry)]
+    call eax
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Flat code and data segments, replaced by gdt_init_cpu() in ap_main
+align 8
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+ap_gdt_ptr:
+    dw ap_gdt_ptr - ap_gdt - 1
+    dd TRAMP(ap_gdt)
+
+; Parameters written by smp_init() for each AP
+align 4
+global ap_boot_cr3
+ap_boot_cr3:    dd 0
+global ap_boot_stack
+ap_boot_stack:  dd 0
+global ap_boot_entry
+ap_boot_entry:  dd 0
+global ap_boot_cpu
+ap_boot_cpu:    dd 0
+
+global ap_trampoline_end
+ap_trampoline_end:
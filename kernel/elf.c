@@ -9,6 +9,7 @@
 #include <kernel/vga.h>
 #include <kernel/string.h>
 #include <kernel/io.h>
+#include <kernel/smp.h>
 
 /* Check ELF header */
 int elf_check_header(elf32_header_t* header) {
@@ -121,7 +122,11 @@ int elf_load(uint8_t* elf_data, uint32_t size, uint32_t* entry_point) {
                 }
                 flags |= PAGE_PRESENT;
 
-                vmm_map_page(addr, phys, flags);
+                if (vmm_map_page(addr, phys, flags) != 0) {
+                    pmm_free_frame(phys);
+                    vga_print("[-] Failed to allocate page table\n");
+                    return -1;
+                }
             }
 
             /* Copy segment data */
@@ -182,115 +187,107 @@ int elf_load_to_process(uint8_t* elf_data, uint32_t size, process_t* proc) {
         return -1;
     }
 
-    /* Save current page directory */
-    page_directory_t* old_dir = vmm_get_current_directory();
-
-    /* Load program segments */
-    /* First pass: Map all pages in the process's address space */
+    /* First pass: validate every segment before touching the address space */
     elf32_phdr_t* phdr = (elf32_phdr_t*)(elf_data + header->e_phoff);
 
     for (uint32_t i = 0; i < header->e_phnum; i++) {
-        if (phdr->p_type == PT_LOAD) {
-            vga_print("    Mapping segment at 0x");
-            vga_print_hex(phdr->p_vaddr);
-            vga_print("\n");
+        if (phdr[i].p_type != PT_LOAD) {
+            continue;
+        }
 
-            /* Validate sizes/offsets */
-            if (phdr->p_filesz > phdr->p_memsz) {
-                vga_print("[-] Segment file size larger than memory size\n");
-                vga_print("[-] Restoring kernel directory\n");
-                vmm_switch_page_directory(old_dir);
-                return -1;
-            }
-            if (phdr->p_offset + phdr->p_filesz > size) {
-                vga_print("[-] Segment exceeds ELF data size\n");
-                vga_print("[-] Restoring kernel directory\n");
-                vmm_switch_page_directory(old_dir);
-                return -1;
-            }
+        if (phdr[i].p_filesz > phdr[i].p_memsz) {
+            vga_print("[-] Segment file size larger than memory size\n");
+            return -1;
+        }
+        if (phdr[i].p_offset + phdr[i].p_filesz > size) {
+            vga_print("[-] Segment exceeds ELF data size\n");
+            return -1;
+        }
+        if (phdr[i].p_vaddr < ELF_USER_BASE || phdr[i].p_vaddr >= USER_SPACE_END ||
+            phdr[i].p_memsz > USER_SPACE_END - phdr[i].p_vaddr) {
+            vga_print("[-] Segment outside user space\n");
+            return -1;
+        }
+    }
 
-            /* Calculate number of pages needed */
-            uint32_t start_page = phdr->p_vaddr & 0xFFFFF000;
-            uint32_t end_page = (phdr->p_vaddr + phdr->p_memsz + 0xFFF) & 0xFFFFF000;
+    /* Second pass: map and fill the segments with the process directory
+       loaded. elf_data lives in the kernel half, which every directory
+       shares, so it stays readable. No preemption meanwhile: switching
+       back to this thread would load its own directory again. */
+    preempt_disable();
+    page_directory_t* old_dir = vmm_get_current_directory();
+    vmm_switch_page_directory(proc->page_dir);
 
-            /* Map pages to process directory */
-            vmm_switch_page_directory(proc->page_dir);
+    int result = 0;
+    for (uint32_t i = 0; i < header->e_phnum && result == 0; i++) {
+        if (phdr[i].p_type != PT_LOAD) {
+            continue;
+        }
 
-            uint32_t alloc_failed = 0;
-            for (uint32_t addr = start_page; addr < end_page; addr += PAGE_SIZE) {
-                uint32_t phys = pmm_alloc_frame();
-                if (phys == 0) {
-                    vga_print("[-] Failed to allocate physical frame\n");
-                    alloc_failed = 1;
-                    break;
-                }
-                uint32_t flags = 0;
+        vga_print("    Loading segment at ");
+        vga_print_hex(phdr[i].p_vaddr);
+        vga_print(" (size: ");
+        vga_print_dec(phdr[i].p_memsz);
+        vga_print(" bytes)\n");
 
-                if (phdr->p_flags & PF_W) {
-                    flags |= PAGE_WRITE;
+        uint32_t flags = PAGE_PRESENT | PAGE_USER;
+        if (phdr[i].p_flags & PF_W) {
+            flags |= PAGE_WRITE;
+        }
+
+        /* Calculate number of pages needed */
+        uint32_t start_page = phdr[i].p_vaddr & 0xFFFFF000;
+        uint32_t end_page = (phdr[i].p_vaddr + phdr[i].p_memsz + 0xFFF) & 0xFFFFF000;
+
+        for (uint32_t addr = start_page; addr < end_page; addr += PAGE_SIZE) {
+            /* Segments may share a page; it ends up writable if either is */
+            uint32_t mapped = vmm_get_phys_addr(addr);
+            if (mapped != 0) {
+                if (flags & PAGE_WRITE) {
+                    vmm_map_page(addr, mapped, flags);
                 }
-                flags |= PAGE_PRESENT | PAGE_USER;
+                continue;
+            }
 
-                vmm_map_page(addr, phys, flags);
+            /* Zeroed, so no stale data leaks into the process */
+            uint32_t phys = pmm_alloc_zeroed_frame();
+            if (phys == 0) {
+                vga_print("[-] Failed to allocate physical frame\n");
+                result = -1;
+                break;
             }
 
-            if (alloc_failed) {
-                vga_print("[-] Restoring kernel directory\n");
-                vmm_switch_page_directory(old_dir);
-                return -1;
+            if (vmm_map_page(addr, phys, flags) != 0) {
+                pmm_free_frame(phys);
+                vga_print("[-] Failed to allocate page table\n");
+                result = -1;
+                break;
             }
         }
 
-        phdr++;
+        if (result != 0) {
+            break;
+        }
+
+        /* Copy file data; the rest up to p_memsz (bss) is already zero */
+        uint8_t* dest = (uint8_t*)phdr[i].p_vaddr;
+        uint8_t* src = elf_data + phdr[i].p_offset;
+        if (phdr[i].p_filesz > 0) {
+            memcpy(dest, src, phdr[i].p_filesz);
+        }
     }
 
-    /* Second pass: Copy data from kernel space to process space */
-    /* Switch to kernel directory to access ELF data */
     vmm_switch_page_directory(old_dir);
+    preempt_enable();
 
-    phdr = (elf32_phdr_t*)(elf_data + header->e_phoff);
-
-    for (uint32_t i = 0; i < header->e_phnum; i++) {
-        if (phdr->p_type == PT_LOAD) {
-            vga_print("    Copying segment at 0x");
-            vga_print_hex(phdr->p_vaddr);
-            vga_print("\n");
-
-            /* Copy segment data using temporary mapping */
-            uint8_t* dest = (uint8_t*)phdr->p_vaddr;
-            uint8_t* src = elf_data + phdr->p_offset;
-
-            /* Switch to process directory for destination */
-            vmm_switch_page_directory(proc->page_dir);
-
-            /* Copy file data */
-            if (phdr->p_filesz > 0) {
-                /* This won't work properly - src is in kernel space, dest in process space */
-                /* We need to map kernel pages into process space temporarily */
-                /* For now, we'll skip the copy - this is a known limitation */
-                /* TODO: Implement temporary mapping of ELF data into process space */
-                vga_print("    [!] Skipping copy (requires temp mapping)\n");
-            }
-
-            /* Zero out bss */
-            if (phdr->p_memsz > phdr->p_filesz) {
-                memset(dest + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
-            }
-
-            /* Switch back to kernel directory for next iteration */
-            vmm_switch_page_directory(old_dir);
-        }
-
-        phdr++;
+    if (result != 0) {
+        /* Pages mapped so far are released with the process directory */
+        return -1;
     }
 
     /* Set process entry point */
     proc->eip = header->e_entry;
 
-    vga_print("[+] ELF mapped for process (copy TODO)\n");
-
-    /* Ensure we're back in kernel directory */
-    vmm_switch_page_directory(old_dir);
-
+    vga_print("[+] ELF loaded for process\n");
     return 0;
 }
@@ -0,0 +1,200 @@
+/* SYNAPSE SO - Lazy FPU/SSE Context Switching */
+/* Licensed under GPLv3 */
+
+/* The FPU registers are only saved and restored when a process actually
+ * uses them. On a context switch CR0.TS is set; the first FPU or SSE
+ * instruction the next process executes raises #NM, and only then is the
+ * previous owner's state saved and the new one's restored. Processes that
+ * never touch the FPU never pay for FXSAVE/FXRSTOR. */
+
+#include <kernel/fpu.h>
+#include <kernel/cpu.h>
+#include <kernel/heap.h>
+#include <kernel/smp.h>
+#include <kernel/vga.h>
+
+/* The process whose state is live in a CPU's FPU registers is that CPU's
+ * fpu_owner; the process records the CPU in fpu_cpu so the scheduler does
+ * not migrate it away from its live state. */
+
+static int fpu_present;
+static int fpu_has_fxsr;
+static int fpu_has_sse;
+
+static void fpu_save(process_t* proc) {
+    if (fpu_has_fxsr) {
+        __asm__ __volatile__("fxsave (%0)" : : "r"(proc->fpu_state) : "memory");
+    } else {
+        __asm__ __volatile__("fnsave (%0)" : : "r"(proc->fpu_state) : "memory");
+    }
+    proc->flags |= PROC_FLAG_FPU_USED;
+    proc->fpu_cpu = CPU_NONE;
+}
+
+static void fpu_restore(process_t* proc) {
+    if (fpu_has_fxsr) {
+        __asm__ __volatile__("fxrstor (%0)" : : "r"(proc->fpu_state) : "memory");
+    } else {
+        __asm__ __volatile__("frstor (%0)" : : "r"(proc->fpu_state) : "memory");
+    }
+}
+
+/* Give the current process a freshly initialized FPU */
+static void fpu_reset(void) {
+    __asm__ __volatile__("fninit");
+    if (fpu_has_sse) {
+        uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+        __asm__ __volatile__("ldmxcsr %0" : : "m"(mxcsr));
+    }
+}
+
+/* Allocate the aligned save area on first use */
+static int fpu_alloc_state(process_t* proc) {
+    if (proc->fpu_state != 0) {
+        return 0;
+    }
+
+    void* mem = kmalloc(FPU_STATE_SIZE + FPU_STATE_ALIGN);
+    if (mem == 0) {
+        return -1;
+    }
+
+    proc->fpu_alloc = mem;
+    proc->fpu_state = (uint8_t*)(((uint32_t)mem + FPU_STATE_ALIGN - 1) &
+                                 ~(uint32_t)(FPU_STATE_ALIGN - 1));
+    return 0;
+}
+
+/* Initialize FPU support */
+void fpu_init(void) {
+    vga_print("[+] Initializing FPU...\n");
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    fpu_present = (edx & CPUID_EDX_FPU) != 0;
+    fpu_has_fxsr = (edx & CPUID_EDX_FXSR) != 0;
+    fpu_has_sse = fpu_has_fxsr && (edx & CPUID_EDX_SSE) != 0;
+
+    if (!fpu_present) {
+        vga_print("    No FPU present\n");
+        return;
+    }
+
+    fpu_init_cpu();
+
+    vga_print("    FPU ready (");
+    vga_print(fpu_has_sse ? "FXSR+SSE" : (fpu_has_fxsr ? "FXSR" : "x87"));
+    vga_print(", lazy switching)\n");
+}
+
+/* Enable the FPU of the calling CPU with the features found by fpu_init() */
+void fpu_init_cpu(void) {
+    cpu_current()->fpu_owner = 0;
+
+    if (!fpu_present) {
+        return;
+    }
+
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    if (fpu_has_fxsr) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (fpu_has_sse) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        write_cr4(cr4);
+    }
+
+    fpu_reset();
+
+    /* Nobody owns the FPU yet: trap the first use */
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+/* Arm or disarm the #NM trap for the next process */
+void fpu_switch(process_t* next) {
+    if (!fpu_present) {
+        return;
+    }
+
+    if (next != 0 && next == cpu_current()->fpu_owner) {
+        clts();
+    } else {
+        write_cr0(read_cr0() | CR0_TS);
+    }
+}
+
+/* Device-not-available exception handler */
+void fpu_handle_nm(void) {
+    if (!fpu_present) {
+        vga_print("\n[-] FPU instruction without an FPU\n");
+        while (1) {
+            __asm__ __volatile__("cli; hlt");
+        }
+    }
+
+    cpu_t* cpu = cpu_current();
+    process_t* current = cpu->current;
+
+    clts();
+
+    if (cpu->fpu_owner == current) {
+        return;
+    }
+
+    if (cpu->fpu_owner != 0) {
+        fpu_save(cpu->fpu_owner);
+    }
+
+    if (current == 0) {
+        fpu_reset();
+        cpu->fpu_owner = 0;
+        return;
+    }
+
+    if (fpu_alloc_state(current) != 0) {
+        vga_print("\n[-] Out of memory for FPU state\n");
+        while (1) {
+            __asm__ __volatile__("cli; hlt");
+        }
+    }
+
+    if (current->flags & PROC_FLAG_FPU_USED) {
+        fpu_restore(current);
+    } else {
+        fpu_reset();
+    }
+
+    current->flags |= PROC_FLAG_FPU_USED;
+    current->fpu_cpu = cpu->index;
+    cpu->fpu_owner = current;
+}
+
+/* Release FPU state of a destroyed process */
+void fpu_release(process_t* proc) {
+    if (proc == 0) {
+        return;
+    }
+
+    /* Live state is only ever on the CPU the process last ran on; an
+       exiting process releases it from that CPU (see process_exit) */
+    if (proc->fpu_cpu != CPU_NONE) {
+        cpu_t* cpu = cpu_get(proc->fpu_cpu);
+        if (cpu != 0) {
+            __sync_bool_compare_and_swap(&cpu->fpu_owner, proc, 0);
+        }
+        proc->fpu_cpu = CPU_NONE;
+    }
+
+    if (proc->fpu_alloc != 0) {
+        kfree(proc->fpu_alloc);
+    }
+
+    proc->fpu_alloc = 0;
+    proc->fpu_state = 0;
+    proc->flags &= ~PROC_FLAG_FPU_USED;
+}
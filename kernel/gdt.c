@@ -2,6 +2,7 @@
 /* Licensed under GPLv3 */
 
 #include <kernel/gdt.h>
+#include <kernel/smp.h>
 
 /* Macro to stringify for inline assembly (GDT-specific) */
 #define GDT_STR_HELPER(x) #x
@@ -23,13 +24,15 @@ typedef struct {
     unsigned int base;
 } __attribute__((packed)) gdt_ptr_t;
 
-/* GDT entries */
-static gdt_entry_t gdt[5];
-static gdt_ptr_t gdt_ptr;
+/* GDT and TSS of every CPU. Each CPU has its own GDT so that the same
+   GDT_TSS and GDT_KERNEL_PERCPU selectors resolve to per-CPU data. */
+static gdt_entry_t gdt_tables[MAX_CPUS][GDT_ENTRIES];
+static tss_t tss_table[MAX_CPUS];
 
 /* Function to set a GDT entry */
-static void gdt_set_entry(int num, unsigned int base, unsigned int limit,
-                          unsigned char access, unsigned char gran) {
+static void gdt_set_entry(gdt_entry_t* gdt, int num, unsigned int base,
+                          unsigned int limit, unsigned char access,
+                          unsigned char gran) {
     /* Set base address */
     gdt[num].base_low = (base & 0xFFFF);
     gdt[num].base_middle = (base >> 16) & 0xFF;
@@ -46,15 +49,24 @@ static void gdt_set_entry(int num, unsigned int base, unsigned int limit,
     gdt[num].access = access;
 }
 
-/* Initialize GDT */
+/* Initialize GDT of the boot CPU */
 void gdt_init(void) {
+    gdt_init_cpu(0, (uint32_t)cpu_get(0));
+}
+
+/* Initialize GDT and TSS of one CPU */
+void gdt_init_cpu(uint32_t cpu, uint32_t percpu_base) {
+    gdt_entry_t* gdt = gdt_tables[cpu];
+    tss_t* tss = &tss_table[cpu];
+    gdt_ptr_t gdt_ptr;
+
     /* Setup GDT pointer */
-    gdt_ptr.limit = (sizeof(gdt_entry_t) * 5) - 1;
-    gdt_ptr.base = (unsigned int)&gdt;
+    gdt_ptr.limit = (sizeof(gdt_entry_t) * GDT_ENTRIES) - 1;
+    gdt_ptr.base = (unsigned int)gdt;
 
     /* Clear GDT */
-    for (int i = 0; i < 5; i++) {
-        gdt_set_entry(i, 0, 0, 0, 0);
+    for (int i = 0; i < GDT_ENTRIES; i++) {
+        gdt_set_entry(gdt, i, 0, 0, 0, 0);
     }
 
     /* Set up GDT entries:
@@ -63,19 +75,32 @@ void gdt_init(void) {
      * 2: Kernel Data segment (base=0, limit=4GB, type=data, ring=0)
      * 3: User Code segment (base=0, limit=4GB, type=code, ring=3)
      * 4: User Data segment (base=0, limit=4GB, type=data, ring=3)
+     * 5: TSS of this CPU (32-bit available TSS, byte granular)
+     * 6: Per-CPU data of this CPU (ring 0 data, loaded in FS)
      */
 
     /* Kernel Code Segment */
-    gdt_set_entry(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
+    gdt_set_entry(gdt, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
 
     /* Kernel Data Segment */
-    gdt_set_entry(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+    gdt_set_entry(gdt, 2, 0, 0xFFFFFFFF, 0x92, 0xCF);
 
     /* User Code Segment */
-    gdt_set_entry(3, 0, 0xFFFFFFFF, 0xFA, 0xCF);
+    gdt_set_entry(gdt, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF);
 
     /* User Data Segment */
-    gdt_set_entry(4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
+    gdt_set_entry(gdt, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
+
+    /* Task State Segment */
+    for (uint32_t i = 0; i < sizeof(tss_t); i++) {
+        ((unsigned char*)tss)[i] = 0;
+    }
+    tss->ss0 = GDT_KERNEL_DATA;
+    tss->iomap_base = sizeof(tss_t); /* no I/O permission bitmap */
+    gdt_set_entry(gdt, 5, (unsigned int)tss, sizeof(tss_t) - 1, 0x89, 0x00);
+
+    /* Per-CPU data segment */
+    gdt_set_entry(gdt, 6, percpu_base, 0xFFFFF, 0x92, 0x40);
 
     /* Load GDT and reload segment registers */
     __asm__ __volatile__(
@@ -84,14 +109,23 @@ void gdt_init(void) {
         "movw %1, %%ax\n"               /* Load kernel data segment */
         "movw %%ax, %%ds\n"
         "movw %%ax, %%es\n"
-        "movw %%ax, %%fs\n"
         "movw %%ax, %%gs\n"
         "movw %%ax, %%ss\n"
-        "pushw %2\n"                    /* Push CS selector (16-bit) */
+        "movw %3, %%ax\n"               /* FS points at this CPU's data */
+        "movw %%ax, %%fs\n"
+        "pushl %2\n"                    /* Push CS selector (lretl pops 32 bits) */
         "pushl $1f\n"                   /* Push return address */
         "lretl\n"                       /* Far return to reload CS */
         "1:\n"
-        : : "m"(gdt_ptr), "i"(GDT_KERNEL_DATA), "i"(GDT_KERNEL_CODE)
+        "movw %4, %%ax\n"               /* Load task register */
+        "ltr %%ax\n"
+        : : "m"(gdt_ptr), "i"(GDT_KERNEL_DATA), "i"(GDT_KERNEL_CODE),
+            "i"(GDT_KERNEL_PERCPU), "i"(GDT_TSS)
         : "ax", "memory"
     );
 }
+
+/* Get the TSS of a CPU */
+tss_t* gdt_get_tss(uint32_t cpu) {
+    return &tss_table[cpu];
+}
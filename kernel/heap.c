@@ -5,7 +5,10 @@
 #include <kernel/vmm.h>
 #include <kernel/pmm.h>
 #include <kernel/vga.h>
+#include <kernel/printk.h>
 #include <kernel/string.h>
+#include <kernel/spinlock.h>
+#include <kernel/trace.h>
 
 /* Heap start and size */
 static void* heap_start;
@@ -16,6 +19,10 @@ static heap_block_t* heap_head;
 static uint32_t heap_used;
 static uint32_t heap_free;
 
+/* Protects the block list and the statistics. Nests outside pmm_lock
+   (heap growth allocates frames), so never kmalloc with pmm_lock held */
+static spinlock_t heap_lock = SPINLOCK_INIT("heap");
+
 /* Align size to alignment boundary */
 static inline uint32_t align_size(uint32_t size, uint32_t alignment) {
     return (size + alignment - 1) & ~(alignment - 1);
@@ -117,10 +124,7 @@ void heap_init(void* start, uint32_t size) {
 }
 
 /* Allocate memory */
-void* kmalloc(uint32_t size) {
-    if (size == 0) {
-        return 0;
-    }
+static void* kmalloc_locked(uint32_t size) {
 
     /* Find free block */
     heap_block_t* block = find_free_block(size);
@@ -160,7 +164,7 @@ void* kmalloc(uint32_t size) {
     }
 
     if (block == 0) {
-        vga_print("[-] Error: Out of memory!\n");
+        kprintf(KLOG_ERR, "[-] Error: Out of memory!\n");
         return 0;
     }
 
@@ -175,23 +179,31 @@ void* kmalloc(uint32_t size) {
     return (void*)((uint8_t*)block + sizeof(heap_block_t));
 }
 
-/* Free memory */
-void kfree(void* ptr) {
-    if (ptr == 0) {
-        return;
+void* kmalloc(uint32_t size) {
+    if (size == 0) {
+        return 0;
     }
 
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = kmalloc_locked(size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    TRACE(TRACE_KMALLOC, ptr, size, 0, 0);
+    return ptr;
+}
+
+/* Free memory */
+static void kfree_locked(void* ptr) {
     heap_block_t* block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
 
     /* Check magic */
     if (block->magic != HEAP_MAGIC) {
-        vga_print("[-] Error: Invalid heap block!\n");
+        kprintf(KLOG_ERR, "[-] Error: Invalid heap block %p\n", ptr);
         return;
     }
 
     /* Check if already free */
     if (block->is_free) {
-        vga_print("[-] Warning: Double free detected!\n");
+        kprintf(KLOG_WARN, "[-] Warning: Double free of %p detected!\n", ptr);
         return;
     }
 
@@ -204,6 +216,18 @@ void kfree(void* ptr) {
     merge_blocks(block);
 }
 
+void kfree(void* ptr) {
+    if (ptr == 0) {
+        return;
+    }
+
+    TRACE(TRACE_KFREE, ptr, 0, 0, 0);
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    kfree_locked(ptr);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
 /* Reallocate memory */
 void* krealloc(void* ptr, uint32_t size) {
     if (ptr == 0) {
@@ -2,12 +2,20 @@
 /* Licensed under GPLv3 */
 
 #include <kernel/idt.h>
+#include <kernel/fpu.h>
 #include <kernel/vga.h>
 #include <kernel/io.h>
 #include <kernel/gdt.h>
+#include <kernel/irq.h>
+#include <kernel/lapic.h>
 #include <kernel/vmm.h>
+#include <kernel/printk.h>
 #include <kernel/scheduler.h>
-#include <kernel/timer.h>
+#include <kernel/serial.h>
+#include <kernel/smp.h>
+#include <kernel/syscall.h>
+#include <kernel/softirq.h>
+#include <kernel/trace.h>
 
 /* IDT entry structure (for 32-bit) */
 typedef struct {
@@ -24,6 +32,10 @@ typedef struct {
     unsigned int base;
 } __attribute__((packed)) idt_ptr_t;
 
+/* isr_common_stub reads these fields (kernel/isr.asm) */
+_Static_assert(offsetof(registers_t, int_no) == 48, "REGS_INT_NO");
+_Static_assert(offsetof(registers_t, cs) == 60, "REGS_CS");
+
 /* IDT entries */
 static idt_entry_t idt[256];
 static idt_ptr_t idt_ptr;
@@ -80,6 +92,14 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+/* Local APIC vectors */
+extern void isr48(void); /* LAPIC timer */
+extern void isr49(void); /* Reschedule IPI */
+extern void isr50(void); /* Tick IPI */
+
+/* System call gate */
+extern void isr128(void);
+
 /* Default interrupt handler stub (assembly) */
 extern void isr_default(void);
 extern void isr_common_stub(void);
@@ -102,8 +122,25 @@ registers_t* isr_handler(registers_t *regs) {
 
     /* Identify which interrupt occurred */
     if (regs->int_no < 32) {
+        /* A fault in ring 3 ends only the offending process (the lazy FPU
+           trap is not a fault) */
+        if ((regs->cs & 3) == 3 && regs->int_no != 7) {
+            vga_print("\n[-] Process ");
+            vga_print(process_get_current()->name);
+            vga_print(" killed by exception ");
+            vga_print_dec(regs->int_no);
+            vga_print(" at ");
+            vga_print_hex(regs->eip);
+            vga_print("\n");
+            process_exit(-1);
+        }
+
         /* Exception handling */
         switch (regs->int_no) {
+            case 7: /* Device not available: lazy FPU switch */
+                fpu_handle_nm();
+                break;
+
             case 14: /* Page fault */
                 vmm_page_fault_handler(regs->err_code);
                 break;
@@ -111,11 +148,13 @@ registers_t* isr_handler(registers_t *regs) {
             default:
                 /* Prevent further interrupts while we print halt message */
                 __asm__ __volatile__("cli");
+                klog_flush();
                 vga_print("\n[EXCEPTION] ");
                 vga_print_dec(regs->int_no);
                 vga_print(" - Error Code: ");
                 vga_print_hex(regs->err_code);
                 vga_print("\nKernel Halted.\n");
+                serial_flush();
                 while (1) {
                     __asm__ __volatile__("hlt");
                 }
@@ -125,38 +164,68 @@ registers_t* isr_handler(registers_t *regs) {
         return regs;
     }
 
-    if (regs->int_no >= 32 && regs->int_no <= 47) {
+    if (regs->int_no == SYSCALL_VECTOR) {
+        /* Interrupt gate: run the call with interrupts enabled like the
+           SYSENTER path, then restore the frame's return value */
+        __asm__ __volatile__("sti");
+        regs->eax = (unsigned int)syscall_dispatch(regs->eax, regs->ebx,
+                                                   regs->esi, regs->edi);
+        __asm__ __volatile__("cli");
+        return regs;
+    }
+
+    if (regs->int_no >= IRQ_VECTOR_FIRST && regs->int_no <= IRQ_VECTOR_LAST) {
+        cpu_t* cpu = cpu_current();
         registers_t* new_regs = regs;
+        cpu->irq_depth++;
+        TRACE(TRACE_IRQ_ENTRY, regs->int_no, 0, 0, 0);
 
         /* Send EOI early before scheduler_tick (which may context switch).
            Safety: Scheduler must not assume IRQ ownership after EOI.
-           - EOI acknowledges IRQ to PIC, allowing nested IRQs if re-enabled
+           - EOI acknowledges the interrupt (local APIC, or PIC without an
+             I/O APIC), allowing nested IRQs if re-enabled
            - Scheduler only selects next process and returns registers_t*
            - Assembly stub (isr_common_stub) uses returned pointer to restore context
            - iret restores EFLAGS which re-enables interrupts
            This is safe because no code assumes IRQ state after EOI. */
-        if (regs->int_no >= 40) {
-            /* Slave PIC */
-            outb(0xA0, 0x20);
+        irq_eoi(regs->int_no);
+
+        int result = irq_dispatch(regs);
+
+        /* Bottom halves run once the outermost handler is done, with
+           interrupts enabled, before we decide what to return to */
+        if (cpu->irq_depth == 1 && cpu->softirq_pending) {
+            softirq_run();
         }
-        /* Master PIC */
-        outb(0x20, 0x20);
 
-        /* IRQ0: PIT timer */
-        if (regs->int_no == 32) {
-            timer_increment_tick();
+        if (result & IRQ_TICK) {
             new_regs = scheduler_tick(regs);
             if (new_regs == 0) {
                 new_regs = regs;
             }
+        } else if (cpu->need_resched) {
+            /* A handler or another CPU woke a process that should run here
+               now (also the only job of the reschedule IPI). */
+            new_regs = scheduler_preempt(regs);
         }
 
+        TRACE(TRACE_IRQ_EXIT, regs->int_no, result, 0, 0);
+        cpu->irq_depth--;
         return new_regs;
     }
 
     return regs;
 }
 
+int idt_in_interrupt(void) {
+    return cpu_current()->irq_depth != 0;
+}
+
+/* Load the IDT on the calling CPU (APs share the BSP's table) */
+void idt_load(void) {
+    __asm__ __volatile__("lidt %0" : : "m"(idt_ptr));
+}
+
 /* Initialize IDT */
 void idt_init(void) {
     /* Setup IDT pointer */
@@ -211,8 +280,10 @@ void idt_init(void) {
     outb(0xA1, 0x02);
     outb(0x21, 0x01);
     outb(0xA1, 0x01);
-    outb(0x21, 0x0);
-    outb(0xA1, 0x0);
+    /* Mask every line but the cascade; irq_register_handler() unmasks
+       the ones that get a handler */
+    outb(0x21, 0xFB);
+    outb(0xA1, 0xFF);
 
     /* Set up IRQ handlers */
     idt_set_gate(32, (unsigned int)irq0, GDT_KERNEL_CODE, 0x8E);
@@ -232,6 +303,14 @@ void idt_init(void) {
     idt_set_gate(46, (unsigned int)irq14, GDT_KERNEL_CODE, 0x8E);
     idt_set_gate(47, (unsigned int)irq15, GDT_KERNEL_CODE, 0x8E);
 
+    /* Local APIC timer and inter-processor interrupts */
+    idt_set_gate(LAPIC_TIMER_VECTOR, (unsigned int)isr48, GDT_KERNEL_CODE, 0x8E);
+    idt_set_gate(IPI_RESCHEDULE_VECTOR, (unsigned int)isr49, GDT_KERNEL_CODE, 0x8E);
+    idt_set_gate(IPI_TICK_VECTOR, (unsigned int)isr50, GDT_KERNEL_CODE, 0x8E);
+
+    /* int 0x80: interrupt gate with DPL 3 so ring 3 may raise it */
+    idt_set_gate(SYSCALL_VECTOR, (unsigned int)isr128, GDT_KERNEL_CODE, 0xEE);
+
     /* Load IDT */
-    __asm__ __volatile__("lidt %0" : : "m"(idt_ptr));
+    idt_load();
 }
@@ -0,0 +1,64 @@
+/* SYNAPSE SO - ACPI Table Discovery */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_ACPI_H
+#define KERNEL_ACPI_H
+
+#include <stdint.h>
+
+/* Maximum number of processors recorded from the MADT */
+#define ACPI_MAX_CPUS 16
+
+/* Maximum number of I/O APICs recorded from the MADT */
+#define ACPI_MAX_IOAPICS 4
+
+/* Number of legacy ISA IRQs */
+#define ACPI_ISA_IRQS 16
+
+/* MPS INTI flags of an interrupt source override */
+#define ACPI_INTI_POLARITY_MASK 0x3
+#define ACPI_INTI_ACTIVE_HIGH   0x1
+#define ACPI_INTI_ACTIVE_LOW    0x3
+#define ACPI_INTI_TRIGGER_MASK  0xC
+#define ACPI_INTI_EDGE          0x4
+#define ACPI_INTI_LEVEL         0xC
+
+/* Common header of every ACPI system description table */
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+/* Locate the RSDP and RSDT and parse the MADT (APIC table).
+ * Returns 0 on success, -1 if no usable MADT was found. */
+int acpi_init(void);
+
+/* Find a table by its 4-character signature (0 if absent) */
+acpi_sdt_header_t* acpi_find_table(const char* signature);
+
+/* Physical address of the local APIC registers */
+uint32_t acpi_get_lapic_addr(void);
+
+/* Number of enabled processors listed in the MADT */
+uint32_t acpi_get_cpu_count(void);
+
+/* Local APIC ID of MADT processor index */
+uint8_t acpi_get_cpu_apic_id(uint32_t index);
+
+/* I/O APICs listed in the MADT: register base and first GSI */
+uint32_t acpi_get_ioapic_count(void);
+uint32_t acpi_get_ioapic_addr(uint32_t index);
+uint32_t acpi_get_ioapic_gsi_base(uint32_t index);
+
+/* Global system interrupt an ISA IRQ is wired to, after interrupt source
+ * overrides. flags receives the MPS INTI flags (0 = ISA defaults). */
+uint32_t acpi_isa_irq_to_gsi(uint8_t irq, uint16_t* flags);
+
+#endif /* KERNEL_ACPI_H */
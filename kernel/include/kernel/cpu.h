@@ -0,0 +1,115 @@
+/* SYNAPSE SO - CPU Feature and Control Register Helpers */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_CPU_H
+#define KERNEL_CPU_H
+
+#include <stdint.h>
+
+/* EFLAGS interrupt enable flag */
+#define EFLAGS_IF (1 << 9)
+
+/* CR0 bits */
+#define CR0_MP (1 << 1)  /* Monitor coprocessor: WAIT honors TS */
+#define CR0_EM (1 << 2)  /* Emulate FPU: every FPU instruction traps */
+#define CR0_TS (1 << 3)  /* Task switched: next FPU/SSE use raises #NM */
+#define CR0_NE (1 << 5)  /* Native FPU error reporting */
+
+/* CR4 bits */
+#define CR4_OSFXSR     (1 << 9)   /* FXSAVE/FXRSTOR and SSE enabled */
+#define CR4_OSXMMEXCPT (1 << 10)  /* Unmasked SSE exceptions raise #XM */
+
+/* CPUID leaf 1 EDX feature bits */
+#define CPUID_EDX_FPU  (1 << 0)
+#define CPUID_EDX_TSC  (1 << 4)
+#define CPUID_EDX_MSR  (1 << 5)
+#define CPUID_EDX_APIC (1 << 9)
+#define CPUID_EDX_FXSR (1 << 24)
+#define CPUID_EDX_SSE  (1 << 25)
+#define CPUID_EDX_SSE2 (1 << 26)
+
+/* CPUID leaf 1 ECX feature bits */
+#define CPUID_ECX_TSC_DEADLINE (1 << 24)
+
+/* CPUID leaf 7 (subleaf 0) EBX feature bits */
+#define CPUID_LEAF_EXT_FEATURES 7
+#define CPUID_EBX_ERMS         (1 << 9)   /* fast REP MOVSB/STOSB */
+
+/* CPUID leaf 0x80000007 EDX: TSC rate independent of P/C-states */
+#define CPUID_EXT_POWER        0x80000007
+#define CPUID_EDX_INVARIANT_TSC (1 << 8)
+
+/* Model specific registers */
+#define MSR_IA32_TSC_DEADLINE 0x6E0
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx,
+                         uint32_t* ecx, uint32_t* edx) {
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                         : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t val;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr0(uint32_t val) {
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(val) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t val;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr4(uint32_t val) {
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(val) : "memory");
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__("wrmsr"
+                         : : "c"(msr), "a"((uint32_t)val),
+                             "d"((uint32_t)(val >> 32))
+                         : "memory");
+}
+
+/* Clear CR0.TS */
+static inline void clts(void) {
+    __asm__ __volatile__("clts" ::: "memory");
+}
+
+/* Disable interrupts, returning the previous EFLAGS for irq_restore() */
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ __volatile__("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+/* Re-enable interrupts if they were enabled when irq_save() was called */
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ __volatile__("sti" ::: "memory");
+    }
+}
+
+/* Spin-wait hint */
+static inline void cpu_relax(void) {
+    __asm__ __volatile__("pause" ::: "memory");
+}
+
+#endif /* KERNEL_CPU_H */
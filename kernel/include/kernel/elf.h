@@ -113,6 +113,9 @@ typedef struct {
 #define SHF_ALLOC 0x2
 #define SHF_EXECINSTR 0x4
 
+/* Lowest address a user segment may use (USER_SPACE_START) */
+#define ELF_USER_BASE 0x400000
+
 /* ELF loader functions */
 int elf_check_header(elf32_header_t* header);
 int elf_load(uint8_t* elf_data, uint32_t size, uint32_t* entry_point);
@@ -0,0 +1,34 @@
+/* SYNAPSE SO - Lazy FPU/SSE Context Switching */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_FPU_H
+#define KERNEL_FPU_H
+
+#include <stdint.h>
+#include <kernel/process.h>
+
+/* FXSAVE area size and required alignment */
+#define FPU_STATE_SIZE  512
+#define FPU_STATE_ALIGN 16
+
+/* Default MXCSR: all SSE exceptions masked, round to nearest */
+#define FPU_MXCSR_DEFAULT 0x1F80
+
+/* Detect the FPU, enable FXSR/SSE and arm lazy switching */
+void fpu_init(void);
+
+/* Enable the FPU of an application processor (after fpu_init on the BSP) */
+void fpu_init_cpu(void);
+
+/* Called on every context switch: sets CR0.TS unless next still owns the
+ * FPU registers, so the first FPU/SSE instruction of next raises #NM. */
+void fpu_switch(process_t* next);
+
+/* #NM (ISR 7) handler: save the previous owner, restore the current
+ * process (or give it a clean FPU) and clear CR0.TS. */
+void fpu_handle_nm(void);
+
+/* Drop a process's FPU state (called when the PCB is destroyed) */
+void fpu_release(process_t* proc);
+
+#endif /* KERNEL_FPU_H */
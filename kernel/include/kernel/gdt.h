@@ -4,18 +4,48 @@
 #ifndef KERNEL_GDT_H
 #define KERNEL_GDT_H
 
+#include <stdint.h>
 
-/* GDT initialization function */
+/* GDT initialization function (boot CPU) */
 void gdt_init(void);
 
+/* Build and load the GDT and TSS of one CPU. percpu_base is the address
+ * the GDT_KERNEL_PERCPU segment (loaded in FS) points at. */
+void gdt_init_cpu(uint32_t cpu, uint32_t percpu_base);
+
 /* Segment selectors */
 #define GDT_KERNEL_CODE 0x08
 #define GDT_KERNEL_DATA 0x10
 #define GDT_USER_CODE   0x1B
 #define GDT_USER_DATA   0x23
+#define GDT_TSS         0x28
+#define GDT_KERNEL_PERCPU 0x30
+
+/* Entries per GDT: null, kernel code/data, user code/data, TSS, per-CPU */
+#define GDT_ENTRIES 7
+
 /* Compile-time sanity checks: kernel selectors must have RPL 0, user selectors RPL 3 */
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
 _Static_assert((GDT_KERNEL_CODE & 0x3) == 0, "GDT_KERNEL_CODE must have RPL 0");
 _Static_assert((GDT_USER_CODE & 0x3) == 3, "GDT_USER_CODE must have RPL 3");
 #endif
+
+/* 32-bit Task State Segment. Only ss0/esp0 (the ring-0 stack loaded on a
+ * privilege change) are used; there is no hardware task switching. */
+typedef struct {
+    uint32_t prev_tss;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+/* Get the TSS of a CPU */
+tss_t* gdt_get_tss(uint32_t cpu);
+
 #endif /* KERNEL_GDT_H */
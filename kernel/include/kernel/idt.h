@@ -19,12 +19,18 @@ typedef struct {
 /* IDT initialization function */
 void idt_init(void);
 
+/* Load the IDT on the calling CPU */
+void idt_load(void);
+
 /* ISR handler function (called from assembly)
  * Returns a pointer to the register frame to restore. This enables
  * scheduler-driven context switching by returning a different frame.
  */
 registers_t* isr_handler(registers_t *regs);
 
+/* Non-zero while an IRQ handler is running on this CPU */
+int idt_in_interrupt(void);
+
 #ifdef __cplusplus
 }
 #endif
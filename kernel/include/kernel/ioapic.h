@@ -0,0 +1,38 @@
+/* SYNAPSE SO - I/O APIC */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_IOAPIC_H
+#define KERNEL_IOAPIC_H
+
+#include <stdint.h>
+
+/* Indirect register access: select, then read or write the window */
+#define IOAPIC_REG_SELECT   0x00
+#define IOAPIC_REG_WINDOW   0x10
+
+/* Registers behind the window */
+#define IOAPIC_ID           0x00
+#define IOAPIC_VERSION      0x01
+#define IOAPIC_REDTBL(n)    (0x10 + 2 * (n))
+
+/* Redirection entry, low dword (fixed delivery, physical destination) */
+#define IOAPIC_RTE_ACTIVE_LOW   (1 << 13)
+#define IOAPIC_RTE_LEVEL        (1 << 15)
+#define IOAPIC_RTE_MASKED       (1 << 16)
+
+/* Map every I/O APIC listed in the MADT and mask all of its inputs.
+ * Returns 0 if at least one I/O APIC is usable, -1 otherwise. */
+int ioapic_init(void);
+
+/* Non-zero once ioapic_init() found an I/O APIC */
+int ioapic_present(void);
+
+/* Route a legacy ISA IRQ (after MADT overrides) to vector on the CPU with
+ * the given APIC ID. The entry is left masked. */
+void ioapic_route_isa(uint8_t irq, uint8_t vector, uint8_t apic_id);
+
+/* Mask or unmask a routed ISA IRQ */
+void ioapic_mask_isa(uint8_t irq);
+void ioapic_unmask_isa(uint8_t irq);
+
+#endif /* KERNEL_IOAPIC_H */
@@ -0,0 +1,88 @@
+/* SYNAPSE SO - Synchronous Message Passing */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_IPC_H
+#define KERNEL_IPC_H
+
+#include <stdint.h>
+
+/* Processes exchange messages through endpoints. Sends are synchronous:
+ * a sender blocks until a receiver takes its message, a receiver until a
+ * message arrives. When the other side is already waiting, the message
+ * goes straight into its PCB and the CPU is handed to it without passing
+ * through a run queue (ipc_call/ipc_reply round trips run back to back on
+ * one CPU).
+ *
+ * Besides a few inline words a message can carry whole pages. They are
+ * moved, not copied: their PTEs leave the sender's address space and
+ * reappear in the receive window of the receiver. With IPC_MSG_SHARE the
+ * sender keeps them too, and the frames live until both sides unmap. */
+
+#define IPC_MAX_ENDPOINTS   64
+#define IPC_MSG_WORDS       4
+#define IPC_MAX_PAGES       64      /* 256KB per message */
+
+/* Message descriptor in user memory */
+typedef struct {
+    uint32_t words[IPC_MSG_WORDS];  /* inline payload */
+    uint32_t page_addr;     /* send: first page to move; receive: window */
+    uint32_t page_count;    /* send: pages to move; receive: window size,
+                               on return the number of pages received */
+    uint32_t sender;        /* on receive: PID of the sender */
+    uint32_t flags;         /* send: IPC_MSG_* */
+} ipc_msg_t;
+
+/* Message flags */
+#define IPC_MSG_SHARE       (1 << 0)    /* share the pages instead of moving */
+
+/* What a process is blocked on (ipc_state_t.state) */
+#define IPC_STATE_NONE      0
+#define IPC_STATE_SEND      1   /* queued on an endpoint */
+#define IPC_STATE_RECV      2   /* waiting for a message on an endpoint */
+#define IPC_STATE_REPLY     3   /* called, waiting for the reply */
+
+/* Per-process IPC state. The message staged here is the one the process
+ * is sending while queued, or the one delivered to it while it waits. */
+typedef struct {
+    uint32_t state;
+    uint32_t endpoint;
+    int32_t status;                 /* result of the blocked operation */
+    uint32_t words[IPC_MSG_WORDS];
+    uint32_t page_addr;
+    uint32_t page_count;
+    uint32_t sender;
+    uint32_t flags;
+    uint32_t is_call;               /* queued message expects a reply */
+    struct process* queue_next;     /* endpoint send queue */
+    struct process* reply_to;       /* caller owed a reply */
+} ipc_state_t;
+
+/* Create an endpoint owned by the calling process. Returns its ID or -1. */
+int32_t ipc_create(void);
+
+/* Destroy an endpoint of the calling process; blocked senders and the
+ * receiver fail with -1 */
+int32_t ipc_destroy(uint32_t endpoint);
+
+/* Send msg and block until a receiver takes it. Returns 0, or -1 for a bad
+ * endpoint or descriptor, or when the pages do not fit the receive
+ * window. */
+int32_t ipc_send(uint32_t endpoint, ipc_msg_t* msg);
+
+/* Block until a message arrives on endpoint and store it in msg. Returns
+ * 0 or -1. Only one process may wait on an endpoint at a time, and a
+ * process that owes a reply must send it before receiving again. */
+int32_t ipc_recv(uint32_t endpoint, ipc_msg_t* msg);
+
+/* Send msg, then wait for the receiver's ipc_reply() and store the reply
+ * in msg. The reply window is the range the call's pages left, so only a
+ * call that moved pages can get pages back. */
+int32_t ipc_call(uint32_t endpoint, ipc_msg_t* msg);
+
+/* Answer the last call received. Never blocks. Returns 0 or -1. */
+int32_t ipc_reply(ipc_msg_t* msg);
+
+/* Drop the endpoints and pending reply of an exiting process */
+void ipc_process_exit(struct process* proc);
+
+#endif /* KERNEL_IPC_H */
@@ -0,0 +1,72 @@
+/* SYNAPSE SO - Interrupt Controller Routing */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_IRQ_H
+#define KERNEL_IRQ_H
+
+#include <stdint.h>
+#include <kernel/idt.h>
+
+/* Vector of ISA IRQ 0; IRQs 0-15 use vectors 32-47 through either the
+ * remapped 8259 PIC or the I/O APIC */
+#define IRQ_BASE_VECTOR 32
+#define IRQ_COUNT       16
+
+/* Vectors that can take handlers: the ISA IRQs and the local APIC timer
+ * and IPI vectors, which are the ones with their own IDT stub */
+#define IRQ_VECTOR_FIRST    IRQ_BASE_VECTOR
+#define IRQ_VECTOR_LAST     50      /* IPI_TICK_VECTOR */
+#define IRQ_VECTOR_COUNT    (IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1)
+
+/* Handler results, ORed together over the handlers of a vector */
+#define IRQ_NONE        0           /* not raised by this handler's device */
+#define IRQ_HANDLED     (1 << 0)
+#define IRQ_TICK        (1 << 1)    /* run scheduler_tick() on the way out */
+
+/* Runs with interrupts disabled after the EOI; must not block. ctx is the
+ * pointer given at registration. */
+typedef int (*irq_handler_t)(registers_t* regs, void* ctx);
+
+/* 8259 PIC ports */
+#define PIC1_COMMAND    0x20
+#define PIC1_DATA       0x21
+#define PIC2_COMMAND    0xA0
+#define PIC2_DATA       0xA1
+#define PIC_EOI         0x20
+
+/* Discover the interrupt controllers from the ACPI MADT. With an I/O APIC
+ * the 8259 PIC is masked and ISA IRQs are routed to the boot CPU (masked
+ * until irq_unmask()); without one the PIC stays in charge. */
+void irq_init(void);
+
+/* Non-zero when ISA IRQs arrive through the I/O APIC */
+int irq_apic_mode(void);
+
+/* Acknowledge an interrupt vector to whichever controller delivered it */
+void irq_eoi(uint32_t vector);
+
+/* Enable or disable delivery of an ISA IRQ */
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+
+/* Add a handler to a vector. Several handlers may share one; they run in
+ * registration order and each checks whether its device raised the line.
+ * The first handler on an ISA vector unmasks its IRQ. Returns 0, or -1
+ * for a bad vector, a duplicate, or when out of memory. */
+int irq_register_handler(uint32_t vector, irq_handler_t fn, void* ctx);
+
+/* Remove a handler added with the same fn and ctx; the last one masks the
+ * IRQ again. Waits until no CPU can still be running it, so it may
+ * schedule and must not be called from interrupt context. */
+int irq_unregister_handler(uint32_t vector, irq_handler_t fn, void* ctx);
+
+/* Run the handlers of regs->int_no and return their combined result. An
+ * ISA IRQ nobody handles is masked. */
+int irq_dispatch(registers_t* regs);
+
+/* Interrupts taken on a vector, and how many no handler claimed, summed
+ * over all CPUs */
+uint32_t irq_get_count(uint32_t vector);
+uint32_t irq_get_unhandled(uint32_t vector);
+
+#endif /* KERNEL_IRQ_H */
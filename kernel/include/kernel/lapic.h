@@ -0,0 +1,94 @@
+/* SYNAPSE SO - Local APIC */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_LAPIC_H
+#define KERNEL_LAPIC_H
+
+#include <stdint.h>
+
+/* Interrupt vectors delivered by the local APIC (above the PIC's 32-47) */
+#define LAPIC_TIMER_VECTOR      48
+#define IPI_RESCHEDULE_VECTOR   49
+#define IPI_TICK_VECTOR         50
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+/* Register offsets */
+#define LAPIC_REG_ID        0x020
+#define LAPIC_REG_VERSION   0x030
+#define LAPIC_REG_TPR       0x080
+#define LAPIC_REG_EOI       0x0B0
+#define LAPIC_REG_SVR       0x0F0
+#define LAPIC_REG_ESR       0x280
+#define LAPIC_REG_ICR_LOW   0x300
+#define LAPIC_REG_ICR_HIGH  0x310
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_LVT_LINT0 0x350
+#define LAPIC_REG_LVT_LINT1 0x360
+#define LAPIC_REG_LVT_ERROR 0x370
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE  0x3E0
+
+/* Local vector table entries */
+#define LAPIC_LVT_MASKED            (1 << 16)
+#define LAPIC_LVT_TIMER_PERIODIC    (1 << 17)
+#define LAPIC_LVT_TIMER_TSC_DEADLINE (2 << 17)
+
+/* Timer divide configuration: bus clock / 16 */
+#define LAPIC_TIMER_DIV_16  0x3
+
+/* Spurious interrupt vector register: software enable */
+#define LAPIC_SVR_ENABLE    (1 << 8)
+
+/* Interrupt command register */
+#define LAPIC_ICR_FIXED     0x00000
+#define LAPIC_ICR_INIT      0x00500
+#define LAPIC_ICR_STARTUP   0x00600
+#define LAPIC_ICR_PENDING   (1 << 12)
+#define LAPIC_ICR_ASSERT    (1 << 14)
+#define LAPIC_ICR_LEVEL     (1 << 15)
+
+/* Map the local APIC registers at phys_base (BSP, once) */
+void lapic_init(uint32_t phys_base);
+
+/* Software-enable the local APIC of the calling CPU */
+void lapic_init_cpu(void);
+
+/* Non-zero once lapic_init() has mapped the registers */
+int lapic_present(void);
+
+/* Local APIC ID of the calling CPU */
+uint32_t lapic_id(void);
+
+/* Signal end of interrupt to the calling CPU's local APIC */
+void lapic_eoi(void);
+
+/* Stop the local APIC from passing through 8259 interrupts (LINT0 ExtINT)
+ * once the I/O APIC delivers them */
+void lapic_mask_lint0(void);
+
+/* Calibrate the local APIC timer against the PIT and start it on the
+ * calling CPU at frequency_hz. Uses TSC-deadline mode when the CPU has it,
+ * periodic mode otherwise. Returns 0 on success, -1 to fall back to the
+ * PIT. */
+int lapic_timer_init(uint32_t frequency_hz);
+
+/* Start the calibrated timer on the calling CPU (no-op before
+ * lapic_timer_init()) */
+void lapic_timer_start_cpu(void);
+
+/* Program the next tick; called from the timer interrupt */
+void lapic_timer_rearm(void);
+
+/* Non-zero once the local APIC timer is the tick source */
+int lapic_timer_active(void);
+
+/* Send a fixed interrupt to the CPU with the given APIC ID */
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector);
+
+/* INIT and STARTUP IPIs used to boot an application processor. The
+ * startup page is the physical page number of the real-mode entry. */
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint32_t page);
+
+#endif /* KERNEL_LAPIC_H */
@@ -15,6 +15,15 @@
 /* Number of frames in 4GB address space */
 #define MAX_FRAMES (MAX_MEMORY / FRAME_SIZE)
 
+/* Size of the table holding the reference counts of shared frames (a
+ * power of two; at most half of it is used) */
+#define PMM_SHARED_FRAMES 4096
+
+/* Frames the idle threads keep zeroed ahead of demand, and the free frames
+ * they leave alone when memory runs low */
+#define PMM_ZERO_POOL       64
+#define PMM_ZERO_RESERVE    256
+
 /* Frame states */
 #define FRAME_FREE 0
 #define FRAME_USED 1
@@ -40,9 +49,26 @@ void pmm_init(mem_map_t* mmap, uint32_t mmap_size, uint32_t mmap_desc_size);
 /* Allocate a physical frame */
 uint32_t pmm_alloc_frame(void);
 
-/* Free a physical frame */
+/* Allocate a frame filled with zeroes. Taken from the pre-zeroed pool
+ * when it has one, so the caller does not pay for the clearing. */
+uint32_t pmm_alloc_zeroed_frame(void);
+
+/* Zero one free frame into the pool. Returns 1 if it did, 0 if the pool
+ * is full or memory is short. Run by the idle threads. */
+int pmm_zero_pool_refill(void);
+
+/* Drop a reference to a physical frame. A frame is allocated with one
+ * reference and freed when its last one is dropped. */
 void pmm_free_frame(uint32_t frame_addr);
 
+/* Take another reference to an allocated frame, for sharing it between
+ * address spaces. Returns 0, or -1 if the frame is free or the table of
+ * shared frames is full. */
+int pmm_ref_frame(uint32_t frame_addr);
+
+/* Get the number of references to a frame (0 if it is free) */
+uint32_t pmm_frame_refcount(uint32_t frame_addr);
+
 /* Get number of free frames */
 uint32_t pmm_get_free_frames(void);
 
@@ -0,0 +1,67 @@
+/* SYNAPSE SO - Kernel Log */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_PRINTK_H
+#define KERNEL_PRINTK_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/* kprintf() formats into the caller's stack and appends the line to a
+ * lock-free ring; the "klogd" workqueue thread later writes it to the VGA
+ * and serial consoles. The caller never waits on a console, a console
+ * lock or another CPU, so it is safe where vga_print is too slow (with
+ * locks held, in interrupt handlers). A full ring drops the message and
+ * klogd reports how many were lost.
+ *
+ * Not for the scheduler itself: waking klogd takes a run queue lock. */
+
+/* Levels, most severe first */
+#define KLOG_ERR            0
+#define KLOG_WARN           1
+#define KLOG_INFO           2
+#define KLOG_DEBUG          3
+
+/* Messages above this level are compiled out, arguments and format
+ * strings included (make LOG_LEVEL=n) */
+#ifndef CONFIG_LOG_LEVEL
+#define CONFIG_LOG_LEVEL    KLOG_INFO
+#endif
+
+/* Longest line kept, NUL included; the rest is cut off */
+#define KLOG_LINE_MAX       128
+
+/* Ring size in 32-bit entries (power of two); a line takes one header
+ * entry plus one per 4 characters */
+#define KLOG_RING_ENTRIES   4096
+
+/* Formats: %d %i %u %x %X %p %s %c %%, with '-' or '0' flags and a field
+ * width. 'l' and 'h' are accepted and ignored (everything is 32 bits). */
+#define kprintf(level, ...) \
+    do { \
+        if ((level) <= CONFIG_LOG_LEVEL) { \
+            klog_write((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+void klog_write(uint32_t level, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Format into buf (always NUL-terminated when size > 0). Returns the
+ * number of characters stored. */
+uint32_t ksnprintf(char* buf, uint32_t size, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+uint32_t kvsnprintf(char* buf, uint32_t size, const char* fmt, va_list args);
+
+/* Set up the ring; earlier messages go straight to the console */
+void klog_init(void);
+
+/* Start klogd (after workqueue_init()). Until then every kprintf()
+ * flushes the ring itself. */
+void klog_start(void);
+
+/* Write out what is queued, in the caller. For paths that halt right after
+ * printing. Returns at once if another CPU is already flushing. */
+void klog_flush(void);
+
+#endif /* KERNEL_PRINTK_H */
@@ -5,6 +5,7 @@
 #define KERNEL_PROCESS_H
 
 #include <stdint.h>
+#include <kernel/ipc.h>
 #include <kernel/vmm.h>
 
 /* Process states */
@@ -16,6 +17,25 @@
 
 /* Process flags */
 #define PROC_FLAG_KERNEL    (1 << 0)
+#define PROC_FLAG_FPU_USED  (1 << 1)  /* has FPU context (live or saved) */
+#define PROC_FLAG_DETACHED  (1 << 2)  /* reaped on exit, cannot be waited */
+#define PROC_FLAG_IDLE      (1 << 3)  /* per-CPU idle thread, never queued */
+
+/* Zombies released per reaper pass before it yields */
+#define PROC_REAP_BATCH     16
+
+/* Ready-to-running latency histogram: bucket 0 counts 0 ticks, bucket n
+ * counts [2^(n-1), 2^n) ticks, the last bucket everything above. */
+#define PROC_LAT_BUCKETS    8
+
+/* Saved context kinds (what process_t.esp points at) */
+#define PROC_CONTEXT_IRQ    0  /* registers_t frame from isr_common_stub */
+#define PROC_CONTEXT_SWITCH 1  /* callee-saved frame from context_switch */
+
+/* Scheduling classes (highest first: EDF > FIFO > NORMAL) */
+#define SCHED_CLASS_NORMAL  0
+#define SCHED_CLASS_FIFO    1
+#define SCHED_CLASS_EDF     2
 
 /* Process ID */
 typedef uint32_t pid_t;
@@ -23,7 +43,7 @@ typedef uint32_t pid_t;
 /* Forward declaration for process list */
 typedef struct process process_t;
 
-/* Global process list (extern for scheduler access) */
+/* Global process list: NULL-terminated, walk it under rcu_read_lock() */
 extern process_t* process_list;
 
 /* Process Control Block */
@@ -39,7 +59,7 @@ typedef struct process {
     page_directory_t* page_dir;
     uint32_t heap_start;
     uint32_t heap_end;
-    uint32_t stack_start;
+    uint32_t stack_start;       /* kernel stack; TSS esp0 points at its end */
     uint32_t stack_end;
 
     /* CPU context */
@@ -51,7 +71,7 @@ typedef struct process {
     /* Registers */
     uint32_t eax, ebx, ecx, edx, esi, edi;
 
-    /* Process list */
+    /* Process list (RCU: readers follow next only) */
     struct process* next;
     struct process* prev;
 
@@ -63,6 +83,63 @@ typedef struct process {
 
     /* Time quantum remaining */
     uint32_t quantum;
+
+    /* Scheduling class (SCHED_CLASS_*) and real-time parameters */
+    uint32_t sched_class;
+    uint32_t rt_priority;       /* FIFO: 1..99, higher runs first */
+    uint32_t edf_runtime;       /* EDF: budget per period, in ticks */
+    uint32_t edf_deadline;      /* EDF: relative deadline, in ticks */
+    uint32_t edf_period;        /* EDF: period, in ticks */
+    uint32_t edf_abs_deadline;  /* EDF: absolute deadline of current period */
+    uint32_t edf_release;       /* EDF: start of the next period */
+    uint32_t edf_budget;        /* EDF: budget left in current period */
+
+    /* CPU time and scheduling latency accounting */
+    uint32_t user_ticks;        /* ticks that interrupted ring 3 */
+    uint32_t kernel_ticks;      /* ticks that interrupted ring 0 */
+    uint32_t nvcsw;             /* voluntary switches (block, yield, exit) */
+    uint32_t nivcsw;            /* involuntary switches (preemption) */
+    uint32_t ready_since;       /* tick at which the process became ready */
+    uint32_t wait_ticks;        /* total ticks spent ready but not running */
+    uint32_t wait_max;          /* worst ready-to-running latency, in ticks */
+    uint32_t lat_hist[PROC_LAT_BUCKETS];
+
+    /* Lazily allocated FXSAVE area (16-byte aligned inside fpu_alloc) */
+    uint8_t* fpu_state;
+    void* fpu_alloc;
+
+    /* Kind of context saved at esp (PROC_CONTEXT_*) */
+    uint32_t context_type;
+
+    /* Exit handling: process blocked in process_wait() on this one, and the
+       link in the zombie list or reaper queue once it has exited */
+    struct process* waiter;
+    struct process* zombie_next;
+
+    /* SMP scheduling: run queue links, assigned CPU, whether the process is
+       queued, whether a CPU is still running on its stack, and the CPU
+       whose FPU registers hold its live state (CPU_NONE if saved) */
+    struct process* rq_next;
+    struct process* rq_prev;
+    uint32_t cpu;
+    uint32_t on_rq;
+    volatile uint32_t on_cpu;
+    uint32_t fpu_cpu;
+
+    /* Ring-3 entry point and stack in page_dir (0 for kernel threads) */
+    uint32_t user_entry;
+    uint32_t user_stack_start;
+    uint32_t user_stack_end;
+
+    /* Non-zero while the kernel copies to or from its memory; a kernel
+       page fault then ends the process instead of the system */
+    uint32_t user_copy;
+
+    /* Submission/completion ring shared with the process (0 if none) */
+    struct uring* uring;
+
+    /* Message passing state (see kernel/ipc.c) */
+    ipc_state_t ipc;
 } process_t;
 
 typedef void (*process_entry_t)(void);
@@ -90,16 +167,28 @@ void scheduler_init(void);
 void scheduler_add_process(process_t* proc);
 void scheduler_remove_process(process_t* proc);
 
-/* Process execution */
-int process_exec(uint8_t* elf_data, uint32_t size);
+/* Process execution: load an ELF executable into a new user process and
+ * start it in ring 3. Returns its PID, or -1 on error. */
+int process_exec(const char* name, uint8_t* elf_data, uint32_t size);
 void process_exit(int exit_code);
 
+/* Wait for process pid to exit and collect its exit code. The PCB, stack
+ * and address space are then released by the reaper thread. Returns 0 on
+ * success, -1 if pid does not exist, is detached or is already waited on. */
+int process_wait(pid_t pid, int* exit_code);
+
+/* Start the reaper kernel thread that frees exited processes */
+void process_start_reaper(void);
+
 /* Process utilities */
 pid_t process_get_pid(void);
 pid_t process_get_ppid(void);
 void process_set_name(process_t* proc, const char* name);
 
+/* Print a ps-style table of all processes and their scheduling statistics */
+void process_print_table(void);
+
 /* Idle process */
-void idle_process(void);
+void idle_process(void) __attribute__((noreturn));
 
 #endif /* KERNEL_PROCESS_H */
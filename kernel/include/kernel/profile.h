@@ -0,0 +1,50 @@
+/* SYNAPSE SO - Sampling Profiler */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_PROFILE_H
+#define KERNEL_PROFILE_H
+
+#include <stdint.h>
+
+/* Statistical profiler. While it runs, every scheduler tick records the
+ * interrupted eip into a per-CPU sample buffer; a kernel built with frame
+ * pointers (make PROFILE=1) also records the return addresses of the
+ * interrupted kernel stack. The handler hangs off the tick vector through
+ * irq_register_handler(), so it costs nothing while stopped.
+ *
+ * profile_dump() writes the samples to COM1; tools/profile2folded.py
+ * symbolizes them against build/kernel.elf into folded stacks for
+ * flamegraph.pl or speedscope. */
+
+/* Return addresses kept per sample */
+#define PROFILE_DEPTH       13
+
+/* Sample flags */
+#define PROFILE_SAMPLE_USER (1 << 0)    /* eip is in ring 3, no backtrace */
+
+typedef struct {
+    uint32_t pid;
+    uint16_t flags;
+    uint16_t depth;                 /* valid entries of stack[] */
+    uint32_t eip;
+    uint32_t stack[PROFILE_DEPTH];  /* innermost caller first */
+} profile_sample_t;
+
+/* Buffer size per CPU, in pages */
+#define PROFILE_PAGES       16
+
+/* Operations of SYS_PROFILE */
+#define PROFILE_OP_STOP     0
+#define PROFILE_OP_START    1       /* discards earlier samples */
+#define PROFILE_OP_DUMP     2
+
+/* With CONFIG_PROFILE, profile from boot and dump once after 10s */
+void profile_init(void);
+
+/* Start, stop or dump. Start and stop may sleep. Returns 0 or -1. */
+int32_t profile_control(uint32_t op);
+
+/* Write the samples of every CPU to COM1 */
+void profile_dump(void);
+
+#endif /* KERNEL_PROFILE_H */
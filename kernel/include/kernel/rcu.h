@@ -0,0 +1,47 @@
+/* SYNAPSE SO - Read-Copy-Update */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_RCU_H
+#define KERNEL_RCU_H
+
+#include <kernel/smp.h>
+
+/* Classic non-preemptible RCU for read-mostly linked data.
+ *
+ * Readers run between rcu_read_lock() and rcu_read_unlock() without taking
+ * any lock; they only keep this CPU from being preempted, and must not
+ * block. Writers serialize among themselves with an ordinary lock, publish
+ * with rcu_assign_pointer() and unlink without touching the removed
+ * element's forward pointer. Before freeing what they unlinked, they call
+ * synchronize_rcu(), which returns once every CPU has passed a quiescent
+ * state (a context switch, or a timer tick outside any read section), so
+ * no reader can still hold a reference. */
+
+static inline void rcu_read_lock(void) {
+    preempt_disable();
+}
+
+static inline void rcu_read_unlock(void) {
+    preempt_enable();
+}
+
+/* Load a pointer published with rcu_assign_pointer() */
+#define rcu_dereference(p) (*(__typeof__(p) volatile*)&(p))
+
+/* Publish a pointer: the pointee's initialization is visible first */
+#define rcu_assign_pointer(p, v) \
+    do { \
+        __sync_synchronize(); \
+        (*(__typeof__(p) volatile*)&(p)) = (v); \
+    } while (0)
+
+/* Record a quiescent state for the calling CPU (scheduler only) */
+static inline void rcu_note_qs(cpu_t* cpu) {
+    cpu->rcu_qs_count++;
+}
+
+/* Wait until all pre-existing read-side sections have finished. May
+ * schedule; must not be called from a read section or with locks held. */
+void synchronize_rcu(void);
+
+#endif /* KERNEL_RCU_H */
@@ -0,0 +1,102 @@
+/* SYNAPSE SO - Lock-Free Ring Buffers */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_RING_H
+#define KERNEL_RING_H
+
+#include <stdint.h>
+
+/* Bounded queues of 32-bit entries (values or pointers) that need neither
+ * a lock nor cli, for handing work from interrupt handlers to threads.
+ * The caller provides the slot storage; its size must be a power of two.
+ * Indices run freely and wrap. Producer-side and consumer-side fields sit
+ * on separate cache lines so the two sides do not bounce a line between
+ * CPUs on every operation.
+ *
+ * Enqueue and dequeue take a batch and return how many entries they
+ * moved, which is fewer (possibly 0) when the ring is full or empty. */
+
+#define RING_CACHE_LINE 64
+
+/* ------------------------------------------------------------------------
+ * SPSC: one producer and one consumer. Each side also caches the other
+ * side's index and rereads it only when the cached value says full or
+ * empty.
+ * ------------------------------------------------------------------------ */
+
+typedef struct {
+    /* Consumer side */
+    volatile uint32_t head;
+    uint32_t tail_cache;
+    uint8_t pad0[RING_CACHE_LINE - 8];
+
+    /* Producer side */
+    volatile uint32_t tail;
+    uint32_t head_cache;
+    uint8_t pad1[RING_CACHE_LINE - 8];
+
+    /* Read-only after init */
+    uint32_t mask;
+    uint32_t* slots;
+} __attribute__((aligned(RING_CACHE_LINE))) ring_spsc_t;
+
+/* Set up an empty ring over size slots. Returns 0, or -1 if size is not a
+ * power of two. */
+int ring_spsc_init(ring_spsc_t* ring, uint32_t* slots, uint32_t size);
+
+/* Producer: append up to count entries */
+uint32_t ring_spsc_enqueue(ring_spsc_t* ring, const uint32_t* items, uint32_t count);
+
+/* Consumer: remove up to count entries into items */
+uint32_t ring_spsc_dequeue(ring_spsc_t* ring, uint32_t* items, uint32_t count);
+
+/* Entries queued (a snapshot; exact only on the consumer side) */
+uint32_t ring_spsc_count(const ring_spsc_t* ring);
+
+/* ------------------------------------------------------------------------
+ * MPSC: any number of producers (threads and interrupt handlers on any
+ * CPU) and one consumer. Producers claim slots by advancing tail with a
+ * compare-and-swap, then publish each slot through its sequence number,
+ * so the consumer never reads a claimed but unwritten entry. A producer
+ * interrupted between claim and publish only delays the consumer at that
+ * slot; it never blocks other producers.
+ * ------------------------------------------------------------------------ */
+
+typedef struct {
+    volatile uint32_t seq;      /* position + 1 once published */
+    uint32_t value;
+} ring_mpsc_slot_t;
+
+typedef struct {
+    /* Consumer side */
+    volatile uint32_t head;
+    uint8_t pad0[RING_CACHE_LINE - 4];
+
+    /* Producer side */
+    volatile uint32_t tail;
+    uint8_t pad1[RING_CACHE_LINE - 4];
+
+    /* Read-only after init */
+    uint32_t mask;
+    ring_mpsc_slot_t* slots;
+} __attribute__((aligned(RING_CACHE_LINE))) ring_mpsc_t;
+
+/* Set up an empty ring over size slots. Returns 0, or -1 if size is not a
+ * power of two. */
+int ring_mpsc_init(ring_mpsc_t* ring, ring_mpsc_slot_t* slots, uint32_t size);
+
+/* Any producer: append up to count entries, contiguously */
+uint32_t ring_mpsc_enqueue(ring_mpsc_t* ring, const uint32_t* items, uint32_t count);
+
+/* Any producer: append all count entries contiguously, or none (returns
+ * count or 0). For variable-length records that must not be split. */
+uint32_t ring_mpsc_enqueue_all(ring_mpsc_t* ring, const uint32_t* items, uint32_t count);
+
+/* Consumer: remove up to count published entries into items */
+uint32_t ring_mpsc_dequeue(ring_mpsc_t* ring, uint32_t* items, uint32_t count);
+
+/* Entries claimed by producers and not yet dequeued, including any still
+ * being written (a snapshot) */
+uint32_t ring_mpsc_count(const ring_mpsc_t* ring);
+
+#endif /* KERNEL_RING_H */
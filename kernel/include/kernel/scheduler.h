@@ -7,10 +7,34 @@
 #include <stdint.h>
 #include <kernel/idt.h>
 #include <kernel/process.h>
+#include <kernel/spinlock.h>
 
 /* Scheduler quantum (time slice) */
 #define DEFAULT_QUANTUM 10
 
+/* Real-time FIFO priority range */
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX 99
+
+/* EDF admission control: total density (runtime / deadline) of the EDF
+ * processes admitted on one CPU, in 1/1024 units of that CPU. The bound
+ * leaves ~5% of the CPU for FIFO and normal processes. EDF and FIFO
+ * processes stay on the CPU they were admitted on. */
+#define SCHED_EDF_UTIL_SCALE 1024
+#define SCHED_EDF_UTIL_MAX   972
+
+/* Per-CPU run queue: READY processes assigned to one CPU, in queue order
+ * (ties run round robin). Blocked and exited processes are never queued. */
+typedef struct runqueue {
+    spinlock_t lock;            /* taken with interrupts disabled */
+    process_t* head;
+    process_t* tail;
+    uint32_t nr_ready;
+    uint32_t nr_fifo;           /* FIFO processes assigned to this CPU */
+    uint32_t nr_edf;            /* EDF processes assigned to this CPU */
+    uint32_t edf_util;          /* admitted EDF density on this CPU */
+} runqueue_t;
+
 /* Initialize scheduler */
 void scheduler_init(void);
 
@@ -26,9 +50,33 @@ void scheduler_remove_process(process_t* proc);
 /* Must be called with a valid register frame pointer from the timer ISR; passing NULL is undefined. */
 registers_t* scheduler_tick(registers_t* regs) __attribute__((nonnull(1)));
 
+/* Reschedule from a non-timer interrupt when a wakeup made a higher class
+ * runnable. Returns the register frame to restore. */
+registers_t* scheduler_preempt(registers_t* regs) __attribute__((nonnull(1)));
+
+/* Non-zero when a runnable process outranks the current one */
+int scheduler_need_resched(void);
+
 /* Force schedule */
 void schedule(void);
 
+/* Switch this CPU directly to next, a blocked process the caller is waking
+ * (and set to READY), bypassing the run queues. The caller must own the
+ * wakeup and have interrupts disabled. Returns 0 once the caller runs
+ * again, or -1 without switching when next cannot run here right now; the
+ * caller then wakes it with scheduler_add_process(). */
+int scheduler_handoff(process_t* next);
+
+/* Scheduling class control. Return 0 on success, -1 on invalid parameters
+ * or (for EDF) when admission control rejects the reservation. */
+int scheduler_set_normal(process_t* proc);
+int scheduler_set_fifo(process_t* proc, uint32_t rt_priority);
+int scheduler_set_edf(process_t* proc, uint32_t runtime, uint32_t deadline,
+                      uint32_t period);
+
+/* Get admitted EDF utilization (in SCHED_EDF_UTIL_SCALE units) */
+uint32_t scheduler_get_edf_utilization(void);
+
 /* Set quantum */
 void scheduler_set_quantum(uint32_t quantum);
 
@@ -38,10 +86,26 @@ uint32_t scheduler_get_quantum(void);
 /* Get number of ready processes */
 uint32_t scheduler_get_ready_count(void);
 
-/* Context switch function (assembly) */
+/* Called on the new stack after every switch: lets the CPU that switched
+ * out the previous process release it to other CPUs */
+void scheduler_finish_switch(void);
+
+/* Start running the per-CPU idle thread on this CPU (never returns) */
+void scheduler_run_idle(void) __attribute__((noreturn));
+
+/* Context switch functions (assembly). Both save the callee-saved state of
+ * old_proc on its stack. context_switch resumes a new_proc that was itself
+ * switched out by context_switch (PROC_CONTEXT_SWITCH); context_switch_frame
+ * resumes one whose stack holds an interrupt frame (PROC_CONTEXT_IRQ). */
 void context_switch(process_t* old_proc, process_t* new_proc);
+void context_switch_frame(process_t* old_proc, process_t* new_proc);
+
+/* Resume stub used when the interrupt path returns into a process that
+ * was switched out by context_switch */
+void context_switch_resume(void);
 
-/* Initialize context for new process */
+/* Initialize context for new process: a PROC_CONTEXT_SWITCH frame whose
+ * first resumption returns to entry_point with interrupts enabled */
 void context_init(process_t* proc, uint32_t entry_point);
 
 #endif /* KERNEL_SCHEDULER_H */
@@ -0,0 +1,40 @@
+/* SYNAPSE SO - Serial Port */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_SERIAL_H
+#define KERNEL_SERIAL_H
+
+#include <stdint.h>
+
+/* COM1, 16550 UART */
+#define SERIAL_COM1         0x3F8
+#define SERIAL_IRQ          4
+#define SERIAL_BAUD         115200
+
+/* Bytes the console can queue for transmission (power of two) */
+#define SERIAL_TX_RING      2048
+
+/* Program COM1 for 115200 baud, 8N1, FIFOs on. Returns 0, or -1 when no
+ * UART answers the loopback test (output is then dropped). Until
+ * serial_start_irq() all output is polled. */
+int serial_init(void);
+
+/* Hook the transmitter-empty interrupt (after irq_init()). From then on
+ * console output is queued and the interrupt feeds it to the UART. */
+void serial_start_irq(void);
+
+/* Console sink: queue str and return without waiting for the UART. Only
+ * a full queue makes the caller push part of it out itself. */
+void serial_console_write(const char* str);
+
+/* Push out everything queued, polling. For paths that halt right after
+ * printing, where the interrupt would never come. */
+void serial_flush(void);
+
+/* Synchronous output, for dumps that must not be dropped or reordered:
+ * flush the queue, then write and wait for the transmitter. Each call is
+ * written as a unit. */
+void serial_putc(char c);
+void serial_write(const char* str);
+
+#endif /* KERNEL_SERIAL_H */
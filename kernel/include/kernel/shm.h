@@ -0,0 +1,42 @@
+/* SYNAPSE SO - Shared Memory Objects */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_SHM_H
+#define KERNEL_SHM_H
+
+#include <stdint.h>
+#include <kernel/vmm.h>
+
+/* A shared memory object is a set of zeroed frames that any number of
+ * address spaces can map. The object and every mapping each hold a
+ * reference to the frames (see pmm_ref_frame), so destroying the object
+ * only stops new mappings: the frames stay until the last mapping is
+ * unmapped or its process exits. */
+
+#define SHM_MAX_OBJECTS     32
+#define SHM_MAX_PAGES       1024    /* 4MB per object */
+
+struct process;
+
+/* Create an object of pages pages owned by the calling process. Returns
+ * its ID, or -1 on a bad size or when out of memory or objects. */
+int32_t shm_create(uint32_t pages);
+
+/* Destroy an object of the calling process. Existing mappings stay. */
+int32_t shm_destroy(uint32_t id);
+
+/* Map the whole object at virt_addr in pd (read-only unless flags has
+ * PAGE_WRITE). The range must be page aligned, in the user half and
+ * unmapped. Returns 0 or -1. */
+int32_t shm_map(uint32_t id, page_directory_t* pd, uint32_t virt_addr,
+                uint32_t flags);
+
+/* Unmap the object from virt_addr in pd. Fails, changing nothing, unless
+ * every page there maps the object's frame. Mappings of a destroyed
+ * object go away with their address space. */
+int32_t shm_unmap(uint32_t id, page_directory_t* pd, uint32_t virt_addr);
+
+/* Destroy the objects of an exiting process */
+void shm_process_exit(struct process* proc);
+
+#endif /* KERNEL_SHM_H */
@@ -0,0 +1,87 @@
+/* SYNAPSE SO - Symmetric Multiprocessing */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_SMP_H
+#define KERNEL_SMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+
+/* Maximum number of CPUs brought up */
+#define MAX_CPUS 8
+
+/* process_t.cpu / fpu_cpu value for "no CPU" */
+#define CPU_NONE 0xFFFFFFFF
+
+/* Physical address the AP real-mode trampoline is copied to (page 8) */
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+/* Per-CPU data. Each CPU's GDT_KERNEL_PERCPU segment (kept in FS) has its
+ * cpu_t as base, so cpu_current() is a single FS-relative load. */
+typedef struct cpu {
+    struct cpu* self;           /* must stay first: read via %fs:0 */
+    uint32_t index;
+    uint32_t apic_id;
+    volatile uint32_t online;
+
+    process_t* current;         /* process running on this CPU */
+    process_t* idle;            /* runs when the run queue is empty */
+    process_t* prev;            /* switched out, stack not yet released */
+    process_t* fpu_owner;       /* state live in this CPU's FPU */
+
+    volatile uint32_t need_resched;
+    volatile uint32_t yield_pending;
+    uint32_t irq_depth;
+    volatile uint32_t preempt_count;    /* > 0: no involuntary switch */
+    volatile uint32_t rcu_qs_count;     /* quiescent states passed */
+    uint64_t timer_deadline;            /* next TSC-deadline tick */
+
+    runqueue_t rq;
+    volatile uint32_t softirq_pending;  /* bitmask of raised softirqs */
+    struct tasklet* tasklet_head;       /* tasklets scheduled on this CPU */
+    struct tasklet* tasklet_tail;
+} cpu_t;
+
+/* Get the data of the executing CPU */
+static inline cpu_t* cpu_current(void) {
+    cpu_t* cpu;
+    __asm__ __volatile__("movl %%fs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+/* Keep the current process on this CPU until preempt_enable(). Each is a
+   single FS-relative instruction, so it cannot be split by a migration. */
+static inline void preempt_disable(void) {
+    __asm__ __volatile__("incl %%fs:%c0"
+                         : : "i"(offsetof(cpu_t, preempt_count)) : "memory");
+}
+
+static inline void preempt_enable(void) {
+    __asm__ __volatile__("decl %%fs:%c0"
+                         : : "i"(offsetof(cpu_t, preempt_count)) : "memory");
+}
+
+/* Get the data of CPU index */
+cpu_t* cpu_get(uint32_t index);
+
+/* Number of CPUs online */
+uint32_t smp_cpu_count(void);
+
+/* Start the application processors listed in the ACPI MADT (INIT/SIPI);
+ * needs irq_init() first. Each AP runs its own idle thread, run queue and
+ * local APIC timer. */
+void smp_init(void);
+
+/* Forward a PIT tick to the other CPUs (when the local APIC timer could
+   not be calibrated) */
+void smp_broadcast_tick(void);
+
+/* Ask another CPU to reschedule */
+void smp_send_reschedule(cpu_t* cpu);
+
+/* C entry of an application processor (called from the trampoline) */
+void ap_main(uint32_t index);
+
+#endif /* KERNEL_SMP_H */
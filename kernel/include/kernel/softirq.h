@@ -0,0 +1,59 @@
+/* SYNAPSE SO - Deferred Interrupt Work */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_SOFTIRQ_H
+#define KERNEL_SOFTIRQ_H
+
+#include <stdint.h>
+
+/* Interrupt handlers do the minimum with interrupts disabled and defer the
+ * rest. Softirqs are raised per CPU and run when the outermost interrupt
+ * returns, after the EOI and with interrupts enabled but preemption
+ * disabled, so they may not sleep. Work raised outside interrupt context
+ * runs at the next interrupt exit on that CPU (at most a tick later).
+ * Tasklets are one-shot callbacks run from a softirq; work that needs to
+ * sleep goes to a workqueue (kernel/include/kernel/workqueue.h). */
+
+/* Softirq numbers, lowest runs first */
+#define SOFTIRQ_TIMER       0   /* tick-driven timeouts */
+#define SOFTIRQ_TASKLET     1
+#define SOFTIRQ_COUNT       2
+
+/* Passes over the pending mask per interrupt exit; what is raised again
+ * after that waits for the next interrupt */
+#define SOFTIRQ_MAX_RESTART 4
+
+typedef void (*softirq_handler_t)(void);
+
+/* Tasklet: runs func(data) once per tasklet_schedule(), never on two CPUs
+ * at the same time */
+typedef struct tasklet {
+    struct tasklet* next;
+    void (*func)(uint32_t data);
+    uint32_t data;
+    volatile uint32_t state;    /* TASKLET_STATE_* */
+} tasklet_t;
+
+#define TASKLET_STATE_SCHED (1 << 0)    /* queued */
+#define TASKLET_STATE_RUN   (1 << 1)    /* running */
+
+#define TASKLET_INIT(fn, arg) { 0, (fn), (arg), 0 }
+
+/* Register the tasklet softirq */
+void softirq_init(void);
+
+/* Install the handler of softirq nr */
+void softirq_register(uint32_t nr, softirq_handler_t handler);
+
+/* Mark softirq nr pending on this CPU; safe from any context */
+void softirq_raise(uint32_t nr);
+
+/* Run the pending softirqs of this CPU. Called from isr_handler() on the
+ * way out of the outermost interrupt, with interrupts disabled; returns
+ * with them disabled. */
+void softirq_run(void);
+
+/* Queue a tasklet on this CPU unless it is already queued */
+void tasklet_schedule(tasklet_t* t);
+
+#endif /* KERNEL_SOFTIRQ_H */
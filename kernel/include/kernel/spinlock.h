@@ -0,0 +1,233 @@
+/* SYNAPSE SO - Spinlocks, Ticket Locks and Reader-Writer Locks */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_SPINLOCK_H
+#define KERNEL_SPINLOCK_H
+
+#include <stdint.h>
+#include <kernel/cpu.h>
+
+/* All locks busy-wait and must not be held across schedule(). A lock that
+ * is also taken from interrupt handlers must be taken with the _irqsave
+ * variants everywhere else, or the handler can spin forever on its own
+ * CPU's lock.
+ *
+ * Every lock carries contention counters. Acquisitions are counted on
+ * every lock; a named lock that ever had to wait registers itself on first
+ * contention and shows up in lock_print_stats(). The registry keeps
+ * pointers, so locks inside objects that can be freed are left unnamed. */
+
+typedef struct lock_stat {
+    const char* name;
+    uint32_t acquired;          /* successful acquisitions */
+    uint32_t contended;         /* acquisitions that had to wait */
+    uint32_t spins;             /* wait loop iterations */
+    volatile uint32_t registered;
+    struct lock_stat* next;     /* registered locks */
+} lock_stat_t;
+
+#define LOCK_STAT_INIT(lock_name) { (lock_name), 0, 0, 0, 0, 0 }
+
+/* Record a contended acquisition (called with the lock held) */
+void lock_stat_contended(lock_stat_t* stat, uint32_t spins);
+
+/* Print the counters of every lock that has seen contention */
+void lock_print_stats(void);
+
+/* ------------------------------------------------------------------------
+ * Spinlock: test-and-test-and-set. Cheapest when rarely contended.
+ * ------------------------------------------------------------------------ */
+
+typedef struct {
+    volatile uint32_t locked;
+    lock_stat_t stat;
+} spinlock_t;
+
+#define SPINLOCK_INIT(lock_name) { 0, LOCK_STAT_INIT(lock_name) }
+
+static inline void spin_lock_init(spinlock_t* lock, const char* name) {
+    lock->locked = 0;
+    lock->stat.name = name;
+    lock->stat.acquired = lock->stat.contended = lock->stat.spins = 0;
+    lock->stat.registered = 0;
+    lock->stat.next = 0;
+}
+
+static inline int spin_trylock(spinlock_t* lock) {
+    if (__sync_lock_test_and_set(&lock->locked, 1) != 0) {
+        return 0;
+    }
+    lock->stat.acquired++;
+    return 1;
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t spins = 0;
+
+    while (__sync_lock_test_and_set(&lock->locked, 1) != 0) {
+        /* Wait on a plain read so the cache line stays shared */
+        while (lock->locked) {
+            cpu_relax();
+            spins++;
+        }
+    }
+
+    lock->stat.acquired++;
+    if (spins != 0) {
+        lock_stat_contended(&lock->stat, spins);
+    }
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+/* ------------------------------------------------------------------------
+ * Ticket lock: FIFO fair. Waiters are served in arrival order, so no CPU
+ * starves under heavy contention, at the cost of one extra atomic.
+ * ------------------------------------------------------------------------ */
+
+typedef struct {
+    volatile uint32_t next;     /* next ticket to hand out */
+    volatile uint32_t owner;    /* ticket being served */
+    lock_stat_t stat;
+} ticketlock_t;
+
+#define TICKETLOCK_INIT(lock_name) { 0, 0, LOCK_STAT_INIT(lock_name) }
+
+static inline void ticket_lock(ticketlock_t* lock) {
+    uint32_t ticket = __sync_fetch_and_add(&lock->next, 1);
+    uint32_t spins = 0;
+
+    while (lock->owner != ticket) {
+        cpu_relax();
+        spins++;
+    }
+    __sync_synchronize();
+
+    lock->stat.acquired++;
+    if (spins != 0) {
+        lock_stat_contended(&lock->stat, spins);
+    }
+}
+
+static inline int ticket_trylock(ticketlock_t* lock) {
+    uint32_t owner = lock->owner;
+    if (!__sync_bool_compare_and_swap(&lock->next, owner, owner + 1)) {
+        return 0;
+    }
+    lock->stat.acquired++;
+    return 1;
+}
+
+static inline void ticket_unlock(ticketlock_t* lock) {
+    __sync_synchronize();
+    lock->owner = lock->owner + 1;
+}
+
+static inline uint32_t ticket_lock_irqsave(ticketlock_t* lock) {
+    uint32_t flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticketlock_t* lock, uint32_t flags) {
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+/* ------------------------------------------------------------------------
+ * Reader-writer lock: many readers or one writer. A waiting writer stops
+ * new readers from entering, so writers are not starved by a steady
+ * stream of readers. Read-mostly data that can tolerate stale readers is
+ * better served by RCU (kernel/rcu.h).
+ * ------------------------------------------------------------------------ */
+
+#define RWLOCK_WRITER 0x80000000u
+
+typedef struct {
+    volatile uint32_t state;            /* reader count, or RWLOCK_WRITER */
+    volatile uint32_t writers_waiting;
+    lock_stat_t stat;
+} rwlock_t;
+
+#define RWLOCK_INIT(lock_name) { 0, 0, LOCK_STAT_INIT(lock_name) }
+
+static inline void read_lock(rwlock_t* lock) {
+    uint32_t spins = 0;
+
+    while (1) {
+        uint32_t state = lock->state;
+        if (!(state & RWLOCK_WRITER) && lock->writers_waiting == 0 &&
+            __sync_bool_compare_and_swap(&lock->state, state, state + 1)) {
+            break;
+        }
+        cpu_relax();
+        spins++;
+    }
+
+    /* Readers update the counters concurrently; they are approximate */
+    lock->stat.acquired++;
+    if (spins != 0) {
+        lock_stat_contended(&lock->stat, spins);
+    }
+}
+
+static inline void read_unlock(rwlock_t* lock) {
+    __sync_fetch_and_sub(&lock->state, 1);
+}
+
+static inline void write_lock(rwlock_t* lock) {
+    uint32_t spins = 0;
+
+    __sync_fetch_and_add(&lock->writers_waiting, 1);
+    while (!__sync_bool_compare_and_swap(&lock->state, 0, RWLOCK_WRITER)) {
+        cpu_relax();
+        spins++;
+    }
+    __sync_fetch_and_sub(&lock->writers_waiting, 1);
+
+    lock->stat.acquired++;
+    if (spins != 0) {
+        lock_stat_contended(&lock->stat, spins);
+    }
+}
+
+static inline void write_unlock(rwlock_t* lock) {
+    __sync_lock_release(&lock->state);
+}
+
+static inline uint32_t read_lock_irqsave(rwlock_t* lock) {
+    uint32_t flags = irq_save();
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t* lock, uint32_t flags) {
+    read_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline uint32_t write_lock_irqsave(rwlock_t* lock) {
+    uint32_t flags = irq_save();
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t* lock, uint32_t flags) {
+    write_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif /* KERNEL_SPINLOCK_H */
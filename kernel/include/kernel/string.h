@@ -25,4 +25,28 @@ void* memcpy(void* dest, const void* src, unsigned int n);
 /* Set memory */
 void* memset(void* s, int c, unsigned int n);
 
+/* Copy memory that may overlap */
+void* memmove(void* dest, const void* src, unsigned int n);
+
+/* Compare memory */
+int memcmp(const void* s1, const void* s2, unsigned int n);
+
+/* memcpy/memset with non-temporal stores, for large buffers that will not
+ * be read back soon (fall back to the cached versions without SSE2) */
+void* memcpy_nt(void* dest, const void* src, unsigned int n);
+void* memset_nt(void* s, int c, unsigned int n);
+
+/* Pick the block-copy strategy for this CPU from CPUID (early in boot;
+ * until then the baseline rep movsd/stosd paths are used) */
+void string_init(void);
+
+/* Fast REP MOVSB/STOSB, and movnti, available */
+int string_has_erms(void);
+int string_has_movnti(void);
+
+#ifdef CONFIG_BENCHMARKS
+/* Time the memcpy strategies across sizes and alignments */
+void string_benchmark(void);
+#endif
+
 #endif /* KERNEL_STRING_H */
@@ -0,0 +1,74 @@
+/* SYNAPSE SO - System Calls */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_SYSCALL_H
+#define KERNEL_SYSCALL_H
+
+#include <stdint.h>
+
+/* Interrupt vector of the int 0x80 gate (callable from ring 3) */
+#define SYSCALL_VECTOR      0x80
+
+/* System call numbers */
+#define SYS_NULL            0   /* no-op, for measuring entry cost */
+#define SYS_EXIT            1   /* exit(code) */
+#define SYS_YIELD           2   /* yield() */
+#define SYS_GETPID          3   /* getpid() */
+#define SYS_WRITE           4   /* write(buf, len) to the console */
+#define SYS_URING_SETUP     5   /* uring_setup() -> ring address */
+#define SYS_URING_ENTER     6   /* uring_enter(to_submit, min_complete) */
+#define SYS_IPC_CREATE      7   /* ipc_create() -> endpoint */
+#define SYS_IPC_DESTROY     8   /* ipc_destroy(endpoint) */
+#define SYS_IPC_SEND        9   /* ipc_send(endpoint, msg) */
+#define SYS_IPC_RECV        10  /* ipc_recv(endpoint, msg) */
+#define SYS_IPC_CALL        11  /* ipc_call(endpoint, msg) */
+#define SYS_IPC_REPLY       12  /* ipc_reply(msg) */
+#define SYS_SHM_CREATE      13  /* shm_create(pages) -> id */
+#define SYS_SHM_DESTROY     14  /* shm_destroy(id) */
+#define SYS_SHM_MAP         15  /* shm_map(id, addr, writable) */
+#define SYS_SHM_UNMAP       16  /* shm_unmap(id, addr) */
+#define SYS_TRACE           17  /* trace(op): TRACE_OP_* */
+#define SYS_PROFILE         18  /* profile(op): PROFILE_OP_* */
+#define SYS_PS              19  /* ps(): print the process table */
+#define SYSCALL_COUNT       20
+
+/* SYSENTER model specific registers */
+#define MSR_SYSENTER_CS     0x174
+#define MSR_SYSENTER_ESP    0x175
+#define MSR_SYSENTER_EIP    0x176
+
+/* CPUID leaf 1 EDX: SYSENTER/SYSEXIT present */
+#define CPUID_EDX_SEP       (1 << 11)
+
+/*
+ * Calling convention (both entry paths):
+ *   eax = system call number, ebx/esi/edi = arguments 1-3,
+ *   result returned in eax, all other registers preserved.
+ * int 0x80 needs nothing else. SYSENTER additionally takes the user stack
+ * pointer in ecx and the return address in edx (SYSEXIT resumes there
+ * with those two registers unchanged), which is why only ebx, esi and
+ * edi carry arguments.
+ */
+typedef int32_t (*syscall_fn_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3);
+
+/* Program the SYSENTER MSRs of the boot CPU and report the entry paths */
+void syscall_init(void);
+
+/* Program the SYSENTER MSRs of the calling CPU. SYSENTER loads ESP from
+ * this CPU's TSS esp0, i.e. the kernel stack of the running process. */
+void syscall_init_cpu(void);
+
+/* Drop to ring 3 at eip with stack esp on the current kernel stack, never
+ * returning. ebx and esi are passed to the user code, other registers are
+ * cleared. (kernel/syscall_entry.asm) */
+void syscall_enter_user(uint32_t eip, uint32_t esp, uint32_t ebx,
+                        uint32_t esi) __attribute__((noreturn));
+
+/* Run system call num; -1 for unknown numbers */
+int32_t syscall_dispatch(uint32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+
+/* Null system call round trip through int 0x80 and SYSENTER/SYSEXIT,
+ * measured from ring 3 with the TSC. Runs as a kernel thread body. */
+void syscall_benchmark(void);
+
+#endif /* KERNEL_SYSCALL_H */
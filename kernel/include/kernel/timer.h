@@ -6,8 +6,24 @@
 
 #include <stdint.h>
 
+/* Start the scheduler tick: local APIC timer when available, PIT IRQ0
+   otherwise */
 void timer_init(uint32_t frequency_hz);
 void timer_increment_tick(void);
 uint32_t timer_get_ticks(void);
+void timer_busy_wait_us(uint32_t us);
+
+/* Monotonic clock. clock_init() calibrates the TSC against PIT channel 2;
+ * without a TSC it runs channel 2 free and counts its 1.19 MHz input
+ * instead. Call before timer_init(). */
+void clock_init(void);
+
+/* Counts since clock_init() at clock_khz(), and the same in nanoseconds */
+uint64_t clock_cycles(void);
+uint64_t clock_ns(void);
+uint32_t clock_khz(void);
+
+/* Convert an interval of clock_cycles() counts to nanoseconds */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
 
 #endif /* KERNEL_TIMER_H */
@@ -0,0 +1,72 @@
+/* SYNAPSE SO - Event Tracing */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_TRACE_H
+#define KERNEL_TRACE_H
+
+#include <stdint.h>
+
+/* Binary event trace. Every CPU writes fixed-size records into its own
+ * ring, claiming a slot with one atomic add, so tracepoints take no lock
+ * and never disable interrupts. When a ring wraps the oldest records are
+ * overwritten. Tracepoints compile to nothing unless the kernel is built
+ * with CONFIG_TRACE (make TRACE=1).
+ *
+ * trace_dump() writes the rings to COM1 as hex text; tools/trace2json.py
+ * turns a captured serial log into Chrome/Perfetto trace JSON. */
+
+/* Events and their arguments */
+#define TRACE_IRQ_ENTRY     1   /* vector */
+#define TRACE_IRQ_EXIT      2   /* vector, handler result */
+#define TRACE_SWITCH        3   /* previous pid, next pid, previous state */
+#define TRACE_PAGE_ALLOC    4   /* frame */
+#define TRACE_PAGE_FREE     5   /* frame */
+#define TRACE_KMALLOC       6   /* pointer, size */
+#define TRACE_KFREE         7   /* pointer */
+#define TRACE_PAGE_FAULT    8   /* address, error code */
+
+/* One record; the dump format and the decoder depend on this layout */
+typedef struct {
+    uint64_t time;          /* clock_cycles() */
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t pid;           /* process running on the CPU */
+    uint32_t args[4];
+} trace_record_t;
+
+/* Ring size per CPU, in pages */
+#define TRACE_PAGES         16
+
+/* Operations of SYS_TRACE */
+#define TRACE_OP_STOP       0
+#define TRACE_OP_START      1   /* discards what was recorded */
+#define TRACE_OP_DUMP       2
+
+#ifdef CONFIG_TRACE
+extern volatile uint32_t trace_enabled;
+
+void trace_record(uint32_t event, uint32_t arg0, uint32_t arg1, uint32_t arg2,
+                  uint32_t arg3);
+
+#define TRACE(event, arg0, arg1, arg2, arg3) \
+    do { \
+        if (trace_enabled) { \
+            trace_record((event), (uint32_t)(arg0), (uint32_t)(arg1), \
+                         (uint32_t)(arg2), (uint32_t)(arg3)); \
+        } \
+    } while (0)
+#else
+#define TRACE(event, arg0, arg1, arg2, arg3) do { } while (0)
+#endif
+
+/* Allocate the rings of the online CPUs and start tracing (after
+ * smp_init()). Also starts a thread that dumps the boot trace once. */
+void trace_init(void);
+
+/* Start, stop or dump the trace. Returns 0, or -1 without CONFIG_TRACE. */
+int32_t trace_control(uint32_t op);
+
+/* Write the rings to COM1, tracing paused meanwhile */
+void trace_dump(void);
+
+#endif /* KERNEL_TRACE_H */
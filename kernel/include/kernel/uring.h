@@ -0,0 +1,108 @@
+/* SYNAPSE SO - Asynchronous Submission Rings */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_URING_H
+#define KERNEL_URING_H
+
+#include <stdint.h>
+#include <kernel/spinlock.h>
+
+/* A user process may set up one ring: a page shared with the kernel that
+ * holds a submission queue (SQ) and a completion queue (CQ). The process
+ * fills SQ entries and advances sq_tail without entering the kernel, then
+ * hands over the whole batch with a single SYS_URING_ENTER, which can also
+ * wait for completions. The kernel consumes at sq_head and posts results
+ * at cq_tail, including results of operations that finish later (sleeps);
+ * the process reaps them at cq_head, again without a kernel entry.
+ *
+ * Each index is written by one side only and sits on its own cache line.
+ * Indices run freely and wrap; entry i lives in slot i & (entries - 1).
+ * Entries are written before the index that publishes them. */
+
+/* Address of the ring page in every process that sets one up */
+#define URING_USER_ADDR     0x70000000
+
+#define URING_SQ_ENTRIES    64
+#define URING_CQ_ENTRIES    128     /* room for a full SQ plus pending sleeps */
+#define URING_CACHE_LINE    64
+
+/* Sleeps a ring can have pending at once */
+#define URING_MAX_TIMEOUTS  16
+
+/* Operations */
+#define URING_OP_NOP        0   /* completes with 0 */
+#define URING_OP_SYSCALL    1   /* args[0] = SYS_* number, args[1..3] = arguments */
+#define URING_OP_SLEEP      2   /* args[0] = ticks; completes with 0 when they pass */
+#define URING_OP_MEMSET     3   /* args[0] = dst, args[1] = byte, args[2] = length */
+#define URING_OP_MEMCPY     4   /* args[0] = dst, args[1] = src, args[2] = length */
+#define URING_OP_COUNT      5
+
+/* Submission queue entry */
+typedef struct {
+    uint32_t opcode;
+    uint32_t user_data;         /* copied to the completion */
+    uint32_t args[4];
+} uring_sqe_t;
+
+/* Completion queue entry */
+typedef struct {
+    uint32_t user_data;
+    int32_t result;             /* -1 on error */
+} uring_cqe_t;
+
+/* Layout of the shared page */
+typedef struct {
+    volatile uint32_t sq_tail;  /* written by the process */
+    uint8_t pad0[URING_CACHE_LINE - 4];
+    volatile uint32_t sq_head;  /* written by the kernel */
+    uint8_t pad1[URING_CACHE_LINE - 4];
+    volatile uint32_t cq_tail;  /* written by the kernel */
+    uint8_t pad2[URING_CACHE_LINE - 4];
+    volatile uint32_t cq_head;  /* written by the process */
+    uint8_t pad3[URING_CACHE_LINE - 4];
+    uring_sqe_t sqes[URING_SQ_ENTRIES];
+    uring_cqe_t cqes[URING_CQ_ENTRIES];
+} uring_shared_t;
+
+/* Pending sleep */
+typedef struct {
+    uint32_t deadline;          /* tick at which it completes */
+    uint32_t user_data;
+} uring_timeout_t;
+
+/* Kernel side of a ring. sq_head and cq_tail are the kernel's own copies;
+ * the shared page only mirrors them, so the process cannot move them. */
+typedef struct uring {
+    spinlock_t lock;            /* taken with interrupts disabled */
+    uring_shared_t* shared;     /* kernel view of the shared page */
+    uint32_t sq_head;
+    uint32_t cq_tail;
+    uint32_t inflight;          /* submitted, not yet completed */
+    struct process* waiter;     /* owner blocked in SYS_URING_ENTER */
+    uint32_t wait_nr;           /* completions it waits for */
+    uring_timeout_t timeouts[URING_MAX_TIMEOUTS];
+    uint32_t nr_timeouts;
+    struct uring* timer_next;   /* rings with pending sleeps */
+    uint32_t on_timer_list;
+} uring_t;
+
+/* SYS_URING_SETUP: map a ring into the calling process. Returns
+ * URING_USER_ADDR, or -1 for kernel threads, on a second call or when out
+ * of memory. */
+int32_t uring_setup(void);
+
+/* SYS_URING_ENTER: consume up to to_submit SQ entries, then wait until at
+ * least min_complete completions are ready to reap (never for more than
+ * can still arrive). Returns the number of entries consumed, which is
+ * lower when the CQ has no room for their completions, or -1 without a
+ * ring. */
+int32_t uring_enter(uint32_t to_submit, uint32_t min_complete);
+
+/* Release the ring of an exited process (before its address space, which
+ * holds the shared page) */
+void uring_destroy(struct process* proc);
+
+/* Complete expired sleeps; called from the timer softirq of the boot CPU */
+void uring_timer_tick(uint32_t now);
+
+#endif /* KERNEL_URING_H */
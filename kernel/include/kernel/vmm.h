@@ -20,6 +20,11 @@
 #define PAGE_GLOBAL     (1 << 8)
 #define PAGE_FRAME(addr) ((addr) & 0xFFFFF000)
 
+/* User mappings live between the kernel's identity mapped first 4MB,
+ * which every address space shares, and the kernel half (3GB) */
+#define USER_SPACE_START 0x00400000
+#define USER_SPACE_END  0xC0000000
+
 /* Page directory and table structures */
 typedef struct {
     uint32_t entries[1024];
@@ -39,8 +44,15 @@ typedef struct {
 /* Initialize virtual memory manager */
 void vmm_init(void);
 
-/* Map a virtual page to a physical page */
-void vmm_map_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
+/* Map a virtual page to a physical page (kernel half: kernel directory,
+ * user half: the directory loaded on this CPU). Returns 0, or -1 when no
+ * frame is left for a new page table. */
+int vmm_map_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
+
+/* Map a virtual page in a directory that need not be loaded (0 or -1, as
+ * vmm_map_page) */
+int vmm_map_page_in(page_directory_t* pd, uint32_t virt_addr,
+                    uint32_t phys_addr, uint32_t flags);
 
 /* Unmap a virtual page */
 void vmm_unmap_page(uint32_t virt_addr);
@@ -48,13 +60,65 @@ void vmm_unmap_page(uint32_t virt_addr);
 /* Get physical address of a virtual page */
 uint32_t vmm_get_phys_addr(uint32_t virt_addr);
 
+/* Move count user pages mapped at from_addr in from to to_addr in to,
+ * without copying: the frames change owner and from loses the mappings.
+ * Every source page must be a present user page and every destination
+ * page unmapped; otherwise nothing changes and -1 is returned. */
+int vmm_move_pages(page_directory_t* from, uint32_t from_addr,
+                   page_directory_t* to, uint32_t to_addr, uint32_t count);
+
+/* Like vmm_move_pages(), but from keeps its mappings: each frame gains a
+ * reference and is freed only when both sides have unmapped it */
+int vmm_share_pages(page_directory_t* from, uint32_t from_addr,
+                    page_directory_t* to, uint32_t to_addr, uint32_t count);
+
+/* Map count frames at virt_addr in pd as user pages (writable if flags
+ * has PAGE_WRITE), taking a reference to each. The range must be
+ * unmapped. Returns 0 or -1. */
+int vmm_map_frames(page_directory_t* pd, uint32_t virt_addr,
+                   const uint32_t* frames, uint32_t count, uint32_t flags);
+
+/* Unmap count user pages at virt_addr in pd, dropping their references
+ * (frames shared elsewhere stay allocated). All must be mapped. */
+int vmm_unmap_pages(page_directory_t* pd, uint32_t virt_addr, uint32_t count);
+
+/* Like vmm_unmap_pages(), but only if page i maps frames[i]; otherwise
+ * nothing changes and -1 is returned */
+int vmm_unmap_frames(page_directory_t* pd, uint32_t virt_addr,
+                     const uint32_t* frames, uint32_t count);
+
+/* Kernel virtual address through which a physical frame is accessed (the
+ * same view the page table code uses), valid in every address space */
+void* vmm_phys_to_virt(uint32_t phys_addr);
+
+/* Fill a page-aligned page with zeroes, or copy one. page_zero_nt bypasses
+ * the cache, for pages that will not be touched soon. */
+void page_zero(void* page);
+void page_zero_nt(void* page);
+void page_copy(void* dest, const void* src);
+
+/* Memory named by a process is only touched through these. Every page of
+ * the range must be mapped present and user-accessible in the current
+ * address space, and writable when the kernel writes to it; user_access_ok
+ * returns 1 if so. The copies return 0, or -1 without touching anything
+ * when the check fails. Call them without spinlocks held. */
+int user_access_ok(uint32_t addr, uint32_t len, int write);
+int copy_from_user(void* dest, uint32_t src, uint32_t len);
+int copy_to_user(uint32_t dest, const void* src, uint32_t len);
+int copy_in_user(uint32_t dest, uint32_t src, uint32_t len);
+int fill_user(uint32_t dest, uint8_t value, uint32_t len);
+
 /* Allocate a new page directory for a process */
 page_directory_t* vmm_create_page_directory(void);
 
+/* Free a process page directory with its user page tables and frames */
+void vmm_destroy_page_directory(page_directory_t* pd);
+
 /* Switch to a new page directory */
 void vmm_switch_page_directory(page_directory_t* pd);
 
-/* Page fault handler */
+/* Page fault handler. A kernel fault inside a user copy ends the current
+ * process; anything else halts. */
 void vmm_page_fault_handler(uint32_t error_code);
 
 /* Flush TLB entry */
@@ -62,7 +126,15 @@ static inline void vmm_flush_tlb(uint32_t addr) {
     __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
 }
 
-/* Get current page directory */
+/* Get the page directory loaded on the calling CPU */
 page_directory_t* vmm_get_current_directory(void);
 
+/* Get physical address of the kernel page directory (for CR3) */
+uint32_t vmm_get_kernel_directory_phys(void);
+
+#ifdef CONFIG_SELFTEST
+/* Check the mapping paths against a scratch page directory */
+void vmm_selftest(void);
+#endif
+
 #endif /* KERNEL_VMM_H */
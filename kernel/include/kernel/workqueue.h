@@ -0,0 +1,46 @@
+/* SYNAPSE SO - Workqueues */
+/* Licensed under GPLv3 */
+
+#ifndef KERNEL_WORKQUEUE_H
+#define KERNEL_WORKQUEUE_H
+
+#include <stdint.h>
+#include <kernel/spinlock.h>
+
+/* A workqueue is a kernel thread running queued work items in order.
+ * Unlike softirqs and tasklets, work runs in process context and may
+ * block. Work can be queued from any context, interrupts included. */
+
+#define WORKQUEUE_MAX       8
+
+typedef struct work {
+    struct work* next;
+    void (*func)(struct work* work);
+    volatile uint32_t pending;  /* queued, not yet started */
+} work_t;
+
+#define WORK_INIT(fn) { 0, (fn), 0 }
+
+typedef struct workqueue {
+    char name[32];              /* also the name of its thread */
+    spinlock_t lock;            /* taken with interrupts disabled */
+    work_t* head;
+    work_t* tail;
+    struct process* thread;
+    uint32_t in_use;
+} workqueue_t;
+
+/* Start the shared "events" workqueue used by schedule_work() */
+void workqueue_init(void);
+
+/* Create a workqueue with its own thread. Names must be unique. Returns 0
+ * when out of workqueues or memory. */
+workqueue_t* workqueue_create(const char* name);
+
+/* Queue work unless it is already pending. Returns 1 if it was queued. */
+int queue_work(workqueue_t* wq, work_t* work);
+
+/* Queue work on the shared workqueue */
+int schedule_work(work_t* work);
+
+#endif /* KERNEL_WORKQUEUE_H */
@@ -0,0 +1,126 @@
+/* SYNAPSE SO - I/O APIC */
+/* Licensed under GPLv3 */
+
+#include <kernel/ioapic.h>
+#include <kernel/acpi.h>
+#include <kernel/spinlock.h>
+#include <kernel/vga.h>
+#include <kernel/vmm.h>
+
+typedef struct {
+    volatile uint32_t* base;
+    uint32_t gsi_base;
+    uint32_t inputs;
+} ioapic_t;
+
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_count;
+
+/* Select/window pairs must not interleave between CPUs */
+static spinlock_t ioapic_lock = SPINLOCK_INIT("ioapic");
+
+static uint32_t ioapic_read(ioapic_t* io, uint32_t reg) {
+    io->base[IOAPIC_REG_SELECT / 4] = reg;
+    return io->base[IOAPIC_REG_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t* io, uint32_t reg, uint32_t value) {
+    io->base[IOAPIC_REG_SELECT / 4] = reg;
+    io->base[IOAPIC_REG_WINDOW / 4] = value;
+}
+
+/* I/O APIC serving a global system interrupt, with its input pin */
+static ioapic_t* ioapic_for_gsi(uint32_t gsi, uint32_t* pin) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_t* io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->inputs) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return 0;
+}
+
+int ioapic_init(void) {
+    vga_print("[+] Initializing I/O APIC...\n");
+
+    ioapic_count = 0;
+    for (uint32_t i = 0; i < acpi_get_ioapic_count(); i++) {
+        uint32_t phys = acpi_get_ioapic_addr(i);
+        vmm_map_page(phys & 0xFFFFF000, phys & 0xFFFFF000,
+                     PAGE_PRESENT | PAGE_WRITE | PAGE_NOCACHE);
+
+        ioapic_t* io = &ioapics[ioapic_count++];
+        io->base = (volatile uint32_t*)phys;
+        io->gsi_base = acpi_get_ioapic_gsi_base(i);
+        io->inputs = ((ioapic_read(io, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+
+        for (uint32_t pin = 0; pin < io->inputs; pin++) {
+            ioapic_write(io, IOAPIC_REDTBL(pin), IOAPIC_RTE_MASKED);
+            ioapic_write(io, IOAPIC_REDTBL(pin) + 1, 0);
+        }
+
+        vga_print("    IOAPIC at ");
+        vga_print_hex(phys);
+        vga_print(": GSI ");
+        vga_print_dec(io->gsi_base);
+        vga_print("-");
+        vga_print_dec(io->gsi_base + io->inputs - 1);
+        vga_print("\n");
+    }
+
+    return (ioapic_count > 0) ? 0 : -1;
+}
+
+int ioapic_present(void) {
+    return ioapic_count != 0;
+}
+
+void ioapic_route_isa(uint8_t irq, uint8_t vector, uint8_t apic_id) {
+    uint16_t flags;
+    uint32_t pin;
+    ioapic_t* io = ioapic_for_gsi(acpi_isa_irq_to_gsi(irq, &flags), &pin);
+    if (io == 0) {
+        return;
+    }
+
+    /* ISA defaults (flags 0) are edge triggered, active high */
+    uint32_t low = vector | IOAPIC_RTE_MASKED;
+    if ((flags & ACPI_INTI_POLARITY_MASK) == ACPI_INTI_ACTIVE_LOW) {
+        low |= IOAPIC_RTE_ACTIVE_LOW;
+    }
+    if ((flags & ACPI_INTI_TRIGGER_MASK) == ACPI_INTI_LEVEL) {
+        low |= IOAPIC_RTE_LEVEL;
+    }
+
+    uint32_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, IOAPIC_REDTBL(pin) + 1, (uint32_t)apic_id << 24);
+    ioapic_write(io, IOAPIC_REDTBL(pin), low);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+}
+
+static void ioapic_set_masked(uint8_t irq, int masked) {
+    uint32_t pin;
+    ioapic_t* io = ioapic_for_gsi(acpi_isa_irq_to_gsi(irq, 0), &pin);
+    if (io == 0) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    uint32_t low = ioapic_read(io, IOAPIC_REDTBL(pin));
+    if (masked) {
+        low |= IOAPIC_RTE_MASKED;
+    } else {
+        low &= ~IOAPIC_RTE_MASKED;
+    }
+    ioapic_write(io, IOAPIC_REDTBL(pin), low);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void ioapic_mask_isa(uint8_t irq) {
+    ioapic_set_masked(irq, 1);
+}
+
+void ioapic_unmask_isa(uint8_t irq) {
+    ioapic_set_masked(irq, 0);
+}
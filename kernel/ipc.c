@@ -0,0 +1,362 @@
+/* SYNAPSE SO - Synchronous Message Passing */
+/* Licensed under GPLv3 */
+
+/* The IPC state of a process is protected by the lock of the endpoint in
+ * its ipc.endpoint, which is where it last sent or received. Messages are
+ * staged in the PCB of the sender (while queued) or the receiver (once
+ * delivered), so no buffers are allocated and a delivery touches user
+ * memory only in the context of the process that owns it. */
+
+#include <kernel/ipc.h>
+#include <kernel/cpu.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <kernel/spinlock.h>
+#include <kernel/vmm.h>
+
+typedef struct {
+    spinlock_t lock;            /* taken with interrupts disabled */
+    uint32_t in_use;
+    pid_t owner;
+    process_t* receiver;        /* waiting in ipc_recv() */
+    process_t* send_head;       /* queued senders, FIFO */
+    process_t* send_tail;
+} ipc_endpoint_t;
+
+static ipc_endpoint_t endpoints[IPC_MAX_ENDPOINTS];
+
+static ipc_endpoint_t* ipc_endpoint(uint32_t endpoint) {
+    return (endpoint < IPC_MAX_ENDPOINTS) ? &endpoints[endpoint] : 0;
+}
+
+/* Make a process blocked in IPC runnable again. Caller holds the lock of
+   its endpoint and has already set its ipc.state and ipc.status. */
+static void ipc_wake(process_t* proc) {
+    proc->state = PROC_STATE_READY;
+    scheduler_add_process(proc);
+}
+
+/* Hand the CPU to a process whose wakeup the caller owns, or queue it if
+   it cannot run here. Called with interrupts disabled, no lock held. */
+static void ipc_switch_to(process_t* proc) {
+    proc->state = PROC_STATE_READY;
+    if (scheduler_handoff(proc) != 0) {
+        scheduler_add_process(proc);
+    }
+}
+
+/* Deliver the message staged in from to to, moving its pages into the
+   receive window staged in to. Returns -1, leaving both untouched, when
+   the pages do not fit or cannot be moved. */
+static int ipc_transfer(process_t* from, process_t* to) {
+    uint32_t count = from->ipc.page_count;
+
+    if (count != 0) {
+        if (count > to->ipc.page_count ||
+            ((from->flags | to->flags) & PROC_FLAG_KERNEL)) {
+            return -1;
+        }
+
+        int result = (from->ipc.flags & IPC_MSG_SHARE) ?
+            vmm_share_pages(from->page_dir, from->ipc.page_addr,
+                            to->page_dir, to->ipc.page_addr, count) :
+            vmm_move_pages(from->page_dir, from->ipc.page_addr,
+                           to->page_dir, to->ipc.page_addr, count);
+        if (result != 0) {
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < IPC_MSG_WORDS; i++) {
+        to->ipc.words[i] = from->ipc.words[i];
+    }
+    to->ipc.page_count = count;
+    to->ipc.sender = from->pid;
+    return 0;
+}
+
+/* Sleep until the other side clears ipc.state. Called with ep->lock held
+   and interrupts disabled; a wakeup between the unlock and the switch
+   leaves us runnable, so it is not lost. */
+static void ipc_wait(ipc_endpoint_t* ep, process_t* proc) {
+    while (proc->ipc.state != IPC_STATE_NONE) {
+        proc->state = PROC_STATE_BLOCKED;
+        spin_unlock(&ep->lock);
+        schedule();
+        spin_lock(&ep->lock);
+    }
+}
+
+/* Copy a delivered message out to the owner's descriptor. The page
+   window and flags the owner passed in are left as they were. */
+static int ipc_copy_out(process_t* proc, ipc_msg_t* msg) {
+    uint32_t tail[2] = { proc->ipc.page_count, proc->ipc.sender };
+
+    if (copy_to_user((uint32_t)msg->words, proc->ipc.words,
+                     sizeof(msg->words)) != 0 ||
+        copy_to_user((uint32_t)&msg->page_count, tail, sizeof(tail)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Copy the caller's descriptor into its PCB before taking any lock. A
+   descriptor that will receive a message must be writable now, so that
+   a delivery is not lost on the way out. */
+static int ipc_stage(process_t* proc, const ipc_msg_t* msg, uint32_t endpoint,
+                     int receive) {
+    ipc_msg_t local;
+
+    if (copy_from_user(&local, (uint32_t)msg, sizeof(local)) != 0 ||
+        (receive && !user_access_ok((uint32_t)msg, sizeof(local), 1)) ||
+        local.page_count > IPC_MAX_PAGES) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < IPC_MSG_WORDS; i++) {
+        proc->ipc.words[i] = local.words[i];
+    }
+    proc->ipc.page_addr = local.page_addr;
+    proc->ipc.page_count = local.page_count;
+    proc->ipc.flags = local.flags;
+    proc->ipc.endpoint = endpoint;
+    return 0;
+}
+
+int32_t ipc_create(void) {
+    process_t* proc = process_get_current();
+    if (proc == 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < IPC_MAX_ENDPOINTS; i++) {
+        ipc_endpoint_t* ep = &endpoints[i];
+        uint32_t flags = spin_lock_irqsave(&ep->lock);
+        if (!ep->in_use) {
+            ep->in_use = 1;
+            ep->owner = proc->pid;
+            ep->receiver = 0;
+            ep->send_head = ep->send_tail = 0;
+            spin_unlock_irqrestore(&ep->lock, flags);
+            return (int32_t)i;
+        }
+        spin_unlock_irqrestore(&ep->lock, flags);
+    }
+
+    return -1;
+}
+
+/* Fail everything blocked on ep. Caller holds ep->lock. */
+static void ipc_endpoint_close(ipc_endpoint_t* ep) {
+    ep->in_use = 0;
+
+    if (ep->receiver != 0) {
+        ep->receiver->ipc.state = IPC_STATE_NONE;
+        ep->receiver->ipc.status = -1;
+        ipc_wake(ep->receiver);
+        ep->receiver = 0;
+    }
+
+    while (ep->send_head != 0) {
+        process_t* sender = ep->send_head;
+        ep->send_head = sender->ipc.queue_next;
+        sender->ipc.queue_next = 0;
+        sender->ipc.state = IPC_STATE_NONE;
+        sender->ipc.status = -1;
+        ipc_wake(sender);
+    }
+    ep->send_tail = 0;
+}
+
+int32_t ipc_destroy(uint32_t endpoint) {
+    process_t* proc = process_get_current();
+    ipc_endpoint_t* ep = ipc_endpoint(endpoint);
+    if (proc == 0 || ep == 0) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&ep->lock);
+    int32_t result = -1;
+    if (ep->in_use && ep->owner == proc->pid) {
+        ipc_endpoint_close(ep);
+        result = 0;
+    }
+    spin_unlock_irqrestore(&ep->lock, flags);
+    return result;
+}
+
+/* ipc_send() and ipc_call() */
+static int32_t ipc_send_common(uint32_t endpoint, ipc_msg_t* msg, int is_call) {
+    process_t* proc = process_get_current();
+    ipc_endpoint_t* ep = ipc_endpoint(endpoint);
+    if (proc == 0 || ep == 0 ||
+        ipc_stage(proc, msg, endpoint, is_call) != 0) {
+        return -1;
+    }
+    proc->ipc.is_call = is_call;
+
+    uint32_t flags = spin_lock_irqsave(&ep->lock);
+    if (!ep->in_use) {
+        spin_unlock_irqrestore(&ep->lock, flags);
+        return -1;
+    }
+
+    process_t* receiver = ep->receiver;
+    if (receiver != 0) {
+        /* Fast path: the receiver is waiting, deliver into its PCB */
+        if (ipc_transfer(proc, receiver) != 0) {
+            spin_unlock_irqrestore(&ep->lock, flags);
+            return -1;
+        }
+        ep->receiver = 0;
+        receiver->ipc.state = IPC_STATE_NONE;
+        receiver->ipc.status = 0;
+
+        proc->ipc.status = 0;
+        if (is_call) {
+            receiver->ipc.reply_to = proc;
+            proc->ipc.state = IPC_STATE_REPLY;
+            proc->state = PROC_STATE_BLOCKED;
+        }
+
+        spin_unlock(&ep->lock);
+        ipc_switch_to(receiver);
+        spin_lock(&ep->lock);
+    } else {
+        /* Queue up; the receiver moves the message when it arrives */
+        proc->ipc.queue_next = 0;
+        if (ep->send_tail != 0) {
+            ep->send_tail->ipc.queue_next = proc;
+        } else {
+            ep->send_head = proc;
+        }
+        ep->send_tail = proc;
+        proc->ipc.state = IPC_STATE_SEND;
+    }
+
+    /* Queued sends wait to be taken, calls for the reply */
+    ipc_wait(ep, proc);
+    int32_t status = proc->ipc.status;
+    spin_unlock_irqrestore(&ep->lock, flags);
+
+    if (is_call && status == 0 && ipc_copy_out(proc, msg) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+int32_t ipc_send(uint32_t endpoint, ipc_msg_t* msg) {
+    return ipc_send_common(endpoint, msg, 0);
+}
+
+int32_t ipc_call(uint32_t endpoint, ipc_msg_t* msg) {
+    return ipc_send_common(endpoint, msg, 1);
+}
+
+int32_t ipc_recv(uint32_t endpoint, ipc_msg_t* msg) {
+    process_t* proc = process_get_current();
+    ipc_endpoint_t* ep = ipc_endpoint(endpoint);
+    if (proc == 0 || ep == 0 || proc->ipc.reply_to != 0 ||
+        ipc_stage(proc, msg, endpoint, 1) != 0) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&ep->lock);
+    if (!ep->in_use || ep->receiver != 0) {
+        spin_unlock_irqrestore(&ep->lock, flags);
+        return -1;
+    }
+
+    /* Take the first queued message that fits; senders whose pages do not
+       fit the window fail */
+    proc->ipc.status = -1;
+    while (ep->send_head != 0) {
+        process_t* sender = ep->send_head;
+        ep->send_head = sender->ipc.queue_next;
+        if (ep->send_head == 0) {
+            ep->send_tail = 0;
+        }
+        sender->ipc.queue_next = 0;
+
+        if (ipc_transfer(sender, proc) != 0) {
+            sender->ipc.state = IPC_STATE_NONE;
+            sender->ipc.status = -1;
+            ipc_wake(sender);
+            continue;
+        }
+
+        sender->ipc.status = 0;
+        proc->ipc.status = 0;
+        if (sender->ipc.is_call) {
+            sender->ipc.state = IPC_STATE_REPLY;
+            proc->ipc.reply_to = sender;
+        } else {
+            sender->ipc.state = IPC_STATE_NONE;
+            ipc_wake(sender);
+        }
+        break;
+    }
+
+    if (proc->ipc.status != 0) {
+        ep->receiver = proc;
+        proc->ipc.state = IPC_STATE_RECV;
+        ipc_wait(ep, proc);
+    }
+    int32_t status = proc->ipc.status;
+    spin_unlock_irqrestore(&ep->lock, flags);
+
+    if (status == 0 && ipc_copy_out(proc, msg) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+int32_t ipc_reply(ipc_msg_t* msg) {
+    process_t* proc = process_get_current();
+    if (proc == 0 || proc->ipc.reply_to == 0) {
+        return -1;
+    }
+
+    process_t* caller = proc->ipc.reply_to;
+    if (ipc_stage(proc, msg, caller->ipc.endpoint, 0) != 0) {
+        return -1;
+    }
+    ipc_endpoint_t* ep = &endpoints[caller->ipc.endpoint];
+
+    uint32_t flags = spin_lock_irqsave(&ep->lock);
+    proc->ipc.reply_to = 0;
+
+    /* The caller's window is the range its call's pages left. A reply
+       that does not fit still releases the caller, with -1. */
+    int32_t result = ipc_transfer(proc, caller);
+    caller->ipc.status = result;
+    caller->ipc.state = IPC_STATE_NONE;
+
+    spin_unlock(&ep->lock);
+    ipc_switch_to(caller);
+    irq_restore(flags);
+    return result;
+}
+
+void ipc_process_exit(process_t* proc) {
+    /* A caller waiting for our reply would wait forever */
+    process_t* caller = proc->ipc.reply_to;
+    if (caller != 0) {
+        ipc_endpoint_t* ep = &endpoints[caller->ipc.endpoint];
+        uint32_t flags = spin_lock_irqsave(&ep->lock);
+        proc->ipc.reply_to = 0;
+        caller->ipc.state = IPC_STATE_NONE;
+        caller->ipc.status = -1;
+        ipc_wake(caller);
+        spin_unlock_irqrestore(&ep->lock, flags);
+    }
+
+    for (uint32_t i = 0; i < IPC_MAX_ENDPOINTS; i++) {
+        ipc_endpoint_t* ep = &endpoints[i];
+        uint32_t flags = spin_lock_irqsave(&ep->lock);
+        if (ep->in_use && ep->owner == proc->pid) {
+            ipc_endpoint_close(ep);
+        }
+        spin_unlock_irqrestore(&ep->lock, flags);
+    }
+}
@@ -0,0 +1,253 @@
+/* SYNAPSE SO - Interrupt Controller Routing */
+/* Licensed under GPLv3 */
+
+/* The PIC is remapped to vectors 32-47 by idt_init() and delivers IRQs
+ * until irq_init() finds an I/O APIC in the MADT. From then on the PIC is
+ * fully masked, the local APIC no longer passes ExtINT through LINT0, and
+ * every interrupt is acknowledged with a single MMIO write to the local
+ * APIC EOI register instead of one or two outb to the PICs. */
+
+#include <kernel/irq.h>
+#include <kernel/acpi.h>
+#include <kernel/cpu.h>
+#include <kernel/io.h>
+#include <kernel/ioapic.h>
+#include <kernel/lapic.h>
+#include <kernel/heap.h>
+#include <kernel/rcu.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/vga.h>
+
+_Static_assert(IRQ_VECTOR_LAST == IPI_TICK_VECTOR, "IRQ_VECTOR_LAST");
+
+/* IRQ 2 is the slave PIC cascade and never raised by a device */
+#define IRQ_CASCADE 2
+
+#define IS_ISA_VECTOR(v) ((v) >= IRQ_BASE_VECTOR && (v) < IRQ_BASE_VECTOR + IRQ_COUNT)
+
+static int apic_mode;
+
+/* One registered handler; a vector's handlers form an RCU list */
+typedef struct irq_action {
+    irq_handler_t fn;
+    void* ctx;
+    struct irq_action* next;
+} irq_action_t;
+
+static irq_action_t* irq_actions[IRQ_VECTOR_COUNT];
+
+/* Serializes registration; dispatch reads the lists without it */
+static spinlock_t irq_actions_lock = SPINLOCK_INIT("irq_actions");
+
+/* Per-CPU so counting never bounces a cache line between CPUs */
+static uint32_t irq_counts[MAX_CPUS][IRQ_VECTOR_COUNT];
+static uint32_t irq_unhandled[MAX_CPUS][IRQ_VECTOR_COUNT];
+
+static void pic_set_masked(uint8_t irq, int masked) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    uint8_t bit = (uint8_t)(1 << (irq & 7));
+
+    uint32_t flags = irq_save();
+    uint8_t mask = inb(port);
+    outb(port, masked ? (mask | bit) : (mask & ~bit));
+    irq_restore(flags);
+}
+
+void irq_init(void) {
+    vga_print("[+] Initializing interrupt controllers...\n");
+
+    if (acpi_init() != 0 || acpi_get_lapic_addr() == 0) {
+        vga_print("    No MADT, using the 8259 PIC\n");
+        return;
+    }
+
+    lapic_init(acpi_get_lapic_addr());
+
+    if (ioapic_init() != 0) {
+        vga_print("    No I/O APIC, using the 8259 PIC\n");
+        return;
+    }
+
+    /* Mask the PIC first so nothing is delivered through both paths */
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    lapic_mask_lint0();
+
+    uint8_t bsp = (uint8_t)lapic_id();
+    for (uint8_t irq = 0; irq < IRQ_COUNT; irq++) {
+        if (irq != IRQ_CASCADE) {
+            ioapic_route_isa(irq, IRQ_BASE_VECTOR + irq, bsp);
+        }
+    }
+
+    apic_mode = 1;
+    vga_print("    ISA IRQs routed through the I/O APIC, PIC masked\n");
+}
+
+int irq_apic_mode(void) {
+    return apic_mode;
+}
+
+void irq_eoi(uint32_t vector) {
+    if (apic_mode || vector >= IRQ_BASE_VECTOR + IRQ_COUNT) {
+        lapic_eoi();
+        return;
+    }
+
+    if (vector >= IRQ_BASE_VECTOR + 8) {
+        /* Slave PIC */
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    /* Master PIC */
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+void irq_mask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) {
+        return;
+    }
+
+    if (apic_mode) {
+        ioapic_mask_isa(irq);
+    } else {
+        pic_set_masked(irq, 1);
+    }
+}
+
+void irq_unmask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) {
+        return;
+    }
+
+    if (apic_mode) {
+        ioapic_unmask_isa(irq);
+    } else {
+        pic_set_masked(irq, 0);
+    }
+}
+
+int irq_register_handler(uint32_t vector, irq_handler_t fn, void* ctx) {
+    if (vector < IRQ_VECTOR_FIRST || vector > IRQ_VECTOR_LAST || fn == 0 ||
+        vector == IRQ_BASE_VECTOR + IRQ_CASCADE) {
+        return -1;
+    }
+
+    irq_action_t* action = (irq_action_t*)kmalloc(sizeof(irq_action_t));
+    if (action == 0) {
+        return -1;
+    }
+    action->fn = fn;
+    action->ctx = ctx;
+    action->next = 0;
+
+    uint32_t flags = spin_lock_irqsave(&irq_actions_lock);
+
+    irq_action_t** link = &irq_actions[vector - IRQ_VECTOR_FIRST];
+    while (*link != 0) {
+        if ((*link)->fn == fn && (*link)->ctx == ctx) {
+            spin_unlock_irqrestore(&irq_actions_lock, flags);
+            kfree(action);
+            return -1;
+        }
+        link = &(*link)->next;
+    }
+
+    int first = (irq_actions[vector - IRQ_VECTOR_FIRST] == 0);
+    rcu_assign_pointer(*link, action);
+
+    if (first && IS_ISA_VECTOR(vector)) {
+        irq_unmask((uint8_t)(vector - IRQ_BASE_VECTOR));
+    }
+
+    spin_unlock_irqrestore(&irq_actions_lock, flags);
+    return 0;
+}
+
+int irq_unregister_handler(uint32_t vector, irq_handler_t fn, void* ctx) {
+    if (vector < IRQ_VECTOR_FIRST || vector > IRQ_VECTOR_LAST) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&irq_actions_lock);
+
+    irq_action_t** link = &irq_actions[vector - IRQ_VECTOR_FIRST];
+    while (*link != 0 && !((*link)->fn == fn && (*link)->ctx == ctx)) {
+        link = &(*link)->next;
+    }
+
+    irq_action_t* action = *link;
+    if (action == 0) {
+        spin_unlock_irqrestore(&irq_actions_lock, flags);
+        return -1;
+    }
+
+    /* Readers past action still see its next pointer */
+    rcu_assign_pointer(*link, action->next);
+
+    if (irq_actions[vector - IRQ_VECTOR_FIRST] == 0 && IS_ISA_VECTOR(vector)) {
+        irq_mask((uint8_t)(vector - IRQ_BASE_VECTOR));
+    }
+
+    spin_unlock_irqrestore(&irq_actions_lock, flags);
+
+    synchronize_rcu();
+    kfree(action);
+    return 0;
+}
+
+int irq_dispatch(registers_t* regs) {
+    uint32_t vector = regs->int_no;
+    if (vector < IRQ_VECTOR_FIRST || vector > IRQ_VECTOR_LAST) {
+        return IRQ_NONE;
+    }
+
+    uint32_t index = cpu_current()->index;
+    irq_counts[index][vector - IRQ_VECTOR_FIRST]++;
+
+    int result = IRQ_NONE;
+    rcu_read_lock();
+    irq_action_t* action = rcu_dereference(irq_actions[vector - IRQ_VECTOR_FIRST]);
+    int registered = (action != 0);
+    while (action != 0) {
+        result |= action->fn(regs, action->ctx);
+        action = rcu_dereference(action->next);
+    }
+    rcu_read_unlock();
+
+    if (result == IRQ_NONE) {
+        irq_unhandled[index][vector - IRQ_VECTOR_FIRST]++;
+
+        /* Nobody listens on this line: stop it from firing again, unless
+           a handler was registered meanwhile */
+        if (!registered && IS_ISA_VECTOR(vector)) {
+            spin_lock(&irq_actions_lock);
+            if (irq_actions[vector - IRQ_VECTOR_FIRST] == 0) {
+                irq_mask((uint8_t)(vector - IRQ_BASE_VECTOR));
+            }
+            spin_unlock(&irq_actions_lock);
+        }
+    }
+
+    return result;
+}
+
+static uint32_t irq_sum(uint32_t counts[MAX_CPUS][IRQ_VECTOR_COUNT], uint32_t vector) {
+    if (vector < IRQ_VECTOR_FIRST || vector > IRQ_VECTOR_LAST) {
+        return 0;
+    }
+
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        total += counts[i][vector - IRQ_VECTOR_FIRST];
+    }
+    return total;
+}
+
+uint32_t irq_get_count(uint32_t vector) {
+    return irq_sum(irq_counts, vector);
+}
+
+uint32_t irq_get_unhandled(uint32_t vector) {
+    return irq_sum(irq_unhandled, vector);
+}
@@ -6,6 +6,11 @@ section .text
 ; Segment selector constants (must match kernel/include/kernel/gdt.h)
 %define GDT_KERNEL_CODE 0x08
 %define GDT_KERNEL_DATA 0x10
+%define GDT_KERNEL_PERCPU 0x30
+
+; Offsets into registers_t (kernel/include/kernel/idt.h)
+%define REGS_INT_NO 48
+%define REGS_CS 60
 
 ; Macro for ISR without error code
 ; These push a dummy error code to keep stack uniform
@@ -90,6 +95,20 @@ IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
 
+; Local APIC vectors (must match kernel/include/kernel/lapic.h)
+ISR_NOERRCODE 48  ; LAPIC timer
+ISR_NOERRCODE 49  ; Reschedule IPI
+ISR_NOERRCODE 50  ; Tick IPI
+
+; System call gate (must match SYSCALL_VECTOR in kernel/include/kernel/syscall.h).
+; push byte would sign-extend 128, so the vector is pushed as a dword.
+global isr128
+isr128:
+    cli
+    push byte 0
+    push dword 128
+    jmp isr_common_stub
+
 ; Default ISR for unhandled interrupts
 global isr_default
 isr_default:
@@ -99,23 +118,40 @@ isr_default:
     jmp isr_common_stub
 
 extern isr_handler
+extern scheduler_finish_switch
 
 isr_common_stub:
     ; Save general-purpose registers
     pusha                    ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
 
+    ; C code expects DF clear; the interrupted code may have set it (a
+    ; backward memmove, or ring 3). IRET restores it from the frame.
+    cld
+
     ; Save segment registers
     push ds
     push es
     push fs
     push gs
 
+    ; Segment loads are serializing. An interrupt from ring 0 arrives with
+    ; the kernel segments already loaded, so only entries from ring 3 and
+    ; exceptions (one raised while unwinding a frame to ring 3 may find
+    ; user selectors) reload them. The frame keeps its full layout.
+    cmp dword [esp + REGS_INT_NO], 32
+    jb .load_segments
+    test dword [esp + REGS_CS], 3
+    jz .segments_loaded
 
+.load_segments:
     mov ax, GDT_KERNEL_DATA        ; Load kernel data segment
     mov ds, ax
     mov es, ax
-    mov fs, ax
     mov gs, ax
+    mov ax, GDT_KERNEL_PERCPU      ; FS addresses this CPU's cpu_t
+    mov fs, ax
+
+.segments_loaded:
 
     ; Call C handler
     mov eax, esp
@@ -126,16 +162,36 @@ isr_common_stub:
     ; Allow the C handler (scheduler) to switch contexts by returning a
     ; different registers_t frame pointer in EAX.
     test eax, eax
-    jz .no_context_switch
+    jz isr_restore_frame
+    cmp eax, esp
+    je isr_restore_frame
     mov esp, eax
-.no_context_switch:
+
+    ; Off the previous process's stack: let other CPUs run it
+    call scheduler_finish_switch
+
+; Unwind a registers_t frame at ESP and return from the interrupt.
+; context_switch_frame (switch.asm) also jumps here to resume a process
+; that was preempted by an interrupt.
+global isr_restore_frame
+isr_restore_frame:
+
+    ; A frame returning to ring 0 holds the kernel segments we are
+    ; running with: skip reloading them
+    test dword [esp + REGS_CS], 3
+    jz .kernel_frame
 
     ; Restore segment registers
     pop gs
     pop fs
     pop es
     pop ds
+    jmp .restore_gprs
+
+.kernel_frame:
+    add esp, 16
 
+.restore_gprs:
     ; Restore general-purpose registers
     popa
 
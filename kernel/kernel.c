@@ -11,6 +11,17 @@
 #include <kernel/scheduler.h>
 #include <kernel/timer.h>
 #include <kernel/elf.h>
+#include <kernel/fpu.h>
+#include <kernel/smp.h>
+#include <kernel/irq.h>
+#include <kernel/syscall.h>
+#include <kernel/softirq.h>
+#include <kernel/workqueue.h>
+#include <kernel/serial.h>
+#include <kernel/trace.h>
+#include <kernel/profile.h>
+#include <kernel/printk.h>
+#include <kernel/string.h>
 
 /* Multiboot information structure */
 typedef struct {
@@ -33,12 +44,7 @@ static void worker_a(void) {
         uint32_t now = timer_get_ticks();
         if (now - last >= 100) {
             last = now;
-            /* Make the VGA prints atomic to avoid concurrent corruption. */
-            __asm__ __volatile__("cli");
-            vga_print("[A] ticks=");
-            vga_print_dec(now);
-            vga_print("\n");
-            __asm__ __volatile__("sti");
+            kprintf(KLOG_INFO, "[A] ticks=%u\n", now);
         }
         __asm__ __volatile__("hlt");
     }
@@ -51,21 +57,39 @@ static void worker_b(void) {
         uint32_t now = timer_get_ticks();
         if (now - last >= 137) {
             last = now;
-            /* Make the VGA prints atomic to avoid concurrent corruption. */
-            __asm__ __volatile__("cli");
-            vga_print("[B] ticks=");
-            vga_print_dec(now);
-            vga_print("\n");
-            __asm__ __volatile__("sti");
+            kprintf(KLOG_INFO, "[B] ticks=%u\n", now);
         }
         __asm__ __volatile__("hlt");
     }
 }
 
+#if CONFIG_LOG_LEVEL >= KLOG_DEBUG
+/* With debug logging (make LOG_LEVEL=3), dump the process table every
+   10 seconds; SYS_PS prints it on demand */
+#define PS_DUMP_TICKS 1000
+
+static void ps_dump(void) {
+    uint32_t last = timer_get_ticks();
+
+    while (1) {
+        uint32_t now = timer_get_ticks();
+        if (now - last >= PS_DUMP_TICKS) {
+            last = now;
+            process_print_table();
+        }
+        __asm__ __volatile__("hlt");
+    }
+}
+#endif
+
 /* Kernel main function - entry point from bootloader */
 void kernel_main(unsigned int magic, multiboot_info_t* mbi) {
     /* Clear screen */
     vga_clear_screen();
+    klog_init();
+
+    /* memcpy/memset strategy for this CPU */
+    string_init();
 
     /* Print kernel banner */
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -90,6 +114,9 @@ void kernel_main(unsigned int magic, multiboot_info_t* mbi) {
         vga_print("[-] Warning: Multiboot info pointer is null\n");
     }
 
+    /* COM1: serial console (polled until its IRQ is hooked) and dumps */
+    serial_init();
+
     /* Initialize GDT */
     vga_print("[+] Initializing Global Descriptor Table...\n");
     gdt_init();
@@ -129,16 +156,52 @@ void kernel_main(unsigned int magic, multiboot_info_t* mbi) {
     vga_print("\n=== PHASE 2: Process Management ===\n");
     process_init();
     scheduler_init();
+    fpu_init();
+    syscall_init();
+    softirq_init();
 
     /* Create a process representing the currently running kernel context */
     process_create_current("kernel_main");
 
+    /* Local APIC and I/O APIC from the ACPI MADT (8259 PIC fallback) */
+    irq_init();
+
+    /* Console output to COM1 is now queued and drained by its IRQ */
+    serial_start_irq();
+
+    /* Monotonic clock, calibrated against the PIT */
+    clock_init();
+
+    /* Scheduler tick: local APIC timer, so APs can start theirs on boot.
+       Interrupts stay disabled on this CPU until the end of kernel_main. */
+    timer_init(100);
+
+    /* Start the other CPUs; each runs its own run queue from now on */
+    smp_init();
+
+    process_start_reaper();
+    workqueue_init();
+    klog_start();
+
+    /* Without CONFIG_TRACE or CONFIG_PROFILE these do nothing */
+    trace_init();
+    profile_init();
+
+#ifdef CONFIG_SELFTEST
+    vmm_selftest();
+#endif
+
     /* Demo kernel threads */
     process_create("worker_a", PROC_FLAG_KERNEL, worker_a);
     process_create("worker_b", PROC_FLAG_KERNEL, worker_b);
-
-    /* Start PIT so scheduler_tick() runs from IRQ0 */
-    timer_init(100);
+#if CONFIG_LOG_LEVEL >= KLOG_DEBUG
+    process_create("ps", PROC_FLAG_KERNEL | PROC_FLAG_DETACHED, ps_dump);
+#endif
+
+#ifdef CONFIG_BENCHMARKS
+    process_create("bench", PROC_FLAG_KERNEL | PROC_FLAG_DETACHED, syscall_benchmark);
+    process_create("string_bench", PROC_FLAG_KERNEL | PROC_FLAG_DETACHED, string_benchmark);
+#endif
 
     /* Memory information */
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
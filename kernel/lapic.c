@@ -0,0 +1,196 @@
+/* SYNAPSE SO - Local APIC */
+/* Licensed under GPLv3 */
+
+#include <kernel/lapic.h>
+#include <kernel/vga.h>
+#include <kernel/vmm.h>
+#include <kernel/cpu.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+
+/* PIT interval the timer and the TSC are measured over */
+#define LAPIC_CALIBRATE_US 10000
+
+/* Registers are identity mapped uncached at their physical address */
+static volatile uint32_t* lapic_base;
+
+/* Tick period: TSC cycles in TSC-deadline mode, timer counts otherwise
+   (0 until lapic_timer_init()) */
+static uint32_t timer_period;
+static int timer_tsc_deadline;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+}
+
+/* Wait for the previous IPI to be accepted */
+static void lapic_wait_icr(void) {
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+/* The two ICR writes must not be split by an interrupt that sends an IPI */
+static void lapic_send_icr(uint32_t apic_id, uint32_t low) {
+    uint32_t flags = irq_save();
+
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, low);
+
+    irq_restore(flags);
+}
+
+void lapic_init(uint32_t phys_base) {
+    vmm_map_page(phys_base, phys_base, PAGE_PRESENT | PAGE_WRITE | PAGE_NOCACHE);
+    lapic_base = (volatile uint32_t*)phys_base;
+
+    lapic_init_cpu();
+
+    vga_print("    Local APIC ");
+    vga_print_dec(lapic_id());
+    vga_print(" enabled, version ");
+    vga_print_hex(lapic_read(LAPIC_REG_VERSION) & 0xFF);
+    vga_print("\n");
+}
+
+void lapic_init_cpu(void) {
+    /* Accept all priorities and enable with the spurious vector */
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    /* Clear stale errors (the ESR must be written before reading) */
+    lapic_write(LAPIC_REG_ESR, 0);
+    (void)lapic_read(LAPIC_REG_ESR);
+}
+
+int lapic_present(void) {
+    return lapic_base != 0;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector) {
+    lapic_send_icr(apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    lapic_wait_icr();
+}
+
+void lapic_send_startup(uint32_t apic_id, uint32_t page) {
+    lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | (page & 0xFF));
+    lapic_wait_icr();
+}
+
+void lapic_mask_lint0(void) {
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+}
+
+/* Scale a count measured over LAPIC_CALIBRATE_US (10ms) to one tick at
+   frequency_hz, in 32-bit arithmetic (no 64-bit division here) */
+static uint32_t lapic_scale_10ms(uint32_t count, uint32_t frequency_hz) {
+    return (count / frequency_hz) * 100 + ((count % frequency_hz) * 100) / frequency_hz;
+}
+
+static int lapic_has_tsc_deadline(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_EDX_TSC) && (edx & CPUID_EDX_MSR) &&
+           (ecx & CPUID_ECX_TSC_DEADLINE);
+}
+
+int lapic_timer_init(uint32_t frequency_hz) {
+    if (lapic_base == 0 || frequency_hz == 0) {
+        return -1;
+    }
+
+    /* Count down from the maximum in one-shot mode, masked, while the PIT
+       measures the interval; sample the TSC over the same interval */
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+
+    uint64_t tsc_start = rdtsc();
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0xFFFFFFFF);
+    timer_busy_wait_us(LAPIC_CALIBRATE_US);
+    uint32_t remaining = lapic_read(LAPIC_REG_TIMER_CURRENT);
+    uint64_t tsc_end = rdtsc();
+
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+
+    uint32_t counts = 0xFFFFFFFF - remaining;
+    if (lapic_has_tsc_deadline() && (uint32_t)((tsc_end - tsc_start) >> 32) == 0) {
+        timer_tsc_deadline = 1;
+        timer_period = lapic_scale_10ms((uint32_t)(tsc_end - tsc_start), frequency_hz);
+    } else {
+        timer_tsc_deadline = 0;
+        timer_period = lapic_scale_10ms(counts, frequency_hz);
+    }
+
+    if (timer_period == 0) {
+        vga_print("[-] Local APIC timer did not count, using the PIT\n");
+        return -1;
+    }
+
+    vga_print("    Local APIC timer: ");
+    vga_print_dec(lapic_scale_10ms(counts, 1000));
+    vga_print(" counts/ms (div 16), ");
+    vga_print(timer_tsc_deadline ? "TSC-deadline" : "periodic");
+    vga_print(" mode at ");
+    vga_print_dec(frequency_hz);
+    vga_print(" Hz\n");
+
+    lapic_timer_start_cpu();
+    return 0;
+}
+
+void lapic_timer_start_cpu(void) {
+    if (timer_period == 0) {
+        return;
+    }
+
+    if (timer_tsc_deadline) {
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+        /* Order the LVT write before the MSR write (SDM 10.5.4.1) */
+        __asm__ __volatile__("mfence" ::: "memory");
+
+        cpu_t* cpu = cpu_current();
+        cpu->timer_deadline = rdtsc() + timer_period;
+        wrmsr(MSR_IA32_TSC_DEADLINE, cpu->timer_deadline);
+    } else {
+        lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_REG_TIMER_INITIAL, timer_period);
+    }
+}
+
+void lapic_timer_rearm(void) {
+    if (!timer_tsc_deadline) {
+        return;
+    }
+
+    /* Advance from the previous deadline so ticks do not drift with
+       interrupt latency; skip missed ticks instead of bursting */
+    cpu_t* cpu = cpu_current();
+    uint64_t now = rdtsc();
+    cpu->timer_deadline += timer_period;
+    if (cpu->timer_deadline <= now) {
+        cpu->timer_deadline = now + timer_period;
+    }
+    wrmsr(MSR_IA32_TSC_DEADLINE, cpu->timer_deadline);
+}
+
+int lapic_timer_active(void) {
+    return timer_period != 0;
+}
@@ -0,0 +1,181 @@
+/* SYNAPSE SO - Lock-Free Ring Buffers */
+/* Licensed under GPLv3 */
+
+/* Index updates use acquire/release ordering: a side reads the other
+ * side's index with acquire before touching the slots it covers, and
+ * publishes its own index with release after it is done with them. On x86
+ * these are plain loads and stores; only the compiler is constrained. */
+
+#include <kernel/ring.h>
+
+static inline uint32_t load_acquire(const volatile uint32_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(volatile uint32_t* p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline int is_power_of_two(uint32_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+/* ------------------------------------------------------------------------
+ * SPSC
+ * ------------------------------------------------------------------------ */
+
+int ring_spsc_init(ring_spsc_t* ring, uint32_t* slots, uint32_t size) {
+    if (!is_power_of_two(size)) {
+        return -1;
+    }
+
+    ring->head = ring->tail_cache = 0;
+    ring->tail = ring->head_cache = 0;
+    ring->mask = size - 1;
+    ring->slots = slots;
+    return 0;
+}
+
+uint32_t ring_spsc_enqueue(ring_spsc_t* ring, const uint32_t* items, uint32_t count) {
+    uint32_t size = ring->mask + 1;
+    uint32_t tail = ring->tail;
+
+    uint32_t space = size - (tail - ring->head_cache);
+    if (space < count) {
+        ring->head_cache = load_acquire(&ring->head);
+        space = size - (tail - ring->head_cache);
+    }
+    if (count > space) {
+        count = space;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        ring->slots[(tail + i) & ring->mask] = items[i];
+    }
+
+    store_release(&ring->tail, tail + count);
+    return count;
+}
+
+uint32_t ring_spsc_dequeue(ring_spsc_t* ring, uint32_t* items, uint32_t count) {
+    uint32_t head = ring->head;
+
+    uint32_t avail = ring->tail_cache - head;
+    if (avail < count) {
+        ring->tail_cache = load_acquire(&ring->tail);
+        avail = ring->tail_cache - head;
+    }
+    if (count > avail) {
+        count = avail;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        items[i] = ring->slots[(head + i) & ring->mask];
+    }
+
+    store_release(&ring->head, head + count);
+    return count;
+}
+
+uint32_t ring_spsc_count(const ring_spsc_t* ring) {
+    uint32_t head = load_acquire(&ring->head);
+    return load_acquire(&ring->tail) - head;
+}
+
+/* ------------------------------------------------------------------------
+ * MPSC. Slot i starts with seq = i: free for position i. A producer that
+ * claimed position p stores the entry, then seq = p + 1 (published). The
+ * consumer takes it and sets seq = p + size, freeing the slot for the next
+ * lap, before it advances head past p.
+ * ------------------------------------------------------------------------ */
+
+int ring_mpsc_init(ring_mpsc_t* ring, ring_mpsc_slot_t* slots, uint32_t size) {
+    if (!is_power_of_two(size)) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        slots[i].seq = i;
+        slots[i].value = 0;
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = size - 1;
+    ring->slots = slots;
+    return 0;
+}
+
+/* Claim and fill up to count positions; with all set, exactly count or
+   none */
+static uint32_t mpsc_enqueue(ring_mpsc_t* ring, const uint32_t* items,
+                             uint32_t count, int all) {
+    uint32_t size = ring->mask + 1;
+    uint32_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t n;
+
+    /* Claim count (or as many as are free) consecutive positions. Slots
+       below head have been freed, so head bounds what may be claimed. */
+    while (1) {
+        uint32_t head = load_acquire(&ring->head);
+        if ((int32_t)(pos - head) < 0) {
+            /* Stale tail: the consumer has already passed it */
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        n = size - (pos - head);
+        if (n > count) {
+            n = count;
+        }
+        if (n == 0 || (all && n < count)) {
+            return 0;
+        }
+
+        /* On failure pos is reloaded with the current tail */
+        if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + n, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        ring_mpsc_slot_t* slot = &ring->slots[(pos + i) & ring->mask];
+        slot->value = items[i];
+        store_release(&slot->seq, pos + i + 1);
+    }
+
+    return n;
+}
+
+uint32_t ring_mpsc_enqueue(ring_mpsc_t* ring, const uint32_t* items, uint32_t count) {
+    return mpsc_enqueue(ring, items, count, 0);
+}
+
+uint32_t ring_mpsc_enqueue_all(ring_mpsc_t* ring, const uint32_t* items, uint32_t count) {
+    return mpsc_enqueue(ring, items, count, 1);
+}
+
+uint32_t ring_mpsc_dequeue(ring_mpsc_t* ring, uint32_t* items, uint32_t count) {
+    uint32_t size = ring->mask + 1;
+    uint32_t head = ring->head;
+    uint32_t n = 0;
+
+    /* Stop at the first slot not yet published, even if later ones are */
+    while (n < count) {
+        ring_mpsc_slot_t* slot = &ring->slots[(head + n) & ring->mask];
+        if (load_acquire(&slot->seq) != head + n + 1) {
+            break;
+        }
+        items[n] = slot->value;
+        store_release(&slot->seq, head + n + size);
+        n++;
+    }
+
+    store_release(&ring->head, head + n);
+    return n;
+}
+
+uint32_t ring_mpsc_count(const ring_mpsc_t* ring) {
+    uint32_t head = load_acquire(&ring->head);
+    return load_acquire(&ring->tail) - head;
+}
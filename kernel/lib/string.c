@@ -1,6 +1,16 @@
 /* SYNAPSE SO - String Library */
 /* Licensed under GPLv3 */
 
+#include <stdint.h>
+#include <kernel/string.h>
+#include <kernel/cpu.h>
+
+#ifdef CONFIG_BENCHMARKS
+#include <kernel/heap.h>
+#include <kernel/printk.h>
+#include <kernel/timer.h>
+#endif
+
 /* Get string length */
 int strlen(const char* str) {
     int len = 0;
@@ -51,25 +61,301 @@ int strncmp(const char* s1, const char* s2, int n) {
     return *(unsigned char*)s1 - *(unsigned char*)s2;
 }
 
-/* Copy memory */
-void* memcpy(void* dest, const void* src, unsigned int n) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
+/* ------------------------------------------------------------------------
+ * Memory. The block operations use the string instructions: rep movsd and
+ * rep stosd after aligning the destination, or rep movsb and rep stosb on
+ * CPUs with ERMS, whose microcode moves whole cache lines for them. The
+ * _nt variants write with movnti (SSE2, general registers), bypassing the
+ * cache, for large buffers that will not be read again soon.
+ * ------------------------------------------------------------------------ */
 
-    while (n--) {
-        *d++ = *s++;
+/* Below this many bytes the setup of a fast-string operation does not pay
+   for itself and the dword path is used even with ERMS */
+#define STRING_ERMS_MIN 128
+
+/* Selected by string_init() */
+static int string_erms;
+static int string_movnti;
+
+/* 32-bit access to byte buffers */
+typedef uint32_t string_word_t __attribute__((may_alias));
+
+void string_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    string_movnti = (edx & CPUID_EDX_SSE2) != 0;
+
+    if (max_leaf >= CPUID_LEAF_EXT_FEATURES) {
+        cpuid(CPUID_LEAF_EXT_FEATURES, &eax, &ebx, &ecx, &edx);
+        string_erms = (ebx & CPUID_EBX_ERMS) != 0;
     }
+}
+
+int string_has_erms(void) {
+    return string_erms;
+}
+
+int string_has_movnti(void) {
+    return string_movnti;
+}
 
+static inline void copy_bytes(void* dest, const void* src, uint32_t n) {
+    __asm__ __volatile__("rep movsb"
+                         : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+/* Bytes up to a 4-byte aligned destination, dwords, then the tail */
+static inline void copy_dwords(void* dest, const void* src, uint32_t n) {
+    uint32_t head = (0u - (uint32_t)dest) & 3;
+    uint32_t dwords = (n - head) >> 2;
+    uint32_t tail = (n - head) & 3;
+    __asm__ __volatile__("rep movsb\n\t"
+                         "mov %3, %%ecx\n\t"
+                         "rep movsl\n\t"
+                         "mov %4, %%ecx\n\t"
+                         "rep movsb"
+                         : "+D"(dest), "+S"(src), "+c"(head)
+                         : "r"(dwords), "r"(tail)
+                         : "memory");
+}
+
+static inline void fill_bytes(void* dest, uint8_t c, uint32_t n) {
+    __asm__ __volatile__("rep stosb"
+                         : "+D"(dest), "+c"(n) : "a"(c) : "memory");
+}
+
+static inline void fill_dwords(void* dest, uint8_t c, uint32_t n) {
+    uint32_t pattern = c * 0x01010101u;
+    uint32_t head = (0u - (uint32_t)dest) & 3;
+    uint32_t dwords = (n - head) >> 2;
+    uint32_t tail = (n - head) & 3;
+    __asm__ __volatile__("rep stosb\n\t"
+                         "mov %3, %%ecx\n\t"
+                         "rep stosl\n\t"
+                         "mov %4, %%ecx\n\t"
+                         "rep stosb"
+                         : "+D"(dest), "+c"(head)
+                         : "a"(pattern), "r"(dwords), "r"(tail)
+                         : "memory");
+}
+
+/* Copy memory */
+void* memcpy(void* dest, const void* src, unsigned int n) {
+    if (n < 8) {
+        copy_bytes(dest, src, n);
+    } else if (string_erms && n >= STRING_ERMS_MIN) {
+        copy_bytes(dest, src, n);
+    } else {
+        copy_dwords(dest, src, n);
+    }
     return dest;
 }
 
 /* Set memory */
 void* memset(void* s, int c, unsigned int n) {
-    unsigned char* p = (unsigned char*)s;
+    if (n < 8) {
+        fill_bytes(s, (uint8_t)c, n);
+    } else if (string_erms && n >= STRING_ERMS_MIN) {
+        fill_bytes(s, (uint8_t)c, n);
+    } else {
+        fill_dwords(s, (uint8_t)c, n);
+    }
+    return s;
+}
 
-    while (n--) {
-        *p++ = (unsigned char)c;
+/* Copy memory that may overlap */
+void* memmove(void* dest, const void* src, unsigned int n) {
+    /* A forward copy is safe unless dest starts inside src */
+    if ((uint32_t)dest - (uint32_t)src >= n) {
+        return memcpy(dest, src, n);
     }
 
+    /* Backwards from the last byte: the odd bytes, then dwords. Interrupt
+       entry clears DF, so handlers are not affected by the std. */
+    uint8_t* d = (uint8_t*)dest + n - 1;
+    const uint8_t* s = (const uint8_t*)src + n - 1;
+    uint32_t tail = n & 3;
+    uint32_t dwords = n >> 2;
+    __asm__ __volatile__("std\n\t"
+                         "rep movsb\n\t"
+                         "sub $3, %%esi\n\t"
+                         "sub $3, %%edi\n\t"
+                         "mov %3, %%ecx\n\t"
+                         "rep movsl\n\t"
+                         "cld"
+                         : "+D"(d), "+S"(s), "+c"(tail)
+                         : "r"(dwords)
+                         : "memory", "cc");
+    return dest;
+}
+
+/* Compare memory */
+int memcmp(const void* s1, const void* s2, unsigned int n) {
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+
+    /* Skip equal dwords; a differing one is resolved bytewise below */
+    while (n >= 4 && *(const string_word_t*)a == *(const string_word_t*)b) {
+        a += 4;
+        b += 4;
+        n -= 4;
+    }
+
+    while (n > 0) {
+        if (*a != *b) {
+            return *a - *b;
+        }
+        a++;
+        b++;
+        n--;
+    }
+    return 0;
+}
+
+/* Non-temporal stores: 32 bytes per iteration, then a fence so they are
+   visible before anything stored after the call */
+static void copy_movnti(void* dest, const void* src, uint32_t n) {
+    string_word_t* d = (string_word_t*)dest;
+    const string_word_t* s = (const string_word_t*)src;
+
+    for (uint32_t i = 0; i < n / 4; i += 8) {
+        for (uint32_t j = 0; j < 8; j++) {
+            __asm__ __volatile__("movnti %1, %0" : "=m"(d[i + j]) : "r"(s[i + j]));
+        }
+    }
+    __asm__ __volatile__("sfence" : : : "memory");
+}
+
+static void fill_movnti(void* dest, uint8_t c, uint32_t n) {
+    string_word_t* d = (string_word_t*)dest;
+    uint32_t pattern = c * 0x01010101u;
+
+    for (uint32_t i = 0; i < n / 4; i += 8) {
+        for (uint32_t j = 0; j < 8; j++) {
+            __asm__ __volatile__("movnti %1, %0" : "=m"(d[i + j]) : "r"(pattern));
+        }
+    }
+    __asm__ __volatile__("sfence" : : : "memory");
+}
+
+/* The bulk goes through movnti once dest is 4-byte aligned, in 32-byte
+   blocks; the ends through the regular path */
+void* memcpy_nt(void* dest, const void* src, unsigned int n) {
+    uint32_t head = (0u - (uint32_t)dest) & 3;
+    if (!string_movnti || n < head + 32) {
+        return memcpy(dest, src, n);
+    }
+
+    uint32_t body = (n - head) & ~31u;
+    memcpy(dest, src, head);
+    copy_movnti((uint8_t*)dest + head, (const uint8_t*)src + head, body);
+    memcpy((uint8_t*)dest + head + body, (const uint8_t*)src + head + body,
+           n - head - body);
+    return dest;
+}
+
+void* memset_nt(void* s, int c, unsigned int n) {
+    uint32_t head = (0u - (uint32_t)s) & 3;
+    if (!string_movnti || n < head + 32) {
+        return memset(s, c, n);
+    }
+
+    uint32_t body = (n - head) & ~31u;
+    memset(s, c, head);
+    fill_movnti((uint8_t*)s + head, (uint8_t)c, body);
+    memset((uint8_t*)s + head + body, c, n - head - body);
     return s;
 }
+
+#ifdef CONFIG_BENCHMARKS
+
+/* Bytes moved per measurement, as a power of two */
+#define STRING_BENCH_SHIFT  20
+#define STRING_BENCH_MAX    (64 * 1024)
+
+/* The old byte loop, as the baseline. The empty asm keeps the compiler
+   from turning it back into a memcpy call. */
+static void copy_loop(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    while (n--) {
+        *d++ = *s++;
+        __asm__ __volatile__("");
+    }
+}
+
+static void copy_rep_movsb(void* dest, const void* src, uint32_t n) {
+    copy_bytes(dest, src, n);
+}
+
+static void copy_rep_movsd(void* dest, const void* src, uint32_t n) {
+    copy_dwords(dest, src, n);
+}
+
+static void copy_nt(void* dest, const void* src, uint32_t n) {
+    memcpy_nt(dest, src, n);
+}
+
+typedef void (*string_bench_copy_t)(void* dest, const void* src, uint32_t n);
+
+/* Columns of the result table */
+static const string_bench_copy_t string_bench_variants[] = {
+    copy_loop, copy_rep_movsd, copy_rep_movsb, copy_nt,
+};
+
+#define STRING_BENCH_VARIANTS \
+    (sizeof(string_bench_variants) / sizeof(string_bench_variants[0]))
+
+/* Cycles per copy of size bytes (a power of two), both buffers offset by
+   align */
+static uint32_t string_bench_run(string_bench_copy_t copy, uint8_t* dst,
+                                 const uint8_t* src, uint32_t size_shift,
+                                 uint32_t align) {
+    uint32_t size = 1u << size_shift;
+    uint32_t shift = STRING_BENCH_SHIFT - size_shift;
+
+    /* Warm up, then time */
+    copy(dst + align, src + align, size);
+    uint64_t start = clock_cycles();
+    for (uint32_t i = 0; i < (1u << shift); i++) {
+        copy(dst + align, src + align, size);
+    }
+    return (uint32_t)((clock_cycles() - start) >> shift);
+}
+
+void string_benchmark(void) {
+    uint8_t* src = (uint8_t*)kmalloc(STRING_BENCH_MAX + 64);
+    uint8_t* dst = (uint8_t*)kmalloc(STRING_BENCH_MAX + 64);
+    if (src == 0 || dst == 0) {
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+    memset(src, 0x5A, STRING_BENCH_MAX + 64);
+
+    kprintf(KLOG_INFO, "[+] memcpy cycles per call (ERMS %s, movnti %s):\n",
+            string_erms ? "yes" : "no", string_movnti ? "yes" : "no");
+    kprintf(KLOG_INFO, "     size al    loop   movsd   movsb  movnti\n");
+
+    /* 64 bytes to 64KB, with both buffers aligned and then both off by 3 */
+    for (uint32_t size_shift = 6; size_shift <= 16; size_shift += 2) {
+        for (uint32_t align = 0; align <= 3; align += 3) {
+            uint32_t cycles[STRING_BENCH_VARIANTS];
+            for (uint32_t v = 0; v < STRING_BENCH_VARIANTS; v++) {
+                cycles[v] = string_bench_run(string_bench_variants[v], dst, src,
+                                             size_shift, align);
+            }
+            kprintf(KLOG_INFO, "    %5u %2u %7u %7u %7u %7u\n", 1u << size_shift,
+                    align, cycles[0], cycles[1], cycles[2], cycles[3]);
+        }
+    }
+
+    kfree(src);
+    kfree(dst);
+}
+
+#endif /* CONFIG_BENCHMARKS */
@@ -0,0 +1,50 @@
+/* SYNAPSE SO - Lock Contention Statistics */
+/* Licensed under GPLv3 */
+
+#include <kernel/spinlock.h>
+#include <kernel/vga.h>
+
+/* Named locks that have seen contention (lock-free push only) */
+static lock_stat_t* volatile lock_stats_head;
+
+void lock_stat_contended(lock_stat_t* stat, uint32_t spins) {
+    stat->contended++;
+    stat->spins += spins;
+
+    if (stat->name == 0 || stat->registered ||
+        !__sync_bool_compare_and_swap(&stat->registered, 0, 1)) {
+        return;
+    }
+
+    lock_stat_t* head;
+    do {
+        head = lock_stats_head;
+        stat->next = head;
+    } while (!__sync_bool_compare_and_swap(&lock_stats_head, head, stat));
+}
+
+/* Print a decimal right-aligned in a field of the given width */
+static void print_dec_field(uint32_t num, uint32_t width) {
+    uint32_t digits = 1;
+    for (uint32_t n = num; n >= 10; n /= 10) {
+        digits++;
+    }
+
+    while (width-- > digits) {
+        vga_put_char(' ');
+    }
+    vga_print_dec(num);
+    vga_put_char(' ');
+}
+
+void lock_print_stats(void) {
+    vga_print("   ACQUIRED  CONTENDED      SPINS LOCK\n");
+
+    for (lock_stat_t* stat = lock_stats_head; stat != 0; stat = stat->next) {
+        print_dec_field(stat->acquired, 10);
+        print_dec_field(stat->contended, 10);
+        print_dec_field(stat->spins, 10);
+        vga_print(stat->name);
+        vga_print("\n");
+    }
+}
@@ -3,7 +3,11 @@
 
 #include <kernel/pmm.h>
 #include <kernel/vga.h>
+#include <kernel/printk.h>
 #include <kernel/io.h>
+#include <kernel/spinlock.h>
+#include <kernel/trace.h>
+#include <kernel/vmm.h>
 
 /* Bitmap for tracking frames */
 /* Each bit represents one 4KB frame */
@@ -12,6 +16,26 @@ static uint32_t total_frames;
 static uint32_t used_frames;
 static uint32_t last_used_frame;
 
+/* Protects the bitmap, the frame counters and the reference table */
+static spinlock_t pmm_lock = SPINLOCK_INIT("pmm");
+
+/* Reference counts. An allocated frame has one reference unless it is in
+   this table, which holds the extra references of shared frames (open
+   addressing with linear probing, keyed by frame index + 1 so that 0
+   marks an empty slot). */
+typedef struct {
+    uint32_t key;
+    uint32_t extra;
+} frame_ref_t;
+
+static frame_ref_t frame_refs[PMM_SHARED_FRAMES];
+static uint32_t shared_frames;
+
+/* Zeroed frames, allocated in the bitmap and owned by the pool (a stack,
+   under pmm_lock). pmm_alloc_frame falls back on them before failing. */
+static uint32_t zero_pool[PMM_ZERO_POOL];
+static uint32_t zero_pool_count;
+
 /* Physical memory information */
 static uint32_t total_memory;
 
@@ -60,6 +84,44 @@ static inline void frame_set_free(uint32_t frame) {
     used_frames--;
 }
 
+static inline uint32_t ref_slot(uint32_t key) {
+    return (key * 2654435761u) & (PMM_SHARED_FRAMES - 1);
+}
+
+/* Slot of frame in frame_refs, or the empty slot where it would go */
+static uint32_t ref_find(uint32_t frame) {
+    uint32_t key = frame + 1;
+    uint32_t slot = ref_slot(key);
+    while (frame_refs[slot].key != 0 && frame_refs[slot].key != key) {
+        slot = (slot + 1) & (PMM_SHARED_FRAMES - 1);
+    }
+    return slot;
+}
+
+/* Empty a slot, moving later entries of the probe chain back so lookups
+   never stop early */
+static void ref_remove(uint32_t slot) {
+    uint32_t next = slot;
+    while (1) {
+        next = (next + 1) & (PMM_SHARED_FRAMES - 1);
+        if (frame_refs[next].key == 0) {
+            break;
+        }
+
+        /* An entry may fill the hole if its home slot is not in (slot, next] */
+        uint32_t home = ref_slot(frame_refs[next].key);
+        if (((next - home) & (PMM_SHARED_FRAMES - 1)) >=
+            ((next - slot) & (PMM_SHARED_FRAMES - 1))) {
+            frame_refs[slot] = frame_refs[next];
+            slot = next;
+        }
+    }
+
+    frame_refs[slot].key = 0;
+    frame_refs[slot].extra = 0;
+    shared_frames--;
+}
+
 /* Initialize PMM */
 void pmm_init(mem_map_t* mmap, uint32_t mmap_size, uint32_t mmap_desc_size) {
     vga_print("[+] Initializing Physical Memory Manager...\n");
@@ -116,6 +178,14 @@ void pmm_init(mem_map_t* mmap, uint32_t mmap_size, uint32_t mmap_desc_size) {
         entry = (mem_map_entry_t*)((uint32_t)entry + mmap_desc_size);
     }
 
+    /* Keep the first 1MB (real-mode IVT, BDA, EBDA, BIOS and the AP
+       startup trampoline) out of the allocator */
+    for (uint32_t f = 0; f < addr_to_frame(0x100000) && f < total_frames; f++) {
+        if (frame_is_free(f)) {
+            frame_set_used(f);
+        }
+    }
+
     /* Mark kernel region as used (1MB to 2MB for now) */
     uint32_t kernel_start_frame = addr_to_frame(0x100000);
     uint32_t kernel_end_frame = addr_to_frame(0x200000);
@@ -145,8 +215,9 @@ void pmm_init(mem_map_t* mmap, uint32_t mmap_size, uint32_t mmap_desc_size) {
     vga_print("\n");
 }
 
-/* Allocate a physical frame */
-uint32_t pmm_alloc_frame(void) {
+/* Take a free frame from the bitmap; 0 if there is none (frame 0 is
+   never free). pmm_lock held. */
+static uint32_t bitmap_alloc_locked(void) {
     /* Start from last used frame for better locality */
     uint32_t start_frame = last_used_frame;
 
@@ -159,13 +230,86 @@ uint32_t pmm_alloc_frame(void) {
             return frame_to_addr(frame);
         }
     }
-
-    /* No free frames available */
-    vga_print("[-] Error: Out of physical memory!\n");
     return 0;
 }
 
-/* Free a physical frame */
+/* Take a frame from the zeroed pool; 0 if it is empty. pmm_lock held. */
+static uint32_t zero_pool_take_locked(void) {
+    return (zero_pool_count > 0) ? zero_pool[--zero_pool_count] : 0;
+}
+
+/* Allocate a physical frame */
+uint32_t pmm_alloc_frame(void) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t frame_addr = bitmap_alloc_locked();
+    if (frame_addr == 0) {
+        /* The bitmap is exhausted; zeroed frames are frames too */
+        frame_addr = zero_pool_take_locked();
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    if (frame_addr == 0) {
+        /* No free frames available */
+        kprintf(KLOG_ERR, "[-] Error: Out of physical memory!\n");
+        return 0;
+    }
+
+    TRACE(TRACE_PAGE_ALLOC, frame_addr, 0, 0, 0);
+    return frame_addr;
+}
+
+/* Allocate a zeroed frame */
+uint32_t pmm_alloc_zeroed_frame(void) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t frame_addr = zero_pool_take_locked();
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    if (frame_addr != 0) {
+        TRACE(TRACE_PAGE_ALLOC, frame_addr, 0, 0, 0);
+        return frame_addr;
+    }
+
+    /* Pool empty: clear one here, with cached stores since the caller is
+       about to use it */
+    frame_addr = pmm_alloc_frame();
+    if (frame_addr != 0) {
+        page_zero(vmm_phys_to_virt(frame_addr));
+    }
+    return frame_addr;
+}
+
+/* Zero a frame into the pool */
+int pmm_zero_pool_refill(void) {
+    uint32_t frame_addr = 0;
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (zero_pool_count < PMM_ZERO_POOL &&
+        total_frames - used_frames > PMM_ZERO_RESERVE) {
+        frame_addr = bitmap_alloc_locked();
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    if (frame_addr == 0) {
+        return 0;
+    }
+
+    /* Outside the lock, and past the cache: nobody reads the frame before
+       it is handed out */
+    page_zero_nt(vmm_phys_to_virt(frame_addr));
+
+    flags = spin_lock_irqsave(&pmm_lock);
+    int added = zero_pool_count < PMM_ZERO_POOL;
+    if (added) {
+        zero_pool[zero_pool_count++] = frame_addr;
+    } else {
+        /* Another CPU filled the pool first */
+        frame_set_free(addr_to_frame(frame_addr));
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return added;
+}
+
+/* Drop a reference to a physical frame, freeing it with the last one */
 void pmm_free_frame(uint32_t frame_addr) {
     uint32_t frame = addr_to_frame(frame_addr);
 
@@ -173,21 +317,75 @@ void pmm_free_frame(uint32_t frame_addr) {
         return;
     }
 
-    if (frame_is_free(frame)) {
-        return;
+    TRACE(TRACE_PAGE_FREE, frame_addr, 0, 0, 0);
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (!frame_is_free(frame)) {
+        uint32_t slot = ref_find(frame);
+        if (frame_refs[slot].key != 0) {
+            if (--frame_refs[slot].extra == 0) {
+                ref_remove(slot);
+            }
+        } else {
+            frame_set_free(frame);
+        }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+/* Take another reference to an allocated frame */
+int pmm_ref_frame(uint32_t frame_addr) {
+    uint32_t frame = addr_to_frame(frame_addr);
 
-    frame_set_free(frame);
+    if (frame >= total_frames) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    int result = -1;
+    if (!frame_is_free(frame)) {
+        uint32_t slot = ref_find(frame);
+        if (frame_refs[slot].key != 0) {
+            frame_refs[slot].extra++;
+            result = 0;
+        } else if (shared_frames < PMM_SHARED_FRAMES / 2) {
+            /* Kept at most half full so probe chains stay short */
+            frame_refs[slot].key = frame + 1;
+            frame_refs[slot].extra = 1;
+            shared_frames++;
+            result = 0;
+        }
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return result;
+}
+
+/* Get the number of references to a frame */
+uint32_t pmm_frame_refcount(uint32_t frame_addr) {
+    uint32_t frame = addr_to_frame(frame_addr);
+
+    if (frame >= total_frames) {
+        return 0;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t count = 0;
+    if (!frame_is_free(frame)) {
+        uint32_t slot = ref_find(frame);
+        count = 1 + frame_refs[slot].extra;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return count;
 }
 
-/* Get number of free frames */
+/* Get number of free frames (the zeroed pool counts as free) */
 uint32_t pmm_get_free_frames(void) {
-    return total_frames - used_frames;
+    return total_frames - used_frames + zero_pool_count;
 }
 
 /* Get number of used frames */
 uint32_t pmm_get_used_frames(void) {
-    return used_frames;
+    return used_frames - zero_pool_count;
 }
 
 /* Initialize simple kernel heap for pre-paging allocations */
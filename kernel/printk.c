@@ -0,0 +1,292 @@
+/* SYNAPSE SO - Kernel Log */
+/* Licensed under GPLv3 */
+
+/* A line travels through the ring as a header entry (level << 16 | length)
+ * followed by its characters, four per entry. Producers claim all of a
+ * line's entries at once, so lines never interleave. klogd is the only
+ * consumer; klog_flush() callers take its place through klog_busy. */
+
+#include <kernel/printk.h>
+#include <kernel/ring.h>
+#include <kernel/vga.h>
+#include <kernel/workqueue.h>
+
+#define KLOG_LINE_ENTRIES   (KLOG_LINE_MAX / 4)
+
+_Static_assert(KLOG_LINE_MAX % 4 == 0, "KLOG_LINE_MAX must be a multiple of 4");
+
+static ring_mpsc_slot_t klog_slots[KLOG_RING_ENTRIES];
+static ring_mpsc_t klog_ring;
+static int klog_ready;
+
+/* Lines lost to a full ring, reported by the next flush */
+static volatile uint32_t klog_dropped;
+
+/* Consumer side, owned by whoever holds klog_busy. A line whose producer
+   is still writing it is kept here until the rest arrives. */
+static volatile uint32_t klog_busy;
+static uint32_t klog_line[1 + KLOG_LINE_ENTRIES];
+static uint32_t klog_line_have;
+
+static workqueue_t* klog_wq = 0;
+static void klog_work_func(work_t* work);
+static work_t klog_work = WORK_INIT(klog_work_func);
+
+/* ------------------------------------------------------------------------
+ * Formatting
+ * ------------------------------------------------------------------------ */
+
+typedef struct {
+    char* buf;
+    uint32_t size;
+    uint32_t len;
+} fmt_out_t;
+
+static void fmt_putc(fmt_out_t* out, char c) {
+    if (out->len + 1 < out->size) {
+        out->buf[out->len++] = c;
+    }
+}
+
+/* Emit digits (most significant first) or a string, padded to width */
+static void fmt_field(fmt_out_t* out, const char* str, uint32_t len,
+                      uint32_t width, int left, char pad, char sign) {
+    uint32_t total = len + (sign != 0);
+    uint32_t fill = (width > total) ? width - total : 0;
+
+    if (!left && pad == ' ') {
+        while (fill-- > 0) {
+            fmt_putc(out, ' ');
+        }
+        fill = 0;
+    }
+    if (sign != 0) {
+        fmt_putc(out, sign);
+    }
+    if (!left) {
+        while (fill-- > 0) {
+            fmt_putc(out, pad);
+        }
+        fill = 0;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        fmt_putc(out, str[i]);
+    }
+    while (fill-- > 0) {
+        fmt_putc(out, ' ');
+    }
+}
+
+static void fmt_number(fmt_out_t* out, uint32_t value, uint32_t base, int upper,
+                       uint32_t width, int left, char pad, char sign) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buf[10];
+    uint32_t i = sizeof(buf);
+
+    do {
+        buf[--i] = digits[value % base];
+        value /= base;
+    } while (value != 0);
+
+    fmt_field(out, &buf[i], sizeof(buf) - i, width, left, pad, sign);
+}
+
+uint32_t kvsnprintf(char* buf, uint32_t size, const char* fmt, va_list args) {
+    fmt_out_t out = { buf, size, 0 };
+
+    while (*fmt != '\0') {
+        if (*fmt != '%') {
+            fmt_putc(&out, *fmt++);
+            continue;
+        }
+        fmt++;
+
+        int left = 0;
+        char pad = ' ';
+        for (;; fmt++) {
+            if (*fmt == '-') {
+                left = 1;
+            } else if (*fmt == '0') {
+                pad = '0';
+            } else {
+                break;
+            }
+        }
+
+        uint32_t width = 0;
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (uint32_t)(*fmt++ - '0');
+        }
+        while (*fmt == 'l' || *fmt == 'h') {
+            fmt++;
+        }
+
+        switch (*fmt) {
+            case 'd':
+            case 'i': {
+                int32_t value = va_arg(args, int32_t);
+                uint32_t magnitude = (value < 0) ? 0u - (uint32_t)value : (uint32_t)value;
+                fmt_number(&out, magnitude, 10, 0, width, left, pad,
+                           (value < 0) ? '-' : 0);
+                break;
+            }
+            case 'u':
+                fmt_number(&out, va_arg(args, uint32_t), 10, 0, width, left, pad, 0);
+                break;
+            case 'x':
+            case 'X':
+                fmt_number(&out, va_arg(args, uint32_t), 16, *fmt == 'X',
+                           width, left, pad, 0);
+                break;
+            case 'p':
+                fmt_putc(&out, '0');
+                fmt_putc(&out, 'x');
+                fmt_number(&out, (uint32_t)va_arg(args, void*), 16, 0, 8, 0, '0', 0);
+                break;
+            case 's': {
+                const char* str = va_arg(args, const char*);
+                if (str == 0) {
+                    str = "(null)";
+                }
+                uint32_t len = 0;
+                while (str[len] != '\0') {
+                    len++;
+                }
+                fmt_field(&out, str, len, width, left, ' ', 0);
+                break;
+            }
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                fmt_field(&out, &c, 1, width, left, ' ', 0);
+                break;
+            }
+            case '%':
+                fmt_putc(&out, '%');
+                break;
+            case '\0':
+                /* Trailing '%' */
+                fmt--;
+                break;
+            default:
+                /* Unknown conversion: print it as written */
+                fmt_putc(&out, '%');
+                fmt_putc(&out, *fmt);
+                break;
+        }
+        fmt++;
+    }
+
+    if (size > 0) {
+        buf[out.len] = '\0';
+    }
+    return out.len;
+}
+
+uint32_t ksnprintf(char* buf, uint32_t size, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    uint32_t len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+/* ------------------------------------------------------------------------
+ * Log ring
+ * ------------------------------------------------------------------------ */
+
+/* Take the next complete line off the ring and print it. Returns 0 when
+   the ring is empty or its first line is still being written. klog_busy
+   held. */
+static int klog_print_one(void) {
+    if (klog_line_have == 0) {
+        if (ring_mpsc_dequeue(&klog_ring, klog_line, 1) == 0) {
+            return 0;
+        }
+        klog_line_have = 1;
+    }
+
+    uint32_t len = klog_line[0] & 0xFFFF;
+    uint32_t entries = 1 + (len + 3) / 4;
+    klog_line_have += ring_mpsc_dequeue(&klog_ring, &klog_line[klog_line_have],
+                                        entries - klog_line_have);
+    if (klog_line_have < entries) {
+        /* Its producer queues klogd again once it is done */
+        return 0;
+    }
+
+    char* text = (char*)&klog_line[1];
+    text[len] = '\0';
+    vga_print(text);
+    klog_line_have = 0;
+    return 1;
+}
+
+void klog_flush(void) {
+    int progress;
+
+    /* A line queued while the flag was held is picked up by the next
+       pass, unless the holder made no progress (its line is still being
+       written, possibly under us on this CPU) */
+    do {
+        if (__sync_lock_test_and_set(&klog_busy, 1)) {
+            return;
+        }
+
+        progress = 0;
+        while (klog_print_one()) {
+            progress = 1;
+        }
+
+        uint32_t dropped = __sync_lock_test_and_set(&klog_dropped, 0);
+        if (dropped != 0) {
+            char line[48];
+            ksnprintf(line, sizeof(line), "[-] klog: %u messages dropped\n", dropped);
+            vga_print(line);
+        }
+
+        __sync_lock_release(&klog_busy);
+    } while (progress && ring_mpsc_count(&klog_ring) != 0);
+}
+
+static void klog_work_func(work_t* work) {
+    (void)work;
+    klog_flush();
+}
+
+void klog_write(uint32_t level, const char* fmt, ...) {
+    uint32_t line[1 + KLOG_LINE_ENTRIES];
+    char* text = (char*)&line[1];
+
+    va_list args;
+    va_start(args, fmt);
+    uint32_t len = kvsnprintf(text, KLOG_LINE_MAX, fmt, args);
+    va_end(args);
+
+    if (!klog_ready) {
+        vga_print(text);
+        return;
+    }
+
+    line[0] = (level << 16) | len;
+    if (ring_mpsc_enqueue_all(&klog_ring, line, 1 + (len + 3) / 4) == 0) {
+        __sync_fetch_and_add(&klog_dropped, 1);
+    }
+
+    if (klog_wq != 0) {
+        queue_work(klog_wq, &klog_work);
+    } else {
+        klog_flush();
+    }
+}
+
+void klog_init(void) {
+    ring_mpsc_init(&klog_ring, klog_slots, KLOG_RING_ENTRIES);
+    klog_ready = 1;
+}
+
+void klog_start(void) {
+    klog_wq = workqueue_create("klogd");
+    if (klog_wq == 0) {
+        vga_print("[-] Failed to start klogd, logging synchronously\n");
+    }
+}
@@ -2,91 +2,145 @@
 /* Licensed under GPLv3 */
 
 #include <kernel/process.h>
+#include <kernel/fpu.h>
 #include <kernel/gdt.h>
 #include <kernel/heap.h>
+#include <kernel/idt.h>
+#include <kernel/ipc.h>
 #include <kernel/pmm.h>
+#include <kernel/printk.h>
+#include <kernel/rcu.h>
+#include <kernel/scheduler.h>
+#include <kernel/shm.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
 #include <kernel/string.h>
+#include <kernel/syscall.h>
+#include <kernel/elf.h>
+#include <kernel/timer.h>
+#include <kernel/uring.h>
 #include <kernel/vga.h>
 #include <kernel/vmm.h>
 
 #define KERNEL_STACK_SIZE 0x2000
 #define USER_STACK_SIZE   0x1000
-#define IRQ0_VECTOR       32
 
-/* Process list */
+/* Top of the user stack in every user address space */
+#define USER_STACK_TOP    0x80000000
+
+/* Process list: live processes in creation order, NULL-terminated. Readers
+   walk it under rcu_read_lock(); writers hold process_lock. The running
+   process of each CPU is in its cpu_t. */
 process_t* process_list = 0;
-static process_t* current_process = 0;
+static process_t* process_list_tail = 0;
+
+/* Protects process_list, zombie_list, reap_queue and parent links */
+static spinlock_t process_lock = SPINLOCK_INIT("process_list");
 
 /* Next PID to assign */
 static pid_t next_pid = 1;
 
+/* Exited processes. Zombies are unlinked from process_list on exit so the
+   scheduler never scans them; they wait here until collected by
+   process_wait(), then move to the reap queue for the reaper thread. */
+static process_t* zombie_list = 0;
+static process_t* reap_queue = 0;
+static process_t* reaper_proc = 0;
+
 static void process_list_insert(process_t* proc) {
-    unsigned int flags;
-    /* Save EFLAGS and disable interrupts to make the insertion atomic.
-       This avoids list corruption if an interrupt handler or another CPU
-       traverses/modifies `process_list`. */
-    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
-
-    if (process_list == 0) {
-        process_list = proc;
-        proc->next = proc;
-        proc->prev = proc;
+    uint32_t flags = spin_lock_irqsave(&process_lock);
+
+    /* Fully linked before it is published to readers */
+    proc->next = 0;
+    proc->prev = process_list_tail;
+    if (process_list_tail == 0) {
+        rcu_assign_pointer(process_list, proc);
     } else {
-        proc->next = process_list;
-        proc->prev = process_list->prev;
-        process_list->prev->next = proc;
-        process_list->prev = proc;
+        rcu_assign_pointer(process_list_tail->next, proc);
     }
+    process_list_tail = proc;
 
-    /* Restore interrupts to previous state (IF flag). */
-    if (flags & (1 << 9)) {
-        asm volatile("sti");
+    spin_unlock_irqrestore(&process_lock, flags);
+}
+
+/* Unlink proc from process_list. Caller holds process_lock. proc->next is
+   left alone so readers standing on proc can continue; proc is freed only
+   after a grace period (see reaper_thread). */
+static void process_list_remove(process_t* proc) {
+    if (proc->prev != 0) {
+        rcu_assign_pointer(proc->prev->next, proc->next);
+    } else {
+        rcu_assign_pointer(process_list, proc->next);
+    }
+
+    if (proc->next != 0) {
+        proc->next->prev = proc->prev;
+    } else {
+        process_list_tail = proc->prev;
     }
 }
 
-static uint32_t* stack_push(uint32_t* sp, uint32_t value) {
-    sp--;
-    *sp = value;
-    return sp;
+/* Unlink proc from zombie_list. Caller holds process_lock. */
+static void zombie_list_remove(process_t* proc) {
+    process_t** link = &zombie_list;
+    while (*link != 0) {
+        if (*link == proc) {
+            *link = proc->zombie_next;
+            proc->zombie_next = 0;
+            return;
+        }
+        link = &(*link)->zombie_next;
+    }
 }
 
-static void process_init_kernel_thread_stack(process_t* proc,
-                                            process_entry_t entry) {
-    uint32_t* sp = (uint32_t*)proc->stack_end;
+/* Hand a zombie to the reaper. Caller holds process_lock. */
+static void process_queue_reap(process_t* proc) {
+    proc->zombie_next = reap_queue;
+    reap_queue = proc;
 
-    /* iret frame */
-    sp = stack_push(sp, 0x202); /* EFLAGS (IF=1) */
-    sp = stack_push(sp, GDT_KERNEL_CODE);
-    sp = stack_push(sp, (uint32_t)entry);
+    if (reaper_proc != 0 && reaper_proc->state != PROC_STATE_READY &&
+        reaper_proc->state != PROC_STATE_RUNNING) {
+        reaper_proc->state = PROC_STATE_READY;
+        scheduler_add_process(reaper_proc);
+    }
+}
 
-    /* int_no + err_code (like IRQ stubs) */
-    sp = stack_push(sp, 0);
-    sp = stack_push(sp, IRQ0_VECTOR);
+/* Release everything a process owns. The process must not be running. */
+static void process_free(process_t* proc) {
+    fpu_release(proc);
 
-    /* pusha frame (matches registers_t order after pusha) */
-    sp = stack_push(sp, 0); /* eax */
-    sp = stack_push(sp, 0); /* ecx */
-    sp = stack_push(sp, 0); /* edx */
-    sp = stack_push(sp, 0); /* ebx */
-    sp = stack_push(sp, 0); /* esp (ignored by popa) */
-    sp = stack_push(sp, 0); /* ebp */
-    sp = stack_push(sp, 0); /* esi */
-    sp = stack_push(sp, 0); /* edi */
+    if (proc->stack_start != 0) {
+        kfree((void*)proc->stack_start);
+    }
 
-    /* segment registers (push order in isr_common_stub: ds, es, fs, gs) */
-    sp = stack_push(sp, GDT_KERNEL_DATA); /* ds */
-    sp = stack_push(sp, GDT_KERNEL_DATA); /* es */
-    sp = stack_push(sp, GDT_KERNEL_DATA); /* fs */
-    sp = stack_push(sp, GDT_KERNEL_DATA); /* gs */
+    uring_destroy(proc);
 
-    proc->esp = (uint32_t)sp;
+    if (!(proc->flags & PROC_FLAG_KERNEL) && proc->page_dir != 0) {
+        vmm_destroy_page_directory(proc->page_dir);
+    }
+
+    kfree(proc);
+}
+
+static void process_init_stats(process_t* proc) {
+    proc->user_ticks = 0;
+    proc->kernel_ticks = 0;
+    proc->nvcsw = 0;
+    proc->nivcsw = 0;
+    proc->ready_since = timer_get_ticks();
+    proc->wait_ticks = 0;
+    proc->wait_max = 0;
+    for (uint32_t i = 0; i < PROC_LAT_BUCKETS; i++) {
+        proc->lat_hist[i] = 0;
+    }
 }
 
 /* Initialize process management */
 void process_init(void) {
     vga_print("[+] Initializing Process Management...\n");
     process_list = 0;
-    current_process = 0;
+    process_list_tail = 0;
+    process_set_current(0);
     next_pid = 1;
 }
 
@@ -96,7 +150,7 @@ process_t* process_create_current(const char* name) {
         return 0;
     }
 
-    proc->pid = next_pid++;
+    proc->pid = __sync_fetch_and_add(&next_pid, 1);
     proc->ppid = 0;
     proc->state = PROC_STATE_RUNNING;
     proc->flags = PROC_FLAG_KERNEL;
@@ -119,6 +173,29 @@ process_t* process_create_current(const char* name) {
     proc->priority = 10;
     proc->quantum = 0;
 
+    proc->sched_class = SCHED_CLASS_NORMAL;
+    proc->rt_priority = 0;
+    proc->edf_runtime = proc->edf_deadline = proc->edf_period = 0;
+    proc->edf_abs_deadline = proc->edf_release = proc->edf_budget = 0;
+
+    process_init_stats(proc);
+
+    proc->fpu_state = 0;
+    proc->fpu_alloc = 0;
+    proc->context_type = PROC_CONTEXT_IRQ;
+    proc->waiter = 0;
+    proc->zombie_next = 0;
+    proc->rq_next = proc->rq_prev = 0;
+    proc->cpu = CPU_NONE;
+    proc->on_rq = 0;
+    proc->on_cpu = 0;
+    proc->fpu_cpu = CPU_NONE;
+    proc->user_entry = 0;
+    proc->user_stack_start = proc->user_stack_end = 0;
+    proc->user_copy = 0;
+    proc->uring = 0;
+    memset(&proc->ipc, 0, sizeof(proc->ipc));
+
     if (name != 0) {
         strncpy(proc->name, name, 31);
         proc->name[31] = '\0';
@@ -126,14 +203,15 @@ process_t* process_create_current(const char* name) {
         strcpy(proc->name, "kernel");
     }
 
+    /* Already running on this CPU */
+    proc->cpu = cpu_current()->index;
+    proc->on_cpu = 1;
+
     process_list_insert(proc);
-    current_process = proc;
+    process_set_current(proc);
 
-    vga_print("    Created current process: ");
-    vga_print(proc->name);
-    vga_print(" (PID: ");
-    vga_print_dec(proc->pid);
-    vga_print(")\n");
+    kprintf(KLOG_INFO, "    Created current process: %s (PID: %u)\n",
+            proc->name, proc->pid);
 
     return proc;
 }
@@ -146,8 +224,8 @@ process_t* process_create(const char* name, uint32_t flags,
         return 0;
     }
 
-    proc->pid = next_pid++;
-    proc->ppid = (current_process != 0) ? current_process->pid : 0;
+    proc->pid = __sync_fetch_and_add(&next_pid, 1);
+    proc->ppid = process_get_pid();
     proc->state = PROC_STATE_READY;
     proc->flags = flags;
 
@@ -155,6 +233,29 @@ process_t* process_create(const char* name, uint32_t flags,
     proc->priority = 10;
     proc->quantum = 10;
 
+    proc->sched_class = SCHED_CLASS_NORMAL;
+    proc->rt_priority = 0;
+    proc->edf_runtime = proc->edf_deadline = proc->edf_period = 0;
+    proc->edf_abs_deadline = proc->edf_release = proc->edf_budget = 0;
+
+    process_init_stats(proc);
+
+    proc->fpu_state = 0;
+    proc->fpu_alloc = 0;
+    proc->context_type = PROC_CONTEXT_IRQ;
+    proc->waiter = 0;
+    proc->zombie_next = 0;
+    proc->rq_next = proc->rq_prev = 0;
+    proc->cpu = CPU_NONE;
+    proc->on_rq = 0;
+    proc->on_cpu = 0;
+    proc->fpu_cpu = CPU_NONE;
+    proc->user_entry = 0;
+    proc->user_stack_start = proc->user_stack_end = 0;
+    proc->user_copy = 0;
+    proc->uring = 0;
+    memset(&proc->ipc, 0, sizeof(proc->ipc));
+
     proc->heap_start = 0;
     proc->heap_end = 0;
 
@@ -176,30 +277,37 @@ process_t* process_create(const char* name, uint32_t flags,
         }
     }
 
-    uint32_t stack_size = (flags & PROC_FLAG_KERNEL) ? KERNEL_STACK_SIZE :
-                          USER_STACK_SIZE;
-
-    if (flags & PROC_FLAG_KERNEL) {
-        void* stack = kmalloc(stack_size);
-        if (stack == 0) {
-            kfree(proc);
-            return 0;
+    /* Every process has a kernel stack: kernel threads run on it, user
+       processes enter it from ring 3 through TSS esp0 */
+    void* stack = kmalloc(KERNEL_STACK_SIZE);
+    if (stack == 0) {
+        if (!(flags & PROC_FLAG_KERNEL)) {
+            vmm_destroy_page_directory(proc->page_dir);
         }
+        kfree(proc);
+        return 0;
+    }
+
+    proc->stack_start = (uint32_t)stack;
+    proc->stack_end = proc->stack_start + KERNEL_STACK_SIZE;
+
+    /* User stack, mapped in the process's own directory */
+    if (!(flags & PROC_FLAG_KERNEL)) {
+        proc->user_stack_start = USER_STACK_TOP - USER_STACK_SIZE;
+        proc->user_stack_end = USER_STACK_TOP;
 
-        proc->stack_start = (uint32_t)stack;
-        proc->stack_end = proc->stack_start + stack_size;
-    } else {
         uint32_t stack_phys = pmm_alloc_frame();
-        if (stack_phys == 0) {
+        if (stack_phys == 0 ||
+            vmm_map_page_in(proc->page_dir, proc->user_stack_start, stack_phys,
+                            PAGE_PRESENT | PAGE_WRITE | PAGE_USER) != 0) {
+            if (stack_phys != 0) {
+                pmm_free_frame(stack_phys);
+            }
+            kfree(stack);
+            vmm_destroy_page_directory(proc->page_dir);
             kfree(proc);
             return 0;
         }
-
-        uint32_t stack_virt = 0x7FFFF000;
-        vmm_map_page(stack_virt, stack_phys,
-                     PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
-        proc->stack_start = stack_virt - stack_size;
-        proc->stack_end = stack_virt;
     }
 
     proc->eip = (uint32_t)entry;
@@ -209,7 +317,10 @@ process_t* process_create(const char* name, uint32_t flags,
     proc->esi = proc->edi = 0;
 
     if ((flags & PROC_FLAG_KERNEL) && entry != 0) {
-        process_init_kernel_thread_stack(proc, entry);
+        /* First resumption (by schedule() or the timer path) returns
+           straight into entry */
+        context_init(proc, (uint32_t)entry);
+        proc->context_type = PROC_CONTEXT_SWITCH;
     } else {
         proc->esp = proc->stack_end;
         proc->ebp = proc->stack_end;
@@ -217,11 +328,13 @@ process_t* process_create(const char* name, uint32_t flags,
 
     process_list_insert(proc);
 
-    vga_print("    Created process: ");
-    vga_print(proc->name);
-    vga_print(" (PID: ");
-    vga_print_dec(proc->pid);
-    vga_print(")\n");
+    /* Kernel threads are runnable right away; idle threads are only run
+       by their own CPU, and user processes wait for process_exec() */
+    if ((flags & PROC_FLAG_KERNEL) && entry != 0 && !(flags & PROC_FLAG_IDLE)) {
+        scheduler_add_process(proc);
+    }
+
+    kprintf(KLOG_DEBUG, "    Created process: %s (PID: %u)\n", proc->name, proc->pid);
 
     return proc;
 }
@@ -232,47 +345,37 @@ void process_destroy(process_t* proc) {
         return;
     }
 
-    /* Disable interrupts to make the list removal and cleanup atomic.
-       Keep interrupts disabled until after kfree to prevent use-after-free
-       if an interrupt handler accesses the process being destroyed. */
-    unsigned int flags;
-    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    uint32_t flags = spin_lock_irqsave(&process_lock);
 
-    if (proc->next == proc) {
-        process_list = 0;
-    } else {
-        proc->next->prev = proc->prev;
-        proc->prev->next = proc->next;
-        if (process_list == proc) {
-            process_list = proc->next;
-        }
-    }
+    /* Return any EDF bandwidth reserved by the process */
+    scheduler_set_normal(proc);
 
-    if (proc == current_process) {
-        current_process = 0;
+    /* Exited processes are already off process_list and the run queues */
+    if (proc->state == PROC_STATE_ZOMBIE) {
+        zombie_list_remove(proc);
+    } else {
+        scheduler_remove_process(proc);
+        process_list_remove(proc);
     }
 
-    /* Free the process stack and structure while interrupts are disabled.
-       This prevents ISR from accessing freed memory. */
-    if ((proc->flags & PROC_FLAG_KERNEL) && proc->stack_start != 0) {
-        kfree((void*)proc->stack_start);
+    if (proc == process_get_current()) {
+        process_set_current(0);
     }
 
-    kfree(proc);
+    /* RCU readers of process_list may still hold it: the reaper frees it
+       after a grace period */
+    process_queue_reap(proc);
 
-    /* Restore interrupts after all cleanup is complete */
-    if (flags & (1 << 9)) {
-        asm volatile("sti");
-    }
+    spin_unlock_irqrestore(&process_lock, flags);
 }
 
 /* Get current process */
 process_t* process_get_current(void) {
-    return current_process;
+    return cpu_current()->current;
 }
 
 void process_set_current(process_t* proc) {
-    current_process = proc;
+    cpu_current()->current = proc;
 }
 
 /* Get process list */
@@ -280,21 +383,19 @@ process_t* process_get_list(void) {
     return process_list;
 }
 
-/* Find process by PID */
+/* Find process by PID. The result stays valid only while the caller keeps
+   it from being reaped (holding process_lock, or inside an RCU read
+   section of its own). */
 process_t* process_find_by_pid(pid_t pid) {
-    if (process_list == 0) {
-        return 0;
-    }
+    rcu_read_lock();
 
-    process_t* proc = process_list;
-    do {
-        if (proc->pid == pid) {
-            return proc;
-        }
-        proc = proc->next;
-    } while (proc != 0 && proc != process_list);
+    process_t* proc = rcu_dereference(process_list);
+    while (proc != 0 && proc->pid != pid) {
+        proc = rcu_dereference(proc->next);
+    }
 
-    return 0;
+    rcu_read_unlock();
+    return proc;
 }
 
 /* Set process state */
@@ -325,50 +426,228 @@ void process_unblock(process_t* proc) {
     if (proc != 0) {
         proc->state = PROC_STATE_READY;
         scheduler_add_process(proc);
+
+        /* Waking a higher-class process from thread context switches to it
+           right away; from IRQ context isr_handler does the switch. */
+        if (scheduler_need_resched() && !idt_in_interrupt()) {
+            schedule();
+        }
     }
 }
 
-/* Execute an ELF binary */
-int process_exec(uint8_t* elf_data, uint32_t size) {
-    (void)elf_data;
-    (void)size;
-    vga_print("[-] ELF loader not yet implemented\n");
-    return -1;
+/* First code of a user process, on its kernel stack with its directory
+   loaded: leave for ring 3 */
+static void process_enter_user(void) {
+    process_t* proc = process_get_current();
+    syscall_enter_user(proc->user_entry, proc->user_stack_end, 0, 0);
+}
+
+/* Execute an ELF binary in a new user process */
+int process_exec(const char* name, uint8_t* elf_data, uint32_t size) {
+    process_t* proc = process_create(name, 0, 0);
+    if (proc == 0) {
+        return -1;
+    }
+
+    if (elf_load_to_process(elf_data, size, proc) != 0) {
+        process_destroy(proc);
+        return -1;
+    }
+
+    /* context_init() records the kernel entry in proc->eip */
+    proc->user_entry = proc->eip;
+    context_init(proc, (uint32_t)process_enter_user);
+    proc->context_type = PROC_CONTEXT_SWITCH;
+
+    pid_t pid = proc->pid;
+    scheduler_add_process(proc);
+    return (int)pid;
 }
 
 /* Exit current process */
 void process_exit(int exit_code) {
-    if (current_process == 0) {
+    process_t* proc = process_get_current();
+    if (proc == 0) {
         return;
     }
 
-    current_process->state = PROC_STATE_ZOMBIE;
-    current_process->exit_code = (uint32_t)exit_code;
+    kprintf(KLOG_INFO, "Process exited: %s (PID: %u, exit code: %d)\n",
+            proc->name, proc->pid, exit_code);
+
+    ipc_process_exit(proc);
+    shm_process_exit(proc);
+
+    uint32_t flags = spin_lock_irqsave(&process_lock);
+
+    proc->state = PROC_STATE_ZOMBIE;
+    proc->exit_code = (uint32_t)exit_code;
+    scheduler_set_normal(proc);
+
+    /* Drop FPU ownership from the CPU we are on; nobody else can */
+    fpu_release(proc);
+
+    /* Off process_list; lookups no longer find it */
+    process_list_remove(proc);
+
+    /* Orphan the children; already-exited ones can no longer be waited */
+    process_t** link = &zombie_list;
+    while (*link != 0) {
+        process_t* child = *link;
+        if (child->ppid == proc->pid && child->waiter == 0) {
+            *link = child->zombie_next;
+            process_queue_reap(child);
+        } else {
+            link = &child->zombie_next;
+        }
+    }
+
+    for (process_t* p = process_list; p != 0; p = p->next) {
+        if (p->ppid == proc->pid) {
+            p->ppid = 0;
+        }
+    }
 
-    vga_print("Process exited: ");
-    vga_print(current_process->name);
-    vga_print(" (PID: ");
-    vga_print_dec(current_process->pid);
-    vga_print(", exit code: ");
-    vga_print_dec((unsigned int)exit_code);
-    vga_print(")\n");
+    if (proc->waiter != 0) {
+        /* Wakes the waiter; it collects us and queues the reap */
+        proc->zombie_next = zombie_list;
+        zombie_list = proc;
+        proc->waiter->state = PROC_STATE_READY;
+        scheduler_add_process(proc->waiter);
+    } else if ((proc->flags & PROC_FLAG_DETACHED) || proc->ppid == 0) {
+        /* Nobody can wait for it */
+        process_queue_reap(proc);
+    } else {
+        proc->zombie_next = zombie_list;
+        zombie_list = proc;
+    }
 
-    /* Yield; a reaper process can clean this up in a later phase. */
+    /* Interrupts stay off until the switch. Never resumed: the reaper
+       frees this stack once we are off it. */
+    spin_unlock(&process_lock);
     schedule();
 
+    irq_restore(flags);
+
     while (1) {
         __asm__ __volatile__("hlt");
     }
 }
 
+/* Wait for a process to exit */
+int process_wait(pid_t pid, int* exit_code) {
+    process_t* current = process_get_current();
+    if (current == 0 || pid == current->pid) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&process_lock);
+
+    int result = -1;
+    while (1) {
+        process_t* proc = zombie_list;
+        while (proc != 0 && proc->pid != pid) {
+            proc = proc->zombie_next;
+        }
+
+        if (proc != 0) {
+            if (proc->waiter == 0 || proc->waiter == current) {
+                if (exit_code != 0) {
+                    *exit_code = (int)proc->exit_code;
+                }
+                zombie_list_remove(proc);
+                process_queue_reap(proc);
+                result = 0;
+            }
+            break;
+        }
+
+        proc = process_find_by_pid(pid);
+        if (proc == 0 || (proc->flags & PROC_FLAG_DETACHED) ||
+            (proc->waiter != 0 && proc->waiter != current)) {
+            break;
+        }
+
+        /* Sleep until process_exit() wakes us. A wakeup between the
+           unlock and the switch leaves us runnable, so it is not lost. */
+        proc->waiter = current;
+        current->state = PROC_STATE_BLOCKED;
+        spin_unlock(&process_lock);
+        schedule();
+        spin_lock(&process_lock);
+    }
+
+    spin_unlock_irqrestore(&process_lock, flags);
+    return result;
+}
+
+/* Reaper thread: frees collected zombies in batches */
+static void reaper_thread(void) {
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&process_lock);
+
+        if (reap_queue == 0) {
+            reaper_proc->state = PROC_STATE_BLOCKED;
+            spin_unlock(&process_lock);
+            schedule();
+            irq_restore(flags);
+            continue;
+        }
+
+        /* Detach up to one batch; the rest waits for the next pass */
+        process_t* batch = reap_queue;
+        process_t* last = batch;
+        uint32_t count = 1;
+        while (last->zombie_next != 0 && count < PROC_REAP_BATCH) {
+            last = last->zombie_next;
+            count++;
+        }
+        reap_queue = last->zombie_next;
+        last->zombie_next = 0;
+
+        spin_unlock_irqrestore(&process_lock, flags);
+
+        /* Lookups that found these processes before they were unlinked
+           must be done with them */
+        synchronize_rcu();
+
+        while (batch != 0) {
+            process_t* next = batch->zombie_next;
+
+            /* A process that just exited on another CPU may still be on
+               its stack for a few instructions */
+            while (batch->on_cpu) {
+                cpu_relax();
+            }
+
+            process_free(batch);
+            batch = next;
+        }
+
+        /* Let other work run between batches */
+        if (reap_queue != 0) {
+            schedule();
+        }
+    }
+}
+
+void process_start_reaper(void) {
+    reaper_proc = process_create("reaper", PROC_FLAG_KERNEL | PROC_FLAG_DETACHED,
+                                 reaper_thread);
+    if (reaper_proc == 0) {
+        vga_print("[-] Failed to start reaper\n");
+    }
+}
+
 /* Get current PID */
 pid_t process_get_pid(void) {
-    return (current_process != 0) ? current_process->pid : 0;
+    process_t* current = process_get_current();
+    return (current != 0) ? current->pid : 0;
 }
 
 /* Get parent PID */
 pid_t process_get_ppid(void) {
-    return (current_process != 0) ? current_process->ppid : 0;
+    process_t* current = process_get_current();
+    return (current != 0) ? current->ppid : 0;
 }
 
 /* Set process name */
@@ -379,9 +658,83 @@ void process_set_name(process_t* proc, const char* name) {
     }
 }
 
-/* Idle process */
+static const char* process_state_name(uint32_t state) {
+    switch (state) {
+        case PROC_STATE_READY:   return "RDY ";
+        case PROC_STATE_RUNNING: return "RUN ";
+        case PROC_STATE_BLOCKED: return "BLK ";
+        case PROC_STATE_ZOMBIE:  return "ZOM ";
+        case PROC_STATE_STOPPED: return "STP ";
+        default:                 return "??? ";
+    }
+}
+
+static const char* process_class_name(uint32_t sched_class) {
+    switch (sched_class) {
+        case SCHED_CLASS_FIFO: return "FIFO ";
+        case SCHED_CLASS_EDF:  return "EDF  ";
+        default:               return "NORM ";
+    }
+}
+
+/* Print a decimal right-aligned in a field of the given width */
+static void print_dec_field(uint32_t num, uint32_t width) {
+    uint32_t digits = 1;
+    for (uint32_t n = num; n >= 10; n /= 10) {
+        digits++;
+    }
+
+    while (width-- > digits) {
+        vga_put_char(' ');
+    }
+    vga_print_dec(num);
+    vga_put_char(' ');
+}
+
+/* Print a ps-style table of all processes */
+void process_print_table(void) {
+    rcu_read_lock();
+
+    vga_print("  PID  PPID CPU STAT CLS    USER   SYS  VCSW IVCSW  WAIT WMAX NAME\n");
+
+    for (process_t* proc = rcu_dereference(process_list); proc != 0;
+         proc = rcu_dereference(proc->next)) {
+        print_dec_field(proc->pid, 5);
+        print_dec_field(proc->ppid, 5);
+        if (proc->cpu != CPU_NONE) {
+            print_dec_field(proc->cpu, 3);
+        } else {
+            vga_print("  - ");
+        }
+        vga_print(process_state_name(proc->state));
+        vga_print(process_class_name(proc->sched_class));
+        print_dec_field(proc->user_ticks, 5);
+        print_dec_field(proc->kernel_ticks, 5);
+        print_dec_field(proc->nvcsw, 5);
+        print_dec_field(proc->nivcsw, 5);
+        print_dec_field(proc->wait_ticks, 5);
+        print_dec_field(proc->wait_max, 4);
+        vga_print(proc->name);
+        vga_print("\n");
+
+        /* Latency histogram: 0, 1, 2-3, 4-7, ... ticks */
+        vga_print("      lat:");
+        for (uint32_t i = 0; i < PROC_LAT_BUCKETS; i++) {
+            print_dec_field(proc->lat_hist[i], 5);
+        }
+        vga_print("\n");
+    }
+
+    rcu_read_unlock();
+}
+
+/* Idle process. Idle time goes to zeroing frames ahead of demand, one
+   per pass; like any idle work it is preempted at the next interrupt
+   that makes something runnable. */
 void idle_process(void) {
     while (1) {
-        __asm__ volatile("hlt");
+        if (!pmm_zero_pool_refill()) {
+            __asm__ volatile("hlt");
+        }
     }
 }
@@ -0,0 +1,283 @@
+/* SYNAPSE SO - Sampling Profiler */
+/* Licensed under GPLv3 */
+
+#include <kernel/profile.h>
+#include <kernel/irq.h>
+#include <kernel/lapic.h>
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/serial.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+#include <kernel/vga.h>
+#include <kernel/vmm.h>
+
+_Static_assert(sizeof(profile_sample_t) == 64, "profile_sample_t is 64 bytes");
+
+#define PROFILE_SAMPLES_PER_PAGE    (PAGE_SIZE / sizeof(profile_sample_t))
+#define PROFILE_SAMPLES             (PROFILE_PAGES * PROFILE_SAMPLES_PER_PAGE)
+
+/* The boot profile is dumped this many ticks after profile_init() (10s) */
+#define PROFILE_BOOT_DUMP_TICKS     1000
+
+/* Written only by the tick of its own CPU, with interrupts disabled */
+typedef struct {
+    uint32_t ready;                 /* all pages allocated */
+    uint32_t count;
+    uint32_t lost;                  /* ticks after the buffer filled up */
+    profile_sample_t* pages[PROFILE_PAGES];
+} profile_buffer_t;
+
+static profile_buffer_t profile_buffers[MAX_CPUS];
+
+static volatile uint32_t profile_running;
+
+/* Tick vectors the handler is registered on (0 when stopped) */
+static uint32_t profile_vectors[2];
+
+/* Set while a control operation is in progress */
+static volatile uint32_t profile_busy;
+
+#ifdef CONFIG_FRAME_POINTER
+/* Follow the saved ebp chain while it stays inside the kernel stack and
+   moves towards its base */
+static void profile_backtrace(profile_sample_t* sample, uint32_t ebp,
+                              process_t* proc) {
+    if (proc == 0) {
+        return;
+    }
+
+    while (sample->depth < PROFILE_DEPTH && (ebp & 3) == 0 &&
+           ebp >= proc->stack_start && ebp + 8 <= proc->stack_end) {
+        uint32_t* frame = (uint32_t*)ebp;
+        sample->stack[sample->depth++] = frame[1];
+        if (frame[0] <= ebp) {
+            break;
+        }
+        ebp = frame[0];
+    }
+}
+#endif
+
+/* Shares the tick vector with the timer, which claims the interrupt */
+static int profile_tick(registers_t* regs, void* ctx) {
+    (void)ctx;
+
+    cpu_t* cpu = cpu_current();
+    profile_buffer_t* buf = &profile_buffers[cpu->index];
+    if (!profile_running || !buf->ready) {
+        return IRQ_NONE;
+    }
+
+    if (buf->count >= PROFILE_SAMPLES) {
+        buf->lost++;
+        return IRQ_NONE;
+    }
+
+    profile_sample_t* sample = &buf->pages[buf->count / PROFILE_SAMPLES_PER_PAGE]
+                                          [buf->count % PROFILE_SAMPLES_PER_PAGE];
+    sample->pid = (cpu->current != 0) ? cpu->current->pid : 0;
+    sample->eip = regs->eip;
+    sample->depth = 0;
+
+    if ((regs->cs & 3) != 0) {
+        sample->flags = PROFILE_SAMPLE_USER;
+    } else {
+        sample->flags = 0;
+#ifdef CONFIG_FRAME_POINTER
+        profile_backtrace(sample, regs->ebp, cpu->current);
+#endif
+    }
+
+    buf->count++;
+    return IRQ_NONE;
+}
+
+/* Give every online CPU a buffer; kept once allocated */
+static int profile_alloc_buffers(void) {
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        profile_buffer_t* buf = &profile_buffers[i];
+        for (uint32_t p = 0; p < PROFILE_PAGES; p++) {
+            if (buf->pages[p] != 0) {
+                continue;
+            }
+
+            uint32_t frame = pmm_alloc_frame();
+            if (frame == 0) {
+                return -1;
+            }
+            buf->pages[p] = (profile_sample_t*)vmm_phys_to_virt(frame);
+        }
+        buf->ready = 1;
+    }
+    return 0;
+}
+
+static void profile_unregister(void) {
+    for (uint32_t i = 0; i < 2; i++) {
+        if (profile_vectors[i] != 0) {
+            irq_unregister_handler(profile_vectors[i], profile_tick, 0);
+            profile_vectors[i] = 0;
+        }
+    }
+}
+
+static int32_t profile_start(void) {
+    if (profile_alloc_buffers() != 0) {
+        return -1;
+    }
+
+    profile_running = 0;
+    profile_unregister();
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        profile_buffers[i].count = 0;
+        profile_buffers[i].lost = 0;
+    }
+
+    /* Sample on whatever drives scheduler_tick() */
+    if (lapic_timer_active()) {
+        profile_vectors[0] = LAPIC_TIMER_VECTOR;
+    } else {
+        profile_vectors[0] = IRQ_BASE_VECTOR;
+        profile_vectors[1] = IPI_TICK_VECTOR;
+    }
+
+    for (uint32_t i = 0; i < 2; i++) {
+        if (profile_vectors[i] != 0 &&
+            irq_register_handler(profile_vectors[i], profile_tick, 0) != 0) {
+            profile_vectors[i] = 0;
+            profile_unregister();
+            return -1;
+        }
+    }
+
+    profile_running = 1;
+    return 0;
+}
+
+/* Longest line: flags, pid, eip and a full backtrace, 9 chars per field.
+   Lines are formatted whole and written with one serial_write, so console
+   output from other CPUs can only fall between them. */
+#define PROFILE_LINE_MAX    ((3 + PROFILE_DEPTH) * 9 + 1)
+
+/* Append a separator (unless at the start of the line) and 8 hex digits */
+static char* profile_put_hex(const char* line, char* out, uint32_t value) {
+    static const char hex[] = "0123456789abcdef";
+    if (out != line) {
+        *out++ = ' ';
+    }
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        *out++ = hex[(value >> shift) & 0xF];
+    }
+    return out;
+}
+
+static char* profile_put_str(char* out, const char* str) {
+    while (*str != '\0') {
+        *out++ = *str++;
+    }
+    return out;
+}
+
+static void profile_write_line(const char* line, char* out) {
+    *out++ = '\n';
+    *out = '\0';
+    serial_write(line);
+}
+
+void profile_dump(void) {
+    uint32_t cpus = smp_cpu_count();
+    char line[PROFILE_LINE_MAX];
+    char* out;
+
+    out = profile_put_str(line, "SYNPROF BEGIN");
+    out = profile_put_hex(line, out, cpus);
+    profile_write_line(line, out);
+
+    for (uint32_t i = 0; i < cpus; i++) {
+        profile_buffer_t* buf = &profile_buffers[i];
+        if (!buf->ready) {
+            continue;
+        }
+
+        /* Samples below count are complete and no longer change */
+        uint32_t count = buf->count;
+        out = profile_put_str(line, "CPU");
+        out = profile_put_hex(line, out, i);
+        out = profile_put_hex(line, out, count);
+        out = profile_put_hex(line, out, buf->lost);
+        profile_write_line(line, out);
+
+        /* flags pid eip, then the return addresses */
+        for (uint32_t n = 0; n < count; n++) {
+            profile_sample_t* sample = &buf->pages[n / PROFILE_SAMPLES_PER_PAGE]
+                                                  [n % PROFILE_SAMPLES_PER_PAGE];
+            out = profile_put_hex(line, line, sample->flags);
+            out = profile_put_hex(line, out, sample->pid);
+            out = profile_put_hex(line, out, sample->eip);
+            for (uint32_t d = 0; d < sample->depth && d < PROFILE_DEPTH; d++) {
+                out = profile_put_hex(line, out, sample->stack[d]);
+            }
+            profile_write_line(line, out);
+        }
+    }
+
+    out = profile_put_str(line, "SYNPROF END");
+    profile_write_line(line, out);
+}
+
+int32_t profile_control(uint32_t op) {
+    if (__sync_lock_test_and_set(&profile_busy, 1)) {
+        return -1;
+    }
+
+    int32_t result = 0;
+    switch (op) {
+        case PROFILE_OP_STOP:
+            profile_running = 0;
+            profile_unregister();
+            break;
+
+        case PROFILE_OP_START:
+            result = profile_start();
+            break;
+
+        case PROFILE_OP_DUMP:
+            profile_dump();
+            break;
+
+        default:
+            result = -1;
+            break;
+    }
+
+    __sync_lock_release(&profile_busy);
+    return result;
+}
+
+#ifdef CONFIG_PROFILE
+static void profile_boot_dump(void) {
+    uint32_t start = timer_get_ticks();
+    while (timer_get_ticks() - start < PROFILE_BOOT_DUMP_TICKS) {
+        __asm__ __volatile__("hlt");
+    }
+
+    profile_control(PROFILE_OP_STOP);
+    profile_control(PROFILE_OP_DUMP);
+    process_exit(0);
+}
+#endif
+
+void profile_init(void) {
+#ifdef CONFIG_PROFILE
+    vga_print("[+] Starting the sampling profiler...\n");
+    if (profile_control(PROFILE_OP_START) != 0) {
+        vga_print("[-] Profiler did not start\n");
+        return;
+    }
+    process_create("profile_dump", PROC_FLAG_KERNEL | PROC_FLAG_DETACHED,
+                   profile_boot_dump);
+    vga_print("    Samples dumped to COM1 after 10s\n");
+#endif
+}
@@ -0,0 +1,24 @@
+/* SYNAPSE SO - Read-Copy-Update */
+/* Licensed under GPLv3 */
+
+#include <kernel/rcu.h>
+#include <kernel/scheduler.h>
+
+void synchronize_rcu(void) {
+    uint32_t snapshot[MAX_CPUS];
+    uint32_t count = smp_cpu_count();
+
+    for (uint32_t i = 0; i < count; i++) {
+        snapshot[i] = cpu_get(i)->rcu_qs_count;
+    }
+
+    /* schedule() is itself a quiescent state for this CPU; the others
+       report one at their next switch or tick (idle CPUs still tick) */
+    for (uint32_t i = 0; i < count; i++) {
+        cpu_t* cpu = cpu_get(i);
+        while (cpu->online && cpu->rcu_qs_count == snapshot[i]) {
+            schedule();
+            cpu_relax();
+        }
+    }
+}
@@ -1,20 +1,98 @@
 /* SYNAPSE SO - Scheduler Implementation */
 /* Licensed under GPLv3 */
 
-/* SMP/Multicore Note:
- * This scheduler uses interrupt disable (cli) for process_list synchronization,
- * which is correct for single-core x86 systems. For SMP/multicore support,
- * spinlocks or proper atomic primitives would be needed instead of/cli.
- * Current assumption: Uniprocessor system. */
-
+/* Each CPU has its own run queue of READY processes (runqueue_t in its
+ * cpu_t), protected by a spinlock taken with interrupts disabled. New
+ * processes go to the least loaded CPU; a woken process returns to the CPU
+ * it last ran on. A CPU whose queue is empty steals a normal-class process
+ * from the tail of another CPU's queue before falling back to its idle
+ * thread. Queue locks are only ever trylocked while another is held, so
+ * there is no lock ordering to get wrong. Real-time (FIFO/EDF) processes
+ * stay on the CPU they were admitted on, so EDF admission control is per
+ * CPU.
+ *
+ * A process that was switched out stays "on_cpu" until the CPU that ran it
+ * has left its stack (scheduler_finish_switch); other CPUs never pick or
+ * free it before that. */
+
+#include <stddef.h>
 #include <kernel/scheduler.h>
+#include <kernel/fpu.h>
+#include <kernel/gdt.h>
 #include <kernel/process.h>
+#include <kernel/rcu.h>
+#include <kernel/smp.h>
 #include <kernel/vga.h>
 #include <kernel/vmm.h>
+#include <kernel/timer.h>
+#include <kernel/trace.h>
+
+/* kernel/switch.asm accesses process_t through these offsets */
+_Static_assert(offsetof(process_t, stack_end) == 64, "PROC_STACK_END");
+_Static_assert(offsetof(process_t, esp) == 68, "PROC_ESP");
+_Static_assert(offsetof(process_t, ebp) == 72, "PROC_EBP");
+_Static_assert(offsetof(process_t, eip) == 76, "PROC_EIP");
+_Static_assert(offsetof(process_t, eflags) == 80, "PROC_EFLAGS");
 
 /* Scheduler quantum */
 static uint32_t quantum = DEFAULT_QUANTUM;
 
+/* Run queue lock. Callers disable interrupts first. */
+static void rq_lock(runqueue_t* rq) {
+    spin_lock(&rq->lock);
+}
+
+static int rq_trylock(runqueue_t* rq) {
+    return spin_trylock(&rq->lock);
+}
+
+static void rq_unlock(runqueue_t* rq) {
+    spin_unlock(&rq->lock);
+}
+
+static runqueue_t* proc_rq(const process_t* proc) {
+    return &cpu_get(proc->cpu)->rq;
+}
+
+static void rq_enqueue(runqueue_t* rq, process_t* proc, int at_head) {
+    proc->rq_next = 0;
+    proc->rq_prev = 0;
+
+    if (rq->head == 0) {
+        rq->head = rq->tail = proc;
+    } else if (at_head) {
+        proc->rq_next = rq->head;
+        rq->head->rq_prev = proc;
+        rq->head = proc;
+    } else {
+        proc->rq_prev = rq->tail;
+        rq->tail->rq_next = proc;
+        rq->tail = proc;
+    }
+
+    proc->on_rq = 1;
+    rq->nr_ready++;
+}
+
+static void rq_dequeue(runqueue_t* rq, process_t* proc) {
+    if (proc->rq_prev != 0) {
+        proc->rq_prev->rq_next = proc->rq_next;
+    } else {
+        rq->head = proc->rq_next;
+    }
+
+    if (proc->rq_next != 0) {
+        proc->rq_next->rq_prev = proc->rq_prev;
+    } else {
+        rq->tail = proc->rq_prev;
+    }
+
+    proc->rq_next = 0;
+    proc->rq_prev = 0;
+    proc->on_rq = 0;
+    rq->nr_ready--;
+}
+
 static int proc_is_runnable(const process_t* proc) {
     if (proc == 0) {
         return 0;
@@ -28,24 +106,290 @@ static int proc_is_runnable(const process_t* proc) {
     return 1;
 }
 
-static process_t* scheduler_pick_next(process_t* current) {
-    if (process_list == 0) {
+/* n / d, for a quotient that fits 32 bits (no 64-bit division here) */
+static uint32_t div64_32(uint64_t n, uint32_t d) {
+    uint32_t q, r;
+    __asm__("divl %4"
+            : "=a"(q), "=d"(r)
+            : "a"((uint32_t)n), "d"((uint32_t)(n >> 32)), "rm"(d));
+    (void)r;
+    return q;
+}
+
+/* Density of an EDF reservation, rounded up so admission stays safe. The
+   product needs 64 bits once runtime reaches 2^22 ticks; runtime never
+   exceeds deadline, so the quotient is at most SCHED_EDF_UTIL_SCALE. */
+static uint32_t edf_density(uint32_t runtime, uint32_t deadline) {
+    return div64_32((uint64_t)runtime * SCHED_EDF_UTIL_SCALE + deadline - 1,
+                    deadline);
+}
+
+/* Start a new EDF period if the current one has elapsed */
+static void edf_replenish(process_t* proc, uint32_t now) {
+    if ((int32_t)(now - proc->edf_release) < 0) {
+        return;
+    }
+
+    /* Skip whole periods the process slept through */
+    uint32_t periods = (now - proc->edf_release) / proc->edf_period;
+    uint32_t start = proc->edf_release + periods * proc->edf_period;
+
+    proc->edf_abs_deadline = start + proc->edf_deadline;
+    proc->edf_release = start + proc->edf_period;
+    proc->edf_budget = proc->edf_runtime;
+}
+
+/* Runnable and, for EDF, not throttled by an exhausted budget */
+static int proc_is_eligible(process_t* proc, uint32_t now) {
+    if (!proc_is_runnable(proc)) {
         return 0;
     }
 
-    process_t* start = (current != 0 && current->next != 0) ? current->next :
-                       process_list;
-    process_t* proc = start;
+    if (proc->sched_class == SCHED_CLASS_EDF) {
+        edf_replenish(proc, now);
+        return proc->edf_budget > 0;
+    }
+
+    return 1;
+}
+
+/* Non-zero if a should run in preference to b */
+static int sched_outranks(const process_t* a, const process_t* b) {
+    if (a->sched_class != b->sched_class) {
+        return a->sched_class > b->sched_class;
+    }
+
+    if (a->sched_class == SCHED_CLASS_EDF) {
+        return (int32_t)(a->edf_abs_deadline - b->edf_abs_deadline) < 0;
+    }
 
-    do {
-        if (proc_is_runnable(proc)) {
+    if (a->sched_class == SCHED_CLASS_FIFO) {
+        return a->rt_priority > b->rt_priority;
+    }
+
+    /* Normal processes never preempt each other; they share by quantum */
+    return 0;
+}
+
+/* Best eligible process on a locked run queue. Queue order breaks ties, so
+   equal processes run round robin. Processes still on another CPU's stack
+   are skipped; current itself may be picked again. */
+static process_t* rq_pick(runqueue_t* rq, process_t* current, uint32_t now) {
+    process_t* best = 0;
+
+    for (process_t* proc = rq->head; proc != 0; proc = proc->rq_next) {
+        if (proc->on_cpu && proc != current) {
+            continue;
+        }
+
+        if (proc_is_eligible(proc, now) &&
+            (best == 0 || sched_outranks(proc, best))) {
+            best = proc;
+            if (rq->nr_fifo == 0 && rq->nr_edf == 0) {
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+/* Take a normal-class process from the tail of another CPU's queue. Only
+   trylocks are used, so two idle CPUs stealing from each other cannot
+   deadlock. Returns the process dequeued, or 0. */
+static process_t* sched_steal(cpu_t* thief, uint32_t now) {
+    uint32_t count = smp_cpu_count();
+
+    for (uint32_t i = 1; i < count; i++) {
+        cpu_t* victim = cpu_get((thief->index + i) % count);
+        if (!victim->online || victim->rq.nr_ready == 0 ||
+            !rq_trylock(&victim->rq)) {
+            continue;
+        }
+
+        process_t* proc = victim->rq.tail;
+        while (proc != 0) {
+            if (proc->sched_class == SCHED_CLASS_NORMAL && !proc->on_cpu &&
+                (proc->fpu_cpu == CPU_NONE || proc->fpu_cpu == thief->index) &&
+                proc_is_eligible(proc, now)) {
+                break;
+            }
+            proc = proc->rq_prev;
+        }
+
+        if (proc != 0) {
+            rq_dequeue(&victim->rq, proc);
+        }
+
+        rq_unlock(&victim->rq);
+
+        if (proc != 0) {
             return proc;
         }
+    }
+
+    return 0;
+}
+
+/* Record how long a process waited between becoming ready and running */
+static void sched_account_switch_in(process_t* proc, uint32_t now) {
+    uint32_t lat = now - proc->ready_since;
+    uint32_t bucket = 0;
 
-        proc = proc->next;
-    } while (proc != 0 && proc != start);
+    while (bucket < PROC_LAT_BUCKETS - 1 && (lat >> bucket) != 0) {
+        bucket++;
+    }
 
-    return current;
+    proc->lat_hist[bucket]++;
+    proc->wait_ticks += lat;
+    if (lat > proc->wait_max) {
+        proc->wait_max = lat;
+    }
+}
+
+/* Ask a CPU to reschedule at its next interrupt exit */
+static void sched_kick(cpu_t* cpu) {
+    cpu->need_resched = 1;
+    smp_send_reschedule(cpu);
+}
+
+/* Choose the process to run after current on this CPU and make it current.
+   expired means the current process used up its time slice (or budget),
+   yielded or stopped being runnable. A non-zero direct is run next without
+   consulting the queue (handoff). Returns current if no switch should
+   happen. Called with interrupts disabled. */
+static process_t* scheduler_select(process_t* current, int expired,
+                                   process_t* direct) {
+    cpu_t* cpu = cpu_current();
+    runqueue_t* rq = &cpu->rq;
+    uint32_t now = timer_get_ticks();
+    int voluntary = cpu->yield_pending || !proc_is_runnable(current);
+
+    rcu_note_qs(cpu);
+    cpu->need_resched = 0;
+    cpu->yield_pending = 0;
+
+    rq_lock(rq);
+
+    /* A still runnable current competes with the queue: ahead of its peers
+       if its slice is not used up, behind them otherwise. */
+    if (current != cpu->idle && proc_is_runnable(current) && !current->on_rq) {
+        rq_enqueue(rq, current, !expired);
+    }
+
+    process_t* next = direct;
+    if (next != 0) {
+        next->ready_since = now;
+    } else if ((next = rq_pick(rq, current, now)) != 0) {
+        rq_dequeue(rq, next);
+    } else {
+        next = sched_steal(cpu, now);
+        if (next == 0) {
+            next = cpu->idle;
+        }
+    }
+
+    if (next == 0 || next == current) {
+        if (current->state == PROC_STATE_READY) {
+            current->state = PROC_STATE_RUNNING;
+        }
+        rq_unlock(rq);
+        return current;
+    }
+
+    if (current->state == PROC_STATE_RUNNING) {
+        current->state = PROC_STATE_READY;
+        current->ready_since = now;
+    }
+
+    if (voluntary) {
+        current->nvcsw++;
+    } else {
+        current->nivcsw++;
+    }
+
+    next->state = PROC_STATE_RUNNING;
+    next->cpu = cpu->index;
+    next->on_cpu = 1;
+    if (next->quantum == 0) {
+        next->quantum = quantum;
+    }
+    sched_account_switch_in(next, now);
+
+    /* current stays on_cpu until this CPU is off its stack */
+    cpu->prev = current;
+    cpu->current = next;
+    TRACE(TRACE_SWITCH, current->pid, next->pid, current->state, 0);
+
+    rq_unlock(rq);
+
+    /* Entries from ring 3 (interrupts, int 0x80, SYSENTER) start at the
+       top of the next process's kernel stack */
+    gdt_get_tss(cpu->index)->esp0 = next->stack_end;
+
+    fpu_switch(next);
+    vmm_switch_page_directory(next->page_dir);
+    return next;
+}
+
+/* Release the process this CPU just switched away from */
+void scheduler_finish_switch(void) {
+    cpu_t* cpu = cpu_current();
+    process_t* prev = cpu->prev;
+
+    if (prev != 0) {
+        cpu->prev = 0;
+        __sync_synchronize();
+        prev->on_cpu = 0;
+    }
+}
+
+/* Register frame to return through isr_common_stub to resume proc. A
+   process that gave up the CPU in schedule() has only callee-saved state on
+   its stack, so an interrupt frame is built below it whose iret lands in
+   context_switch_resume; that pops the saved state and returns into
+   schedule(). The useresp/ss slots are left alone: a ring-0 iret does not
+   pop them and they overlap the saved registers. */
+static registers_t* scheduler_frame_for(process_t* proc) {
+    if (proc->context_type == PROC_CONTEXT_IRQ) {
+        return (registers_t*)proc->esp;
+    }
+
+    registers_t* frame = (registers_t*)(proc->esp -
+                                        offsetof(registers_t, useresp));
+    frame->gs = frame->es = frame->ds = GDT_KERNEL_DATA;
+    frame->fs = GDT_KERNEL_PERCPU;
+    frame->edi = frame->esi = frame->ebp = frame->esp = 0;
+    frame->ebx = frame->edx = frame->ecx = frame->eax = 0;
+    frame->int_no = 32;
+    frame->err_code = 0;
+    frame->eip = (uint32_t)context_switch_resume;
+    frame->cs = GDT_KERNEL_CODE;
+    frame->eflags = 0x002; /* IF stays clear until popf in the resume stub */
+
+    proc->context_type = PROC_CONTEXT_IRQ;
+    proc->esp = (uint32_t)frame;
+    return frame;
+}
+
+/* Switch away from an interrupted process if the class rules allow it */
+static registers_t* scheduler_switch(process_t* current, registers_t* regs,
+                                     int expired) {
+    /* Inside preempt_disable()/RCU read sections: retry at the next tick */
+    if (cpu_current()->preempt_count != 0) {
+        cpu_current()->need_resched = 1;
+        return regs;
+    }
+
+    current->esp = (uint32_t)regs;
+    current->context_type = PROC_CONTEXT_IRQ;
+
+    process_t* next = scheduler_select(current, expired, 0);
+    if (next == current) {
+        return regs;
+    }
+
+    return scheduler_frame_for(next);
 }
 
 /* Initialize scheduler */
@@ -57,109 +401,345 @@ void scheduler_init(void) {
 
 /* Add process to scheduler */
 void scheduler_add_process(process_t* proc) {
-    if (proc == 0) {
+    if (proc == 0 || (proc->flags & PROC_FLAG_IDLE)) {
         return;
     }
 
+    uint32_t flags = irq_save();
+
+    uint32_t now = timer_get_ticks();
+
     if (proc->state != PROC_STATE_ZOMBIE && proc->state != PROC_STATE_STOPPED) {
         proc->state = PROC_STATE_READY;
+        proc->ready_since = now;
     }
 
     proc->quantum = quantum;
+
+    /* A woken process goes back to the CPU it last ran on (its FPU state
+       may still be live there); a new one to the least loaded CPU. */
+    cpu_t* target = (proc->cpu != CPU_NONE) ? cpu_get(proc->cpu) : 0;
+    if (target == 0 || !target->online) {
+        target = cpu_current();
+        uint32_t best_load = 0xFFFFFFFF;
+        for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+            cpu_t* cpu = cpu_get(i);
+            uint32_t load = cpu->rq.nr_ready + (cpu->current != cpu->idle);
+            if (cpu->online && load < best_load) {
+                best_load = load;
+                target = cpu;
+            }
+        }
+        proc->cpu = target->index;
+    }
+
+    runqueue_t* rq = &target->rq;
+    rq_lock(rq);
+
+    if (!proc->on_rq && proc_is_runnable(proc)) {
+        rq_enqueue(rq, proc, 0);
+
+        /* Wakeup preemption: a real-time process that outranks the running
+           one must not wait for the current quantum to expire, and an idle
+           CPU should pick up new work right away. */
+        process_t* running = target->current;
+        if (running == 0 || running == target->idle ||
+            (proc != running && proc_is_eligible(proc, now) &&
+             sched_outranks(proc, running))) {
+            sched_kick(target);
+        }
+    }
+
+    rq_unlock(rq);
+
+    irq_restore(flags);
 }
 
 /* Remove process from scheduler */
 void scheduler_remove_process(process_t* proc) {
-    if (proc == 0) {
+    if (proc == 0 || proc->cpu == CPU_NONE) {
         return;
     }
 
-    proc->state = PROC_STATE_STOPPED;
-}
+    uint32_t flags = irq_save();
 
-/* Schedule next process (called by timer interrupt) */
-registers_t* scheduler_tick(registers_t* regs) {
-    /* Disable interrupts to protect process_list access.
-       Called from IRQ context but process_list can be modified from
-       other contexts (e.g., process_destroy, process_create). */
-    unsigned int flags;
-    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    runqueue_t* rq = proc_rq(proc);
+    rq_lock(rq);
 
-    process_t* current = process_get_current();
+    if (proc->on_rq) {
+        rq_dequeue(rq, proc);
+    }
 
-    /* If the recorded current process is not runnable (e.g. blocked/stopped),
-       treat it as no current so the scheduler can pick a runnable process. */
-    if (current != 0 && !proc_is_runnable(current)) {
-        /* Clear current so the existing initialization path runs and selects
-           a runnable process (if any). Also clear global current pointer. */
-        process_set_current(0);
-        current = 0;
+    if (proc->state == PROC_STATE_READY || proc->state == PROC_STATE_RUNNING) {
+        proc->state = PROC_STATE_STOPPED;
     }
 
+    rq_unlock(rq);
+
+    irq_restore(flags);
+}
+
+/* Schedule next process (called by the timer interrupt on every CPU) */
+registers_t* scheduler_tick(registers_t* regs) {
+    cpu_t* cpu = cpu_current();
+    process_t* current = cpu->current;
+
     if (current == 0) {
-        if (process_list == 0) {
-            /* Restore interrupts before returning */
-            if (flags & (1 << 9)) {
-                asm volatile("sti");
-            }
-            return regs;
-        }
+        return regs;
+    }
 
-        process_set_current(process_list);
-        process_list->state = PROC_STATE_RUNNING;
-        process_list->quantum = quantum;
-        current = process_list;
+    /* The interrupted code is outside any RCU read section */
+    if (cpu->preempt_count == 0) {
+        rcu_note_qs(cpu);
     }
 
-    /* Restore interrupts for context switch operations */
-    if (flags & (1 << 9)) {
-        asm volatile("sti");
+    /* Charge the tick to the privilege level it interrupted */
+    if ((regs->cs & 0x3) != 0) {
+        current->user_ticks++;
+    } else {
+        current->kernel_ticks++;
     }
 
-    /* Save the current interrupt frame pointer as the process context */
-    current->esp = (uint32_t)regs;
+    /* A process that blocked without yielding must be switched out */
+    int expired = !proc_is_runnable(current);
 
-    if (current->quantum > 0) {
-        current->quantum--;
+    if (current == cpu->idle) {
+        /* Idle looks for work to steal every tick */
+        expired = 1;
+    } else if (current->sched_class == SCHED_CLASS_EDF) {
+        /* EDF processes are throttled once the period budget is used up */
+        if (current->edf_budget > 0) {
+            current->edf_budget--;
+        }
+        if (current->edf_budget == 0) {
+            expired = 1;
+        }
+    } else if (current->sched_class == SCHED_CLASS_NORMAL) {
+        if (current->quantum > 0) {
+            current->quantum--;
+        }
+        if (current->quantum == 0) {
+            current->quantum = quantum;
+            expired = 1;
+        }
     }
+    /* FIFO processes run until they block or yield */
 
-    if (current->quantum > 0) {
+    /* An EDF process may have been replenished by the passage of time, so
+       re-evaluate every tick while any are admitted on this CPU. */
+    if (!expired && !cpu->need_resched && cpu->rq.nr_edf == 0) {
         return regs;
     }
 
-    current->quantum = quantum;
+    return scheduler_switch(current, regs, expired);
+}
 
-    process_t* next = scheduler_pick_next(current);
-    if (next == 0 || next == current) {
+/* Reschedule outside the timer tick (wakeup preemption) */
+registers_t* scheduler_preempt(registers_t* regs) {
+    cpu_t* cpu = cpu_current();
+    process_t* current = cpu->current;
+    if (current == 0) {
+        cpu->need_resched = 0;
         return regs;
     }
 
-    if (next->esp == 0) {
-        return regs;
+    return scheduler_switch(current, regs,
+                            current == cpu->idle || !proc_is_runnable(current));
+}
+
+int scheduler_need_resched(void) {
+    return cpu_current()->need_resched != 0;
+}
+
+/* Switch away from current in thread context, to direct if non-zero.
+   Called with interrupts disabled. */
+static void schedule_to(cpu_t* cpu, process_t* current, int expired,
+                        process_t* direct) {
+    cpu->yield_pending = 1;
+    current->quantum = quantum;
+
+    process_t* next = scheduler_select(current, expired, direct);
+    if (next != current) {
+        current->context_type = PROC_CONTEXT_SWITCH;
+        if (next->context_type == PROC_CONTEXT_SWITCH) {
+            context_switch(current, next);
+        } else {
+            /* Preempted by an interrupt: resume through its saved frame */
+            context_switch_frame(current, next);
+        }
+
+        /* Resumed, possibly on another CPU */
+        scheduler_finish_switch();
     }
+}
 
-    if (current->state == PROC_STATE_RUNNING) {
-        current->state = PROC_STATE_READY;
+/* Force schedule (voluntary yield, block or exit).
+   Switches directly with context_switch(), saving only callee-saved state,
+   instead of raising a fake timer interrupt: no interrupt frame, no PIC
+   EOI, and timer_ticks only counts real ticks. */
+void schedule(void) {
+    uint32_t flags = irq_save();
+
+    cpu_t* cpu = cpu_current();
+    process_t* current = cpu->current;
+    if (current != 0) {
+        schedule_to(cpu, current, 1, 0);
     }
 
-    next->state = PROC_STATE_RUNNING;
-    if (next->quantum == 0) {
-        next->quantum = quantum;
+    irq_restore(flags);
+}
+
+/* Hand this CPU straight to next. Only a normal-class process that no CPU
+   is running and whose FPU state is not live on another CPU can be taken
+   over, the same rules work stealing follows. */
+int scheduler_handoff(process_t* next) {
+    uint32_t flags = irq_save();
+
+    cpu_t* cpu = cpu_current();
+    process_t* current = cpu->current;
+    if (current == 0 || next == current || next->on_cpu || next->on_rq ||
+        next->sched_class != SCHED_CLASS_NORMAL ||
+        (next->fpu_cpu != CPU_NONE && next->fpu_cpu != cpu->index)) {
+        irq_restore(flags);
+        return -1;
     }
 
-    vmm_switch_page_directory(next->page_dir);
-    process_set_current(next);
-    return (registers_t*)next->esp;
+    /* A still runnable current goes to the head of the queue, so it runs
+       again as soon as next blocks */
+    schedule_to(cpu, current, 0, next);
+
+    irq_restore(flags);
+    return 0;
 }
 
-/* Force schedule (voluntary yield) */
-void schedule(void) {
-    process_t* current = process_get_current();
-    if (current != 0) {
-        current->quantum = 0;
+/* Run this CPU's idle thread on the current stack (AP startup) */
+void scheduler_run_idle(void) {
+    cpu_t* cpu = cpu_current();
+    process_t* idle = cpu->idle;
+
+    idle->state = PROC_STATE_RUNNING;
+    idle->cpu = cpu->index;
+    idle->on_cpu = 1;
+    cpu->current = idle;
+    fpu_switch(idle);
+
+    __asm__ __volatile__("sti");
+    idle_process();
+}
+
+/* Drop a process's real-time reservation (if any). Caller holds the lock
+   of the process's run queue. */
+static void scheduler_release_class(process_t* proc, runqueue_t* rq) {
+    if (proc->sched_class == SCHED_CLASS_EDF) {
+        rq->edf_util -= edf_density(proc->edf_runtime, proc->edf_deadline);
+        rq->nr_edf--;
+    } else if (proc->sched_class == SCHED_CLASS_FIFO) {
+        rq->nr_fifo--;
     }
 
-    __asm__ __volatile__("int $0x20");
+    proc->sched_class = SCHED_CLASS_NORMAL;
+    proc->rt_priority = 0;
+}
+
+/* Lock the run queue a process belongs to, assigning the calling CPU if
+   it has none yet. Real-time classes are accounted on that CPU. */
+static cpu_t* sched_lock_class(process_t* proc) {
+    if (proc->cpu == CPU_NONE) {
+        proc->cpu = cpu_current()->index;
+    }
+
+    cpu_t* cpu = cpu_get(proc->cpu);
+    rq_lock(&cpu->rq);
+    return cpu;
+}
+
+int scheduler_set_normal(process_t* proc) {
+    if (proc == 0) {
+        return -1;
+    }
+
+    uint32_t flags = irq_save();
+
+    cpu_t* cpu = sched_lock_class(proc);
+    scheduler_release_class(proc, &cpu->rq);
+    proc->quantum = quantum;
+    rq_unlock(&cpu->rq);
+    sched_kick(cpu);
+
+    irq_restore(flags);
+    return 0;
+}
+
+int scheduler_set_fifo(process_t* proc, uint32_t rt_priority) {
+    if (proc == 0 || rt_priority < SCHED_RT_PRIO_MIN ||
+        rt_priority > SCHED_RT_PRIO_MAX) {
+        return -1;
+    }
+
+    uint32_t flags = irq_save();
+
+    cpu_t* cpu = sched_lock_class(proc);
+    scheduler_release_class(proc, &cpu->rq);
+    proc->sched_class = SCHED_CLASS_FIFO;
+    proc->rt_priority = rt_priority;
+    cpu->rq.nr_fifo++;
+    rq_unlock(&cpu->rq);
+    sched_kick(cpu);
+
+    irq_restore(flags);
+    return 0;
+}
+
+/* Reserve runtime ticks every period ticks, to be completed within deadline
+   ticks of each period start (deadline 0 means deadline == period). */
+int scheduler_set_edf(process_t* proc, uint32_t runtime, uint32_t deadline,
+                      uint32_t period) {
+    if (deadline == 0) {
+        deadline = period;
+    }
+
+    if (proc == 0 || runtime == 0 || deadline < runtime || period < deadline) {
+        return -1;
+    }
+
+    uint32_t density = edf_density(runtime, deadline);
+
+    uint32_t flags = irq_save();
+
+    cpu_t* cpu = sched_lock_class(proc);
+    runqueue_t* rq = &cpu->rq;
+
+    /* Admission control: an existing reservation is replaced, not added */
+    uint32_t total = rq->edf_util;
+    if (proc->sched_class == SCHED_CLASS_EDF) {
+        total -= edf_density(proc->edf_runtime, proc->edf_deadline);
+    }
+
+    if (total + density > SCHED_EDF_UTIL_MAX) {
+        rq_unlock(rq);
+        irq_restore(flags);
+        return -1;
+    }
+
+    scheduler_release_class(proc, rq);
+    proc->sched_class = SCHED_CLASS_EDF;
+    proc->edf_runtime = runtime;
+    proc->edf_deadline = deadline;
+    proc->edf_period = period;
+    proc->edf_budget = 0;
+    proc->edf_release = timer_get_ticks();
+    rq->edf_util += density;
+    rq->nr_edf++;
+    rq_unlock(rq);
+    sched_kick(cpu);
+
+    irq_restore(flags);
+    return 0;
+}
+
+/* EDF density admitted on the calling CPU */
+uint32_t scheduler_get_edf_utilization(void) {
+    return cpu_current()->rq.edf_util;
 }
 
 /* Set quantum */
@@ -174,22 +754,22 @@ uint32_t scheduler_get_quantum(void) {
     return quantum;
 }
 
-/* Get number of ready processes */
+/* Get number of ready processes (queued or running, on all CPUs) */
 uint32_t scheduler_get_ready_count(void) {
     uint32_t count = 0;
-    process_t* proc = process_list;
 
-    if (proc == 0) {
-        return 0;
-    }
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (!cpu->online) {
+            continue;
+        }
 
-    process_t* start = proc;
-    do {
-        if (proc->state == PROC_STATE_READY || proc->state == PROC_STATE_RUNNING) {
+        count += cpu->rq.nr_ready;
+        if (cpu->current != 0 && cpu->current != cpu->idle &&
+            !cpu->current->on_rq) {
             count++;
         }
-        proc = proc->next;
-    } while (proc != 0 && proc != start);
+    }
 
     return count;
 }
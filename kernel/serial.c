@@ -0,0 +1,234 @@
+/* SYNAPSE SO - Serial Port */
+/* Licensed under GPLv3 */
+
+/* Console output is queued in a lock-free MPSC ring, so any CPU and any
+ * context can log without waiting for the UART. The transmitter-empty
+ * interrupt is the consumer: each one refills the 16-byte FIFO from the
+ * ring. Producers only enable that interrupt after queuing; the handler
+ * disables it once the ring is drained and then checks the ring again,
+ * so a byte queued in between always re-arms it. */
+
+#include <kernel/serial.h>
+#include <kernel/io.h>
+#include <kernel/irq.h>
+#include <kernel/ring.h>
+#include <kernel/spinlock.h>
+
+/* 16550 registers, as offsets from the base port */
+#define UART_DATA           0       /* RBR/THR; divisor low with DLAB */
+#define UART_IER            1       /* divisor high with DLAB */
+#define UART_IIR            2       /* read */
+#define UART_FCR            2       /* write */
+#define UART_LCR            3
+#define UART_MCR            4
+#define UART_LSR            5
+
+#define UART_IER_THRE       0x02    /* interrupt when THR/FIFO empties */
+#define UART_IIR_NONE       0x01    /* no interrupt pending */
+#define UART_LCR_8N1        0x03
+#define UART_LCR_DLAB       0x80
+#define UART_FCR_ENABLE     0xC7    /* enable, clear both, 14-byte trigger */
+#define UART_MCR_DTR_RTS    0x03
+#define UART_MCR_OUT2       0x08    /* gates the IRQ line on PCs */
+#define UART_MCR_LOOP       0x10
+#define UART_LSR_DR         0x01    /* received data ready */
+#define UART_LSR_THRE       0x20    /* transmit holding register empty */
+
+#define UART_CLOCK_HZ       115200  /* divisor base */
+#define UART_FIFO_SIZE      16
+
+/* Polls of the line status before the loopback test gives up */
+#define UART_LOOPBACK_POLLS 100000
+
+/* Characters converted per ring enqueue */
+#define SERIAL_CHUNK        32
+
+static int serial_present;
+static volatile int serial_irq_mode;
+
+static ring_mpsc_slot_t serial_tx_slots[SERIAL_TX_RING];
+static ring_mpsc_t serial_tx_ring;
+
+/* Held by whoever consumes the ring or writes the UART directly */
+static spinlock_t serial_tx_lock = SPINLOCK_INIT("serial_tx");
+
+int serial_init(void) {
+    uint16_t port = SERIAL_COM1;
+    uint16_t divisor = UART_CLOCK_HZ / SERIAL_BAUD;
+
+    ring_mpsc_init(&serial_tx_ring, serial_tx_slots, SERIAL_TX_RING);
+
+    outb(port + UART_IER, 0);
+    outb(port + UART_LCR, UART_LCR_DLAB);
+    outb(port + UART_DATA, divisor & 0xFF);
+    outb(port + UART_IER, (divisor >> 8) & 0xFF);
+    outb(port + UART_LCR, UART_LCR_8N1);
+    outb(port + UART_FCR, UART_FCR_ENABLE);
+
+    /* A byte sent in loopback mode must come back */
+    outb(port + UART_MCR, UART_MCR_LOOP | UART_MCR_DTR_RTS);
+    outb(port + UART_DATA, 0xAE);
+    for (uint32_t i = 0; i < UART_LOOPBACK_POLLS; i++) {
+        if (inb(port + UART_LSR) & UART_LSR_DR) {
+            break;
+        }
+    }
+    if (inb(port + UART_DATA) != 0xAE) {
+        serial_present = 0;
+        return -1;
+    }
+
+    outb(port + UART_MCR, UART_MCR_OUT2 | UART_MCR_DTR_RTS);
+    serial_present = 1;
+    return 0;
+}
+
+static void serial_wait_thre(void) {
+    while (!(inb(SERIAL_COM1 + UART_LSR) & UART_LSR_THRE)) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+/* Move up to a FIFO's worth of queued bytes into an empty transmitter.
+   Returns the number moved. serial_tx_lock held. */
+static uint32_t serial_fill_fifo(void) {
+    if (!(inb(SERIAL_COM1 + UART_LSR) & UART_LSR_THRE)) {
+        return 0;
+    }
+
+    uint32_t bytes[UART_FIFO_SIZE];
+    uint32_t n = ring_mpsc_dequeue(&serial_tx_ring, bytes, UART_FIFO_SIZE);
+    for (uint32_t i = 0; i < n; i++) {
+        outb(SERIAL_COM1 + UART_DATA, (uint8_t)bytes[i]);
+    }
+    return n;
+}
+
+/* Push everything queued out by polling. serial_tx_lock held. */
+static void serial_flush_locked(void) {
+    while (ring_mpsc_count(&serial_tx_ring) != 0) {
+        serial_wait_thre();
+        serial_fill_fifo();
+    }
+}
+
+static int serial_irq(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+
+    /* Reading IIR also acknowledges a transmitter-empty interrupt */
+    if (inb(SERIAL_COM1 + UART_IIR) & UART_IIR_NONE) {
+        return IRQ_NONE;
+    }
+
+    spin_lock(&serial_tx_lock);
+    if (serial_fill_fifo() == 0) {
+        outb(SERIAL_COM1 + UART_IER, 0);
+        if (ring_mpsc_count(&serial_tx_ring) != 0) {
+            outb(SERIAL_COM1 + UART_IER, UART_IER_THRE);
+        }
+    }
+    spin_unlock(&serial_tx_lock);
+
+    return IRQ_HANDLED;
+}
+
+void serial_start_irq(void) {
+    if (!serial_present) {
+        return;
+    }
+
+    if (irq_register_handler(IRQ_BASE_VECTOR + SERIAL_IRQ, serial_irq, 0) == 0) {
+        serial_irq_mode = 1;
+    }
+}
+
+/* Queue count bytes. A full ring is drained by the caller one FIFO at a
+   time, which only stalls it when output outruns the line. */
+static void serial_enqueue(const uint32_t* bytes, uint32_t count) {
+    while (count > 0) {
+        uint32_t n = ring_mpsc_enqueue(&serial_tx_ring, bytes, count);
+        bytes += n;
+        count -= n;
+
+        if (count > 0) {
+            uint32_t flags = spin_lock_irqsave(&serial_tx_lock);
+            serial_wait_thre();
+            serial_fill_fifo();
+            spin_unlock_irqrestore(&serial_tx_lock, flags);
+        }
+    }
+
+    outb(SERIAL_COM1 + UART_IER, UART_IER_THRE);
+}
+
+void serial_console_write(const char* str) {
+    if (!serial_present) {
+        return;
+    }
+
+    if (!serial_irq_mode) {
+        serial_write(str);
+        return;
+    }
+
+    uint32_t chunk[SERIAL_CHUNK];
+    uint32_t n = 0;
+    while (*str != '\0') {
+        if (*str == '\n') {
+            chunk[n++] = '\r';
+        }
+        chunk[n++] = (uint8_t)*str++;
+
+        /* Room for a "\r\n" pair */
+        if (n >= SERIAL_CHUNK - 1) {
+            serial_enqueue(chunk, n);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        serial_enqueue(chunk, n);
+    }
+}
+
+void serial_flush(void) {
+    if (!serial_present) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&serial_tx_lock);
+    serial_flush_locked();
+    spin_unlock_irqrestore(&serial_tx_lock, flags);
+}
+
+static void serial_putc_locked(char c) {
+    serial_wait_thre();
+    outb(SERIAL_COM1 + UART_DATA, (uint8_t)c);
+}
+
+void serial_putc(char c) {
+    if (!serial_present) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&serial_tx_lock);
+    serial_flush_locked();
+    serial_putc_locked(c);
+    spin_unlock_irqrestore(&serial_tx_lock, flags);
+}
+
+void serial_write(const char* str) {
+    if (!serial_present) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&serial_tx_lock);
+    serial_flush_locked();
+    while (*str != '\0') {
+        if (*str == '\n') {
+            serial_putc_locked('\r');
+        }
+        serial_putc_locked(*str++);
+    }
+    spin_unlock_irqrestore(&serial_tx_lock, flags);
+}
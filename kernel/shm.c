@@ -0,0 +1,142 @@
+/* SYNAPSE SO - Shared Memory Objects */
+/* Licensed under GPLv3 */
+
+#include <kernel/shm.h>
+#include <kernel/heap.h>
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/spinlock.h>
+
+typedef struct {
+    uint32_t in_use;
+    pid_t owner;
+    uint32_t page_count;
+    uint32_t* frames;           /* one reference each, held by the object */
+} shm_object_t;
+
+static shm_object_t shm_objects[SHM_MAX_OBJECTS];
+
+/* Protects shm_objects */
+static spinlock_t shm_lock = SPINLOCK_INIT("shm");
+
+/* Drop the object's references; frames still mapped somewhere survive */
+static void shm_release_frames(uint32_t* frames, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        pmm_free_frame(frames[i]);
+    }
+    kfree(frames);
+}
+
+int32_t shm_create(uint32_t pages) {
+    process_t* proc = process_get_current();
+    if (proc == 0 || pages == 0 || pages > SHM_MAX_PAGES) {
+        return -1;
+    }
+
+    uint32_t* frames = (uint32_t*)kmalloc(pages * sizeof(uint32_t));
+    if (frames == 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < pages; i++) {
+        frames[i] = pmm_alloc_zeroed_frame();
+        if (frames[i] == 0) {
+            shm_release_frames(frames, i);
+            return -1;
+        }
+    }
+
+    uint32_t flags = spin_lock_irqsave(&shm_lock);
+    for (uint32_t id = 0; id < SHM_MAX_OBJECTS; id++) {
+        shm_object_t* obj = &shm_objects[id];
+        if (!obj->in_use) {
+            obj->in_use = 1;
+            obj->owner = proc->pid;
+            obj->page_count = pages;
+            obj->frames = frames;
+            spin_unlock_irqrestore(&shm_lock, flags);
+            return (int32_t)id;
+        }
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    shm_release_frames(frames, pages);
+    return -1;
+}
+
+/* Unpublish an object and release it. Caller holds shm_lock, which is
+   dropped before the frames are (the heap and pmm locks come later). */
+static void shm_object_free(shm_object_t* obj, uint32_t flags) {
+    uint32_t* frames = obj->frames;
+    uint32_t count = obj->page_count;
+
+    obj->in_use = 0;
+    obj->frames = 0;
+    obj->page_count = 0;
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    shm_release_frames(frames, count);
+}
+
+int32_t shm_destroy(uint32_t id) {
+    process_t* proc = process_get_current();
+    if (proc == 0 || id >= SHM_MAX_OBJECTS) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&shm_lock);
+    shm_object_t* obj = &shm_objects[id];
+    if (!obj->in_use || obj->owner != proc->pid) {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return -1;
+    }
+
+    shm_object_free(obj, flags);
+    return 0;
+}
+
+int32_t shm_map(uint32_t id, page_directory_t* pd, uint32_t virt_addr,
+                uint32_t flags) {
+    if (id >= SHM_MAX_OBJECTS || pd == 0) {
+        return -1;
+    }
+
+    /* Held across the mapping so the object cannot be destroyed under it */
+    uint32_t irq_flags = spin_lock_irqsave(&shm_lock);
+    shm_object_t* obj = &shm_objects[id];
+    int32_t result = -1;
+    if (obj->in_use) {
+        result = vmm_map_frames(pd, virt_addr, obj->frames, obj->page_count,
+                                flags);
+    }
+    spin_unlock_irqrestore(&shm_lock, irq_flags);
+    return result;
+}
+
+int32_t shm_unmap(uint32_t id, page_directory_t* pd, uint32_t virt_addr) {
+    if (id >= SHM_MAX_OBJECTS || pd == 0) {
+        return -1;
+    }
+
+    /* Held across the unmapping so the frame list stays valid */
+    uint32_t flags = spin_lock_irqsave(&shm_lock);
+    shm_object_t* obj = &shm_objects[id];
+    int32_t result = -1;
+    if (obj->in_use) {
+        result = vmm_unmap_frames(pd, virt_addr, obj->frames, obj->page_count);
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+    return result;
+}
+
+void shm_process_exit(process_t* proc) {
+    for (uint32_t id = 0; id < SHM_MAX_OBJECTS; id++) {
+        uint32_t flags = spin_lock_irqsave(&shm_lock);
+        shm_object_t* obj = &shm_objects[id];
+        if (obj->in_use && obj->owner == proc->pid) {
+            shm_object_free(obj, flags);
+        } else {
+            spin_unlock_irqrestore(&shm_lock, flags);
+        }
+    }
+}
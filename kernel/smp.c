@@ -0,0 +1,210 @@
+/* SYNAPSE SO - Symmetric Multiprocessing */
+/* Licensed under GPLv3 */
+
+/* The boot CPU (BSP) finds the other processors in the ACPI MADT and starts
+ * each with the INIT/SIPI/SIPI sequence. An application processor (AP)
+ * starts in real mode at AP_TRAMPOLINE_ADDR, switches to protected mode
+ * with paging in kernel/ap_boot.asm and enters ap_main() on the stack of
+ * its idle thread. From then on it schedules its own run queue. */
+
+#include <kernel/smp.h>
+#include <kernel/acpi.h>
+#include <kernel/fpu.h>
+#include <kernel/gdt.h>
+#include <kernel/idt.h>
+#include <kernel/irq.h>
+#include <kernel/lapic.h>
+#include <kernel/string.h>
+#include <kernel/syscall.h>
+#include <kernel/timer.h>
+#include <kernel/vga.h>
+#include <kernel/vmm.h>
+
+/* Trampoline code and parameters (kernel/ap_boot.asm) */
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint32_t ap_boot_cr3;
+extern uint32_t ap_boot_stack;
+extern uint32_t ap_boot_entry;
+extern uint32_t ap_boot_cpu;
+
+/* CPU 0 is the BSP; its self pointer must be valid before gdt_init() */
+static cpu_t cpus[MAX_CPUS] = { [0] = { .self = &cpus[0], .online = 1 } };
+static uint32_t cpu_count = 1;
+
+cpu_t* cpu_get(uint32_t index) {
+    return (index < MAX_CPUS) ? &cpus[index] : 0;
+}
+
+uint32_t smp_cpu_count(void) {
+    return cpu_count;
+}
+
+/* Address of a trampoline parameter inside the low-memory copy */
+static uint32_t* ap_param(uint32_t* param) {
+    return (uint32_t*)(AP_TRAMPOLINE_ADDR + (uint32_t)param -
+                       (uint32_t)ap_trampoline_start);
+}
+
+static void cpu_setup(cpu_t* cpu, uint32_t index, uint32_t apic_id) {
+    cpu->self = cpu;
+    cpu->index = index;
+    cpu->apic_id = apic_id;
+    cpu->current = 0;
+    cpu->prev = 0;
+    cpu->fpu_owner = 0;
+    cpu->need_resched = 0;
+    cpu->yield_pending = 0;
+    cpu->irq_depth = 0;
+    cpu->preempt_count = 0;
+    cpu->rcu_qs_count = 0;
+    cpu->softirq_pending = 0;
+    cpu->tasklet_head = cpu->tasklet_tail = 0;
+    spin_lock_init(&cpu->rq.lock, "runqueue");
+}
+
+/* Create the idle thread of a CPU; it is never on a run queue */
+static process_t* cpu_create_idle(cpu_t* cpu) {
+    process_t* idle = process_create("idle",
+                                     PROC_FLAG_KERNEL | PROC_FLAG_IDLE |
+                                     PROC_FLAG_DETACHED,
+                                     (process_entry_t)idle_process);
+    if (idle != 0) {
+        idle->cpu = cpu->index;
+        idle->ppid = 0;
+    }
+    cpu->idle = idle;
+    return idle;
+}
+
+/* INIT, then up to two STARTUP IPIs, as in the MP specification */
+static int smp_start_ap(cpu_t* cpu) {
+    process_t* idle = cpu_create_idle(cpu);
+    if (idle == 0) {
+        return -1;
+    }
+
+    *ap_param(&ap_boot_cr3) = vmm_get_kernel_directory_phys();
+    *ap_param(&ap_boot_stack) = idle->stack_end;
+    *ap_param(&ap_boot_entry) = (uint32_t)ap_main;
+    *ap_param(&ap_boot_cpu) = cpu->index;
+
+    lapic_send_init(cpu->apic_id);
+    timer_busy_wait_us(10000);
+
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_startup(cpu->apic_id, AP_TRAMPOLINE_ADDR >> 12);
+        timer_busy_wait_us(200);
+    }
+
+    /* Give the AP up to 100ms to reach ap_main() */
+    for (int ms = 0; ms < 100 && !cpu->online; ms++) {
+        timer_busy_wait_us(1000);
+    }
+
+    if (!cpu->online) {
+        process_destroy(idle);
+        cpu->idle = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The reschedule IPI only has to interrupt: need_resched is checked on
+   the way out */
+static int smp_reschedule_irq(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    return IRQ_HANDLED;
+}
+
+/* Timer tick forwarded by the boot CPU while it runs on the PIT */
+static int smp_tick_irq(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    return IRQ_HANDLED | IRQ_TICK;
+}
+
+void smp_init(void) {
+    vga_print("[+] Initializing SMP...\n");
+
+    cpu_t* bsp = &cpus[0];
+    cpu_setup(bsp, 0, 0);
+    bsp->current = process_get_current();
+    cpu_create_idle(bsp);
+
+    /* irq_init() parsed the MADT and mapped the local APIC */
+    if (!lapic_present()) {
+        vga_print("    No local APIC, running on the boot CPU only\n");
+        return;
+    }
+
+    bsp->apic_id = lapic_id();
+
+    irq_register_handler(IPI_RESCHEDULE_VECTOR, smp_reschedule_irq, 0);
+    irq_register_handler(IPI_TICK_VECTOR, smp_tick_irq, 0);
+
+    uint32_t size = (uint32_t)ap_trampoline_end - (uint32_t)ap_trampoline_start;
+    memcpy((void*)AP_TRAMPOLINE_ADDR, ap_trampoline_start, size);
+
+    for (uint32_t i = 0; i < acpi_get_cpu_count(); i++) {
+        uint32_t apic_id = acpi_get_cpu_apic_id(i);
+        if (apic_id == bsp->apic_id) {
+            continue;
+        }
+
+        if (cpu_count >= MAX_CPUS) {
+            vga_print("    Ignoring CPUs above MAX_CPUS\n");
+            break;
+        }
+
+        cpu_t* cpu = &cpus[cpu_count];
+        cpu_setup(cpu, cpu_count, apic_id);
+
+        if (smp_start_ap(cpu) == 0) {
+            cpu_count++;
+        } else {
+            vga_print("[-] CPU with APIC ID ");
+            vga_print_dec(apic_id);
+            vga_print(" did not start\n");
+        }
+    }
+
+    vga_print("    ");
+    vga_print_dec(cpu_count);
+    vga_print(" CPU(s) online\n");
+}
+
+void smp_broadcast_tick(void) {
+    cpu_t* self = cpu_current();
+
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        if (&cpus[i] != self && cpus[i].online) {
+            lapic_send_ipi(cpus[i].apic_id, IPI_TICK_VECTOR);
+        }
+    }
+}
+
+void smp_send_reschedule(cpu_t* cpu) {
+    if (cpu != cpu_current() && cpu->online && lapic_present()) {
+        lapic_send_ipi(cpu->apic_id, IPI_RESCHEDULE_VECTOR);
+    }
+}
+
+/* First C code of an AP, on its idle thread's stack with interrupts off */
+void ap_main(uint32_t index) {
+    cpu_t* cpu = &cpus[index];
+
+    gdt_init_cpu(index, (uint32_t)cpu);
+    idt_load();
+    fpu_init_cpu();
+    syscall_init_cpu();
+    lapic_init_cpu();
+    lapic_timer_start_cpu();
+
+    __sync_synchronize();
+    cpu->online = 1;
+
+    scheduler_run_idle();
+}
@@ -0,0 +1,93 @@
+/* SYNAPSE SO - Deferred Interrupt Work */
+/* Licensed under GPLv3 */
+
+#include <kernel/softirq.h>
+#include <kernel/cpu.h>
+#include <kernel/smp.h>
+#include <kernel/vga.h>
+
+static softirq_handler_t softirq_handlers[SOFTIRQ_COUNT];
+
+void softirq_register(uint32_t nr, softirq_handler_t handler) {
+    if (nr < SOFTIRQ_COUNT) {
+        softirq_handlers[nr] = handler;
+    }
+}
+
+void softirq_raise(uint32_t nr) {
+    __sync_fetch_and_or(&cpu_current()->softirq_pending, 1u << nr);
+}
+
+void softirq_run(void) {
+    cpu_t* cpu = cpu_current();
+
+    /* A nested interrupt must neither switch away from us nor run the
+       softirqs itself (irq_depth stays raised until we return) */
+    preempt_disable();
+
+    for (uint32_t pass = 0; pass < SOFTIRQ_MAX_RESTART && cpu->softirq_pending; pass++) {
+        uint32_t pending = __sync_lock_test_and_set(&cpu->softirq_pending, 0);
+
+        __asm__ __volatile__("sti");
+        for (uint32_t nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if ((pending & (1u << nr)) && softirq_handlers[nr] != 0) {
+                softirq_handlers[nr]();
+            }
+        }
+        __asm__ __volatile__("cli");
+    }
+
+    preempt_enable();
+}
+
+/* Append t to this CPU's tasklet list */
+static void tasklet_enqueue(tasklet_t* t) {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = cpu_current();
+
+    t->next = 0;
+    if (cpu->tasklet_tail != 0) {
+        cpu->tasklet_tail->next = t;
+    } else {
+        cpu->tasklet_head = t;
+    }
+    cpu->tasklet_tail = t;
+    softirq_raise(SOFTIRQ_TASKLET);
+
+    irq_restore(flags);
+}
+
+void tasklet_schedule(tasklet_t* t) {
+    if (__sync_fetch_and_or(&t->state, TASKLET_STATE_SCHED) & TASKLET_STATE_SCHED) {
+        return;
+    }
+    tasklet_enqueue(t);
+}
+
+static void tasklet_softirq(void) {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = cpu_current();
+    tasklet_t* list = cpu->tasklet_head;
+    cpu->tasklet_head = cpu->tasklet_tail = 0;
+    irq_restore(flags);
+
+    while (list != 0) {
+        tasklet_t* t = list;
+        list = t->next;
+
+        /* Still running on another CPU: try again at the next exit */
+        if (__sync_fetch_and_or(&t->state, TASKLET_STATE_RUN) & TASKLET_STATE_RUN) {
+            tasklet_enqueue(t);
+            continue;
+        }
+
+        /* Cleared first, so the function may reschedule its own tasklet */
+        __sync_fetch_and_and(&t->state, ~TASKLET_STATE_SCHED);
+        t->func(t->data);
+        __sync_fetch_and_and(&t->state, ~TASKLET_STATE_RUN);
+    }
+}
+
+void softirq_init(void) {
+    softirq_register(SOFTIRQ_TASKLET, tasklet_softirq);
+}
@@ -5,44 +5,89 @@ section .note.GNU-stack noalloc noexec nowrite progbits
 
 section .text
 
-%define KERNEL_VIRT_START 0xC0000000
-
 ; Offsets into process_t (kernel/include/kernel/process.h)
-%define PROC_PAGE_DIR   52
-%define PROC_STACK_END  68
-%define PROC_ESP        72
-%define PROC_EBP        76
-%define PROC_EIP        80
-%define PROC_EFLAGS     84
+; Checked by _Static_assert in kernel/scheduler.c
+%define PROC_STACK_END  64
+%define PROC_ESP        68
+%define PROC_EBP        72
+%define PROC_EIP        76
+%define PROC_EFLAGS     80
+
+extern isr_restore_frame
+extern scheduler_finish_switch
+extern process_exit
+
+; Save the callee-saved state of old_proc (eax) on its stack.
+; Switch frame layout, from the saved ESP upwards:
+;   ebp, edi, esi, ebx, eflags, return address
+%macro SAVE_SWITCH_FRAME 0
+    pushfd
+    push ebx
+    push esi
+    push edi
+    push ebp
+    mov [eax+PROC_ESP], esp
+%endmacro
 
 ; Context switch function
+; The caller (schedule) has already switched CR3 and updated the current
+; process; only the kernel stack changes here.
 ; Parameters:
 ;   old_proc: pointer to old process structure
-;   new_proc: pointer to new process structure
+;   new_proc: pointer to new process structure (PROC_CONTEXT_SWITCH)
 global context_switch
 context_switch:
     mov eax, [esp+4]          ; old_proc
     mov edx, [esp+8]          ; new_proc
 
-    ; Save current stack pointers
-    mov [eax+PROC_ESP], esp
-    mov [eax+PROC_EBP], ebp
+    SAVE_SWITCH_FRAME
 
-    ; Switch page directory (CR3) if provided
-    mov ecx, [edx+PROC_PAGE_DIR]
-    test ecx, ecx
-    jz .skip_cr3
-    sub ecx, KERNEL_VIRT_START
-    mov cr3, ecx
-.skip_cr3:
-
-    ; Load new stack pointers
+    ; Load new stack and fall into the resume sequence
     mov esp, [edx+PROC_ESP]
-    mov ebp, [edx+PROC_EBP]
 
+; Pop a switch frame and return into the code that called context_switch.
+; The interrupt path also irets here (see scheduler_frame_for).
+global context_switch_resume
+context_switch_resume:
+    pop ebp
+    pop edi
+    pop esi
+    pop ebx
+    popfd
     ret
 
+; Switch to a process whose stack holds an interrupt frame
+; Parameters:
+;   old_proc: pointer to old process structure
+;   new_proc: pointer to new process structure (PROC_CONTEXT_IRQ)
+global context_switch_frame
+context_switch_frame:
+    mov eax, [esp+4]          ; old_proc
+    mov edx, [esp+8]          ; new_proc
+
+    SAVE_SWITCH_FRAME
+
+    ; Unwind the saved registers_t exactly like an interrupt return
+    mov esp, [edx+PROC_ESP]
+    call scheduler_finish_switch
+    jmp isr_restore_frame
+
+; First code of a new kernel thread (entry point in ebx, interrupts off).
+; Releases the previous process like every other switch path, then runs
+; the entry point and exits the thread if it returns.
+context_thread_start:
+    call scheduler_finish_switch
+    sti
+    call ebx
+    push dword 0
+    call process_exit
+.hang:
+    hlt
+    jmp .hang
+
 ; Initialize context for new process
+; Builds a switch frame so the first context_switch into the process
+; returns to context_thread_start, which calls entry_point.
 ; Parameters:
 ;   proc: pointer to process structure
 ;   entry_point: entry point address
@@ -55,13 +100,17 @@ context_init:
     mov ecx, [ebp+12]         ; entry_point
 
     mov edx, [eax+PROC_STACK_END]
-    sub edx, 4
+    sub edx, 24
 
-    ; Push entry point as return address
-    mov [edx], ecx
+    mov dword [edx+20], context_thread_start ; return address
+    mov dword [edx+16], 0x002 ; eflags (IF=0 until finish_switch)
+    mov [edx+12], ecx         ; ebx = entry point
+    mov dword [edx+8], 0      ; esi
+    mov dword [edx+4], 0      ; edi
+    mov dword [edx], 0        ; ebp
 
     mov [eax+PROC_ESP], edx
-    mov [eax+PROC_EBP], edx
+    mov dword [eax+PROC_EBP], 0
     mov [eax+PROC_EIP], ecx
     mov dword [eax+PROC_EFLAGS], 0x202
 
@@ -0,0 +1,300 @@
+/* SYNAPSE SO - System Calls */
+/* Licensed under GPLv3 */
+
+/* Two entry paths share one table. int 0x80 goes through isr_common_stub
+ * and saves a full registers_t frame. SYSENTER (kernel/syscall_entry.asm)
+ * saves only what SYSEXIT and the C calling convention need and skips the
+ * IDT, the interrupt frame and iret. */
+
+#include <kernel/syscall.h>
+#include <kernel/cpu.h>
+#include <kernel/gdt.h>
+#include <kernel/ipc.h>
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/shm.h>
+#include <kernel/smp.h>
+#include <kernel/string.h>
+#include <kernel/uring.h>
+#include <kernel/vga.h>
+#include <kernel/vmm.h>
+#include <kernel/trace.h>
+#include <kernel/profile.h>
+
+/* Entry points in kernel/syscall_entry.asm */
+extern void sysenter_entry(void);
+extern uint8_t syscall_bench_user[];
+extern uint8_t syscall_bench_user_end[];
+
+/* Benchmark page: code at the start, result block, stack at the end */
+#define SYSCALL_BENCH_ADDR      0x40000000
+#define SYSCALL_BENCH_RESULTS   (SYSCALL_BENCH_ADDR + 0x800)
+#define SYSCALL_BENCH_SHIFT     12
+#define SYSCALL_BENCH_ITERATIONS (1 << SYSCALL_BENCH_SHIFT)
+
+/* Result block written by syscall_bench_user */
+typedef struct {
+    uint64_t int_start;
+    uint64_t int_end;
+    uint64_t sysenter_start;
+    uint64_t sysenter_end;
+    uint32_t sysenter_enabled;
+} __attribute__((packed)) syscall_bench_result_t;
+
+static int sysenter_supported;
+
+static int32_t sys_null(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1;
+    (void)arg2;
+    (void)arg3;
+    return 0;
+}
+
+static int32_t sys_exit(uint32_t code, uint32_t arg2, uint32_t arg3) {
+    (void)arg2;
+    (void)arg3;
+    process_exit((int)code);
+    return -1;
+}
+
+static int32_t sys_yield(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1;
+    (void)arg2;
+    (void)arg3;
+    schedule();
+    return 0;
+}
+
+static int32_t sys_getpid(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1;
+    (void)arg2;
+    (void)arg3;
+    return (int32_t)process_get_pid();
+}
+
+static int32_t sys_write(uint32_t buf, uint32_t len, uint32_t arg3) {
+    (void)arg3;
+
+    /* Check the whole buffer first so that nothing is printed on failure,
+       then copy it in a piece at a time */
+    if (!user_access_ok(buf, len, 0)) {
+        return -1;
+    }
+
+    char chunk[64];
+    for (uint32_t done = 0; done < len; ) {
+        uint32_t n = len - done;
+        if (n > sizeof(chunk)) {
+            n = sizeof(chunk);
+        }
+        if (copy_from_user(chunk, buf + done, n) != 0) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            vga_put_char(chunk[i]);
+        }
+        done += n;
+    }
+    return (int32_t)len;
+}
+
+static int32_t sys_uring_setup(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1;
+    (void)arg2;
+    (void)arg3;
+    return uring_setup();
+}
+
+static int32_t sys_uring_enter(uint32_t to_submit, uint32_t min_complete,
+                               uint32_t arg3) {
+    (void)arg3;
+    return uring_enter(to_submit, min_complete);
+}
+
+static int32_t sys_ipc_create(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1;
+    (void)arg2;
+    (void)arg3;
+    return ipc_create();
+}
+
+static int32_t sys_ipc_destroy(uint32_t endpoint, uint32_t arg2, uint32_t arg3) {
+    (void)arg2;
+    (void)arg3;
+    return ipc_destroy(endpoint);
+}
+
+static int32_t sys_ipc_send(uint32_t endpoint, uint32_t msg, uint32_t arg3) {
+    (void)arg3;
+    return ipc_send(endpoint, (ipc_msg_t*)msg);
+}
+
+static int32_t sys_ipc_recv(uint32_t endpoint, uint32_t msg, uint32_t arg3) {
+    (void)arg3;
+    return ipc_recv(endpoint, (ipc_msg_t*)msg);
+}
+
+static int32_t sys_ipc_call(uint32_t endpoint, uint32_t msg, uint32_t arg3) {
+    (void)arg3;
+    return ipc_call(endpoint, (ipc_msg_t*)msg);
+}
+
+static int32_t sys_ipc_reply(uint32_t msg, uint32_t arg2, uint32_t arg3) {
+    (void)arg2;
+    (void)arg3;
+    return ipc_reply((ipc_msg_t*)msg);
+}
+
+static int32_t sys_shm_create(uint32_t pages, uint32_t arg2, uint32_t arg3) {
+    (void)arg2;
+    (void)arg3;
+    return shm_create(pages);
+}
+
+static int32_t sys_shm_destroy(uint32_t id, uint32_t arg2, uint32_t arg3) {
+    (void)arg2;
+    (void)arg3;
+    return shm_destroy(id);
+}
+
+static int32_t sys_shm_map(uint32_t id, uint32_t addr, uint32_t writable) {
+    return shm_map(id, vmm_get_current_directory(), addr,
+                   writable ? PAGE_WRITE : 0);
+}
+
+static int32_t sys_shm_unmap(uint32_t id, uint32_t addr, uint32_t arg3) {
+    (void)arg3;
+    return shm_unmap(id, vmm_get_current_directory(), addr);
+}
+
+static int32_t sys_trace(uint32_t op, uint32_t arg2, uint32_t arg3) {
+    (void)arg2;
+    (void)arg3;
+    return trace_control(op);
+}
+
+static int32_t sys_profile(uint32_t op, uint32_t arg2, uint32_t arg3) {
+    (void)arg2;
+    (void)arg3;
+    return profile_control(op);
+}
+
+static int32_t sys_ps(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1;
+    (void)arg2;
+    (void)arg3;
+    process_print_table();
+    return 0;
+}
+
+static const syscall_fn_t syscall_table[SYSCALL_COUNT] = {
+    [SYS_NULL] = sys_null,
+    [SYS_EXIT] = sys_exit,
+    [SYS_YIELD] = sys_yield,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_WRITE] = sys_write,
+    [SYS_URING_SETUP] = sys_uring_setup,
+    [SYS_URING_ENTER] = sys_uring_enter,
+    [SYS_IPC_CREATE] = sys_ipc_create,
+    [SYS_IPC_DESTROY] = sys_ipc_destroy,
+    [SYS_IPC_SEND] = sys_ipc_send,
+    [SYS_IPC_RECV] = sys_ipc_recv,
+    [SYS_IPC_CALL] = sys_ipc_call,
+    [SYS_IPC_REPLY] = sys_ipc_reply,
+    [SYS_SHM_CREATE] = sys_shm_create,
+    [SYS_SHM_DESTROY] = sys_shm_destroy,
+    [SYS_SHM_MAP] = sys_shm_map,
+    [SYS_SHM_UNMAP] = sys_shm_unmap,
+    [SYS_TRACE] = sys_trace,
+    [SYS_PROFILE] = sys_profile,
+    [SYS_PS] = sys_ps,
+};
+
+int32_t syscall_dispatch(uint32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    if (num >= SYSCALL_COUNT || syscall_table[num] == 0) {
+        return -1;
+    }
+    return syscall_table[num](arg1, arg2, arg3);
+}
+
+void syscall_init_cpu(void) {
+    if (!sysenter_supported) {
+        return;
+    }
+
+    tss_t* tss = gdt_get_tss(cpu_current()->index);
+    wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&tss->esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+void syscall_init(void) {
+    vga_print("[+] Initializing system calls...\n");
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    /* Family 6 models before 3 with stepping before 3 report SEP
+       without implementing it */
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    sysenter_supported = (edx & CPUID_EDX_SEP) &&
+                         !(family == 6 && model < 3 && stepping < 3);
+
+    syscall_init_cpu();
+
+    vga_print("    int 0x80 gate ready, SYSENTER ");
+    vga_print(sysenter_supported ? "enabled\n" : "not supported\n");
+}
+
+/* Body of the ring-3 benchmark thread. Its own kernel stack is what TSS
+   esp0 points at while it runs, so both entry paths land there. */
+static void syscall_bench_user_thread(void) {
+    syscall_enter_user(SYSCALL_BENCH_ADDR, SYSCALL_BENCH_ADDR + PAGE_SIZE,
+                       SYSCALL_BENCH_RESULTS, SYSCALL_BENCH_ITERATIONS);
+}
+
+static void syscall_bench_print(const char* path, uint64_t start, uint64_t end) {
+    vga_print("    ");
+    vga_print(path);
+    vga_print(": ");
+    vga_print_dec((uint32_t)((end - start) >> SYSCALL_BENCH_SHIFT));
+    vga_print(" cycles per null syscall\n");
+}
+
+void syscall_benchmark(void) {
+    uint32_t frame = pmm_alloc_frame();
+    if (frame == 0) {
+        return;
+    }
+
+    /* Kernel threads share the kernel page directory, so the page is
+       visible both here and to the ring-3 thread */
+    vmm_map_page(SYSCALL_BENCH_ADDR, frame, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+    memset((void*)SYSCALL_BENCH_ADDR, 0, PAGE_SIZE);
+    memcpy((void*)SYSCALL_BENCH_ADDR, syscall_bench_user,
+           (uint32_t)syscall_bench_user_end - (uint32_t)syscall_bench_user);
+
+    volatile syscall_bench_result_t* result =
+        (volatile syscall_bench_result_t*)SYSCALL_BENCH_RESULTS;
+    result->sysenter_enabled = sysenter_supported;
+
+    process_t* user = process_create("syscall_bench", PROC_FLAG_KERNEL,
+                                     syscall_bench_user_thread);
+    int code;
+    if (user == 0 || process_wait(user->pid, &code) != 0) {
+        vmm_unmap_page(SYSCALL_BENCH_ADDR);
+        return;
+    }
+
+    vga_print("[+] Null syscall round trip (");
+    vga_print_dec(SYSCALL_BENCH_ITERATIONS);
+    vga_print(" iterations):\n");
+    syscall_bench_print("int 0x80", result->int_start, result->int_end);
+    if (sysenter_supported) {
+        syscall_bench_print("SYSENTER", result->sysenter_start, result->sysenter_end);
+    }
+
+    vmm_unmap_page(SYSCALL_BENCH_ADDR);
+}
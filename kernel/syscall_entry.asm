@@ -0,0 +1,156 @@
+; SYNAPSE SO - System Call Entry
+; Licensed under GPLv3
+
+section .text
+
+; Segment selector constants (must match kernel/include/kernel/gdt.h)
+%define GDT_KERNEL_DATA 0x10
+%define GDT_USER_CODE 0x1B
+%define GDT_USER_DATA 0x23
+%define GDT_KERNEL_PERCPU 0x30
+
+; System call numbers (must match kernel/include/kernel/syscall.h)
+%define SYS_NULL 0
+%define SYS_EXIT 1
+
+extern syscall_dispatch
+
+; SYSENTER fast path. The CPU has loaded CS/SS from MSR_SYSENTER_CS, EIP
+; from MSR_SYSENTER_EIP and cleared IF; MSR_SYSENTER_ESP holds the address
+; of this CPU's TSS esp0 field, so one load switches to the kernel stack
+; of the running process. ecx = user esp, edx = user return address.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp]
+    cld                         ; DF is not preserved across SYSENTER
+
+    push ecx                    ; user esp, for SYSEXIT
+    push edx                    ; user eip, for SYSEXIT
+    push ebp
+    push ds
+    push es
+    push fs
+    push gs                     ; user GS: not reloaded by interrupts from
+                                ; ring 0, so it may change under a switch
+
+    mov bp, GDT_KERNEL_DATA
+    mov ds, bp
+    mov es, bp
+    mov bp, GDT_KERNEL_PERCPU   ; FS addresses this CPU's cpu_t
+    mov fs, bp
+
+    ; Preserved across the call (cdecl may overwrite its argument slots)
+    push edi
+    push esi
+    push ebx
+
+    sti
+    push edi                    ; arg3
+    push esi                    ; arg2
+    push ebx                    ; arg1
+    push eax                    ; number
+    call syscall_dispatch
+    add esp, 16
+    cli
+
+    pop ebx
+    pop esi
+    pop edi
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    pop ebp
+    pop edx
+    pop ecx
+
+    ; STI takes effect after SYSEXIT, so no interrupt can arrive on the
+    ; kernel stack with user segments loaded
+    sti
+    sysexit
+
+; Drop to ring 3 at eip with stack esp, never returning:
+; void syscall_enter_user(uint32_t eip, uint32_t esp, uint32_t ebx, uint32_t esi)
+; ebx and esi are handed to the user code; other registers are cleared.
+global syscall_enter_user
+syscall_enter_user:
+    cli                         ; user segments below must not see an IRQ
+    mov eax, [esp + 4]
+    mov ecx, [esp + 8]
+    mov ebx, [esp + 12]
+    mov esi, [esp + 16]
+
+    mov dx, GDT_USER_DATA
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+
+    push dword GDT_USER_DATA    ; ss
+    push ecx                    ; esp
+    push dword 0x202            ; eflags: IF
+    push dword GDT_USER_CODE    ; cs
+    push eax                    ; eip
+
+    xor eax, eax
+    xor ecx, ecx
+    xor edx, edx
+    xor edi, edi
+    xor ebp, ebp
+    iret
+
+; Ring-3 benchmark body, copied to a user page by syscall_benchmark().
+; Position independent. On entry ebx points at the result block:
+;   +0  int 0x80 loop start TSC      +8  int 0x80 loop end TSC
+;   +16 SYSENTER loop start TSC      +24 SYSENTER loop end TSC
+;   +32 non-zero if SYSENTER may be used
+; and esi holds the iteration count of each loop.
+global syscall_bench_user
+global syscall_bench_user_end
+syscall_bench_user:
+    mov ebp, ebx
+
+    rdtsc
+    mov [ebp], eax
+    mov [ebp + 4], edx
+    mov edi, esi
+.int_loop:
+    mov eax, SYS_NULL
+    int 0x80
+    dec edi
+    jnz .int_loop
+    rdtsc
+    mov [ebp + 8], eax
+    mov [ebp + 12], edx
+
+    cmp dword [ebp + 32], 0
+    je .done
+
+    rdtsc
+    mov [ebp + 16], eax
+    mov [ebp + 20], edx
+    call .here
+.here:
+    pop edx
+    add edx, .sysenter_return - .here
+    mov edi, esi
+.sysenter_loop:
+    mov eax, SYS_NULL
+    mov ecx, esp
+    sysenter
+.sysenter_return:
+    dec edi
+    jnz .sysenter_loop
+    rdtsc
+    mov [ebp + 24], eax
+    mov [ebp + 28], edx
+
+.done:
+    mov eax, SYS_EXIT
+    xor ebx, ebx
+    int 0x80
+.hang:
+    jmp .hang
+syscall_bench_user_end:
+
+section .note.GNU-stack noalloc noexec nowrite progbits
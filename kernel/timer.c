@@ -4,24 +4,107 @@
 #include <kernel/timer.h>
 #include <kernel/io.h>
 #include <kernel/vga.h>
+#include <kernel/irq.h>
+#include <kernel/lapic.h>
+#include <kernel/cpu.h>
+#include <kernel/spinlock.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+#include <kernel/uring.h>
 
 #define PIT_FREQUENCY_HZ 1193180
 #define PIT_COMMAND_PORT 0x43
 #define PIT_CHANNEL0_PORT 0x40
 #define PIT_COMMAND_MODE3 0x36
+#define PIT_CHANNEL2_PORT 0x42
+#define PIT_COMMAND_CH2_MODE0 0xB0
+#define PIT_COMMAND_CH2_MODE2 0xB4
+#define PIT_COMMAND_CH2_LATCH 0x80
+
+/* Port 0x61: bit 0 gates PIT channel 2, bit 1 drives the speaker, bit 5
+   reads back channel 2's output */
+#define PIT_GATE_PORT 0x61
+#define PIT_GATE_CH2 0x01
+#define PIT_GATE_SPEAKER 0x02
+#define PIT_OUT_CH2 0x20
+
+/* Longest single channel 2 countdown (fits the 16-bit counter) */
+#define PIT_BUSY_WAIT_CHUNK_US 50000
+
+/* TSC calibration interval */
+#define CLOCK_CALIBRATE_US 50000
+
+/* Largest shift of the counts-to-ns multiplier */
+#define CLOCK_MAX_SHIFT 24
 
 static volatile uint32_t timer_ticks;
 static uint32_t timer_frequency __attribute__((unused));
 
+/* clock_ns() = clock_cycles() * clock_mult >> clock_shift */
+static uint32_t clock_mult;
+static uint32_t clock_shift;
+static uint32_t clock_rate_khz;
+static int clock_tsc;
+static uint64_t clock_tsc_base;
+
+/* PIT fallback: channel 2 wraps every 65536 counts (about 55ms), so it is
+   folded into clock_pit_total at least once per tick */
+static int clock_pit;
+static uint64_t clock_pit_total;
+static uint16_t clock_pit_last;
+static spinlock_t clock_pit_lock = SPINLOCK_INIT("clock_pit");
+
+static uint64_t clock_pit_read(void);
+
+/* Expiry work of a tick, run after the interrupt with interrupts enabled */
+static void timer_softirq(void) {
+    uring_timer_tick(timer_ticks);
+}
+
+/* Every CPU has its own local APIC timer; the boot CPU's also advances
+   timer_ticks */
+static int lapic_timer_irq(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+
+    lapic_timer_rearm();
+    if (cpu_current()->index == 0) {
+        timer_increment_tick();
+        softirq_raise(SOFTIRQ_TIMER);
+    }
+    return IRQ_HANDLED | IRQ_TICK;
+}
+
+/* The PIT fallback (IRQ0) reaches the boot CPU only, which forwards the
+   tick to the others */
+static int pit_timer_irq(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+
+    timer_increment_tick();
+    softirq_raise(SOFTIRQ_TIMER);
+    smp_broadcast_tick();
+    return IRQ_HANDLED | IRQ_TICK;
+}
+
 void timer_init(uint32_t frequency_hz) {
     timer_ticks = 0;
     timer_frequency = frequency_hz;
+    softirq_register(SOFTIRQ_TIMER, timer_softirq);
 
     /* Calculate divisor: PIT_BASE / desired_frequency */
     if (frequency_hz == 0) {
         /* Avoid division by zero; clamp to 1 Hz minimum */
         frequency_hz = 1;
     }
+
+    /* Prefer the per-CPU local APIC timer; the PIT then stays quiet and
+       IRQ0 masked, as no handler is registered for it */
+    if (lapic_present() && lapic_timer_init(frequency_hz) == 0) {
+        irq_register_handler(LAPIC_TIMER_VECTOR, lapic_timer_irq, 0);
+        return;
+    }
+
     uint32_t divisor = PIT_FREQUENCY_HZ / frequency_hz;
     if (divisor > 65535) {
         divisor = 65535;
@@ -39,6 +122,9 @@ void timer_init(uint32_t frequency_hz) {
     /* Send divisor high byte */
     outb(PIT_CHANNEL0_PORT, (divisor >> 8) & 0xFF);
 
+    /* Unmasks IRQ0 */
+    irq_register_handler(IRQ_BASE_VECTOR, pit_timer_irq, 0);
+
     uint32_t actual_freq = PIT_FREQUENCY_HZ / divisor;
     vga_print("    Timer configured: ");
     vga_print_dec(actual_freq);
@@ -47,10 +133,167 @@ void timer_init(uint32_t frequency_hz) {
     vga_print(" Hz)\n");
 }
 
+/* Spin for at least us microseconds using PIT channel 2 in one-shot mode.
+   Does not need interrupts, so it works before timer_init() and with the
+   local APIC not yet set up (AP startup delays). */
+void timer_busy_wait_us(uint32_t us) {
+    while (us > 0) {
+        uint32_t chunk = (us > PIT_BUSY_WAIT_CHUNK_US) ? PIT_BUSY_WAIT_CHUNK_US : us;
+        uint32_t count = (chunk * (PIT_FREQUENCY_HZ / 1000)) / 1000;
+        if (count == 0) {
+            count = 1;
+        }
+
+        /* Channel 2 runs the clock: wait on it instead of reprogramming */
+        if (clock_pit) {
+            uint64_t end = clock_pit_read() + count;
+            while (clock_pit_read() < end) {
+                __asm__ __volatile__("pause");
+            }
+            us -= chunk;
+            continue;
+        }
+
+        /* Gate low, speaker off, then program mode 0 */
+        uint8_t gate = inb(PIT_GATE_PORT) & ~(PIT_GATE_CH2 | PIT_GATE_SPEAKER);
+        outb(PIT_GATE_PORT, gate);
+        outb(PIT_COMMAND_PORT, PIT_COMMAND_CH2_MODE0);
+        outb(PIT_CHANNEL2_PORT, count & 0xFF);
+        outb(PIT_CHANNEL2_PORT, (count >> 8) & 0xFF);
+
+        /* Raising the gate starts the countdown; OUT2 goes high at zero */
+        outb(PIT_GATE_PORT, gate | PIT_GATE_CH2);
+        while (!(inb(PIT_GATE_PORT) & PIT_OUT_CH2)) {
+            __asm__ __volatile__("pause");
+        }
+
+        us -= chunk;
+    }
+}
+
 void timer_increment_tick(void) {
     __sync_add_and_fetch(&timer_ticks, 1);
+
+    /* Keep the PIT clock from missing a wrap */
+    if (clock_pit) {
+        clock_pit_read();
+    }
 }
 
 uint32_t timer_get_ticks(void) {
     return (uint32_t)__sync_add_and_fetch(&timer_ticks, 0);
 }
+
+/* n / d, for a quotient that fits 32 bits (no 64-bit division here) */
+static uint32_t div64_32(uint64_t n, uint32_t d) {
+    uint32_t q, r;
+    __asm__("divl %4"
+            : "=a"(q), "=d"(r)
+            : "a"((uint32_t)n), "d"((uint32_t)(n >> 32)), "rm"(d));
+    (void)r;
+    return q;
+}
+
+/* One count lasts scale / freq ns. Pick the largest shift that keeps the
+   multiplier in 32 bits. */
+static void clock_set_rate(uint32_t scale, uint32_t freq) {
+    uint32_t shift = CLOCK_MAX_SHIFT;
+    while (shift > 0 && (uint32_t)(((uint64_t)scale << shift) >> 32) >= freq) {
+        shift--;
+    }
+
+    clock_shift = shift;
+    clock_mult = div64_32((uint64_t)scale << shift, freq);
+}
+
+static uint16_t pit_ch2_read(void) {
+    outb(PIT_COMMAND_PORT, PIT_COMMAND_CH2_LATCH);
+    uint8_t lo = inb(PIT_CHANNEL2_PORT);
+    uint8_t hi = inb(PIT_CHANNEL2_PORT);
+    return (uint16_t)(lo | (hi << 8));
+}
+
+/* Fold the counts elapsed on channel 2 (it counts down) into the total */
+static uint64_t clock_pit_read(void) {
+    uint32_t flags = spin_lock_irqsave(&clock_pit_lock);
+    uint16_t now = pit_ch2_read();
+    clock_pit_total += (uint16_t)(clock_pit_last - now);
+    clock_pit_last = now;
+    uint64_t total = clock_pit_total;
+    spin_unlock_irqrestore(&clock_pit_lock, flags);
+    return total;
+}
+
+static int clock_tsc_invariant(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < CPUID_EXT_POWER) {
+        return 0;
+    }
+    cpuid(CPUID_EXT_POWER, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_EDX_INVARIANT_TSC) != 0;
+}
+
+void clock_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    if (edx & CPUID_EDX_TSC) {
+        uint64_t start = rdtsc();
+        timer_busy_wait_us(CLOCK_CALIBRATE_US);
+        uint64_t cycles = rdtsc() - start;
+
+        if ((cycles >> 32) == 0 && (uint32_t)cycles >= CLOCK_CALIBRATE_US / 1000) {
+            clock_rate_khz = (uint32_t)cycles / (CLOCK_CALIBRATE_US / 1000);
+            clock_set_rate(1000000, clock_rate_khz);
+            clock_tsc_base = start;
+            clock_tsc = 1;
+
+            vga_print("    TSC clock: ");
+            vga_print_dec(clock_rate_khz / 1000);
+            vga_print(clock_tsc_invariant() ? " MHz, invariant\n" : " MHz, not invariant\n");
+            return;
+        }
+    }
+
+    /* No usable TSC: let channel 2 count down from 65536 over and over
+       (mode 2, gate high, speaker off) and accumulate its input clock */
+    uint8_t gate = inb(PIT_GATE_PORT) & ~PIT_GATE_SPEAKER;
+    outb(PIT_GATE_PORT, gate | PIT_GATE_CH2);
+    outb(PIT_COMMAND_PORT, PIT_COMMAND_CH2_MODE2);
+    outb(PIT_CHANNEL2_PORT, 0);
+    outb(PIT_CHANNEL2_PORT, 0);
+
+    clock_pit_last = pit_ch2_read();
+    clock_pit_total = 0;
+    clock_rate_khz = PIT_FREQUENCY_HZ / 1000;
+    clock_set_rate(1000000000, PIT_FREQUENCY_HZ);
+    clock_pit = 1;
+
+    vga_print("    No TSC, clock counts PIT channel 2 at 1193 kHz\n");
+}
+
+uint64_t clock_cycles(void) {
+    if (clock_tsc) {
+        return rdtsc() - clock_tsc_base;
+    }
+    if (clock_pit) {
+        return clock_pit_read();
+    }
+    return 0;
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    uint32_t lo = (uint32_t)cycles;
+    uint32_t hi = (uint32_t)(cycles >> 32);
+    return (((uint64_t)lo * clock_mult) >> clock_shift) +
+           (((uint64_t)hi * clock_mult) << (32 - clock_shift));
+}
+
+uint64_t clock_ns(void) {
+    return clock_cycles_to_ns(clock_cycles());
+}
+
+uint32_t clock_khz(void) {
+    return clock_rate_khz;
+}
@@ -0,0 +1,212 @@
+/* SYNAPSE SO - Event Tracing */
+/* Licensed under GPLv3 */
+
+#include <kernel/trace.h>
+
+#ifdef CONFIG_TRACE
+
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/serial.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+#include <kernel/vga.h>
+#include <kernel/vmm.h>
+
+_Static_assert(sizeof(trace_record_t) == 32, "trace_record_t is 32 bytes");
+
+#define TRACE_RECORDS_PER_PAGE  (PAGE_SIZE / sizeof(trace_record_t))
+#define TRACE_RECORDS           (TRACE_PAGES * TRACE_RECORDS_PER_PAGE)
+
+/* The boot trace is dumped this many ticks after trace_init() (5s) */
+#define TRACE_BOOT_DUMP_TICKS   500
+
+typedef struct {
+    volatile uint32_t head;             /* records ever claimed */
+    trace_record_t* pages[TRACE_PAGES];
+} trace_buffer_t;
+
+static trace_buffer_t trace_buffers[MAX_CPUS];
+
+volatile uint32_t trace_enabled;
+
+/* Set while a dump or a restart is in progress */
+static volatile uint32_t trace_busy;
+
+void trace_record(uint32_t event, uint32_t arg0, uint32_t arg1, uint32_t arg2,
+                  uint32_t arg3) {
+    /* Stay on this CPU, and so on its ring, until the record is written */
+    preempt_disable();
+
+    cpu_t* cpu = cpu_current();
+    trace_buffer_t* buf = &trace_buffers[cpu->index];
+    if (buf->pages[0] != 0) {
+        /* An interrupt between the claim and the stores gets the next slot */
+        uint32_t pos = __atomic_fetch_add(&buf->head, 1, __ATOMIC_RELAXED) % TRACE_RECORDS;
+        trace_record_t* rec = &buf->pages[pos / TRACE_RECORDS_PER_PAGE]
+                                         [pos % TRACE_RECORDS_PER_PAGE];
+
+        rec->time = clock_cycles();
+        rec->event = (uint16_t)event;
+        rec->cpu = (uint16_t)cpu->index;
+        rec->pid = (cpu->current != 0) ? cpu->current->pid : 0;
+        rec->args[0] = arg0;
+        rec->args[1] = arg1;
+        rec->args[2] = arg2;
+        rec->args[3] = arg3;
+    }
+
+    preempt_enable();
+}
+
+/* Lines are formatted whole and written with one serial_write, so console
+   output from other CPUs can only fall between them */
+#define TRACE_LINE_MAX  (sizeof(trace_record_t) * 2 + 2)
+
+static char* trace_put_hex(char* out, uint32_t value, uint32_t digits) {
+    static const char hex[] = "0123456789abcdef";
+    while (digits-- > 0) {
+        *out++ = hex[(value >> (digits * 4)) & 0xF];
+    }
+    return out;
+}
+
+/* "<tag> <a> <b>" with a and b as 8 hex digits */
+static void trace_write_header(const char* tag, uint32_t a, uint32_t b) {
+    char line[TRACE_LINE_MAX];
+    char* out = line;
+    while (*tag != '\0') {
+        *out++ = *tag++;
+    }
+    *out++ = ' ';
+    out = trace_put_hex(out, a, 8);
+    *out++ = ' ';
+    out = trace_put_hex(out, b, 8);
+    *out++ = '\n';
+    *out = '\0';
+    serial_write(line);
+}
+
+static void trace_dump_buffer(uint32_t index) {
+    trace_buffer_t* buf = &trace_buffers[index];
+    uint32_t head = buf->head;
+    uint32_t count = (head < TRACE_RECORDS) ? head : TRACE_RECORDS;
+
+    trace_write_header("CPU", index, count);
+
+    /* Oldest first */
+    for (uint32_t i = head - count; i != head; i++) {
+        uint32_t pos = i % TRACE_RECORDS;
+        const uint8_t* bytes = (const uint8_t*)&buf->pages[pos / TRACE_RECORDS_PER_PAGE]
+                                                          [pos % TRACE_RECORDS_PER_PAGE];
+        char line[TRACE_LINE_MAX];
+        char* out = line;
+        for (uint32_t b = 0; b < sizeof(trace_record_t); b++) {
+            out = trace_put_hex(out, bytes[b], 2);
+        }
+        *out++ = '\n';
+        *out = '\0';
+        serial_write(line);
+    }
+}
+
+void trace_dump(void) {
+    if (__sync_lock_test_and_set(&trace_busy, 1)) {
+        return;
+    }
+
+    /* A record already being written on another CPU may still land */
+    uint32_t was_enabled = trace_enabled;
+    trace_enabled = 0;
+
+    uint32_t cpus = smp_cpu_count();
+    trace_write_header("SYNTRACE BEGIN", clock_khz(), cpus);
+
+    for (uint32_t i = 0; i < cpus; i++) {
+        if (trace_buffers[i].pages[0] != 0) {
+            trace_dump_buffer(i);
+        }
+    }
+
+    serial_write("SYNTRACE END\n");
+
+    trace_enabled = was_enabled;
+    __sync_lock_release(&trace_busy);
+}
+
+int32_t trace_control(uint32_t op) {
+    switch (op) {
+        case TRACE_OP_STOP:
+            trace_enabled = 0;
+            return 0;
+
+        case TRACE_OP_START:
+            if (__sync_lock_test_and_set(&trace_busy, 1)) {
+                return -1;
+            }
+            trace_enabled = 0;
+            for (uint32_t i = 0; i < MAX_CPUS; i++) {
+                trace_buffers[i].head = 0;
+            }
+            trace_enabled = 1;
+            __sync_lock_release(&trace_busy);
+            return 0;
+
+        case TRACE_OP_DUMP:
+            trace_dump();
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+static void trace_boot_dump(void) {
+    uint32_t start = timer_get_ticks();
+    while (timer_get_ticks() - start < TRACE_BOOT_DUMP_TICKS) {
+        __asm__ __volatile__("hlt");
+    }
+
+    trace_dump();
+    process_exit(0);
+}
+
+void trace_init(void) {
+    vga_print("[+] Initializing event tracing...\n");
+
+    uint32_t cpus = smp_cpu_count();
+    for (uint32_t i = 0; i < cpus; i++) {
+        for (uint32_t p = 0; p < TRACE_PAGES; p++) {
+            uint32_t frame = pmm_alloc_frame();
+            if (frame == 0) {
+                /* Leave this CPU without a ring; tracing stays off */
+                trace_buffers[i].pages[0] = 0;
+                vga_print("[-] Out of memory for trace buffers\n");
+                return;
+            }
+            trace_buffers[i].pages[p] = (trace_record_t*)vmm_phys_to_virt(frame);
+        }
+    }
+
+    trace_enabled = 1;
+    process_create("trace_dump", PROC_FLAG_KERNEL | PROC_FLAG_DETACHED, trace_boot_dump);
+
+    vga_print("    ");
+    vga_print_dec(TRACE_RECORDS);
+    vga_print(" records per CPU, dumped to COM1 after 5s\n");
+}
+
+#else
+
+void trace_init(void) {
+}
+
+int32_t trace_control(uint32_t op) {
+    (void)op;
+    return -1;
+}
+
+void trace_dump(void) {
+}
+
+#endif /* CONFIG_TRACE */
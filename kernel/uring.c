@@ -0,0 +1,292 @@
+/* SYNAPSE SO - Asynchronous Submission Rings */
+/* Licensed under GPLv3 */
+
+/* SQ entries are copied out of the shared page before they are checked, so
+ * the process cannot change one under the kernel. Operations run in the
+ * context of SYS_URING_ENTER, on the submitting process's address space.
+ * Sleeps complete from the boot CPU's tick, which writes the CQ through
+ * the kernel view of the shared page and wakes a waiting owner. */
+
+#include <kernel/uring.h>
+#include <kernel/heap.h>
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <kernel/string.h>
+#include <kernel/syscall.h>
+#include <kernel/timer.h>
+#include <kernel/vmm.h>
+
+_Static_assert(sizeof(uring_shared_t) <= PAGE_SIZE, "uring_shared_t must fit a page");
+_Static_assert((URING_SQ_ENTRIES & (URING_SQ_ENTRIES - 1)) == 0, "URING_SQ_ENTRIES");
+_Static_assert((URING_CQ_ENTRIES & (URING_CQ_ENTRIES - 1)) == 0, "URING_CQ_ENTRIES");
+
+/* Entries must be visible before the index that publishes them (x86 keeps
+   stores in order and loads in order; only the compiler needs a fence) */
+#define uring_barrier() __asm__ __volatile__("" : : : "memory")
+
+/* Rings with pending sleeps, and the earliest deadline among them. Lock
+   order: uring_timer_lock before a ring's lock. */
+static uring_t* uring_timers = 0;
+static volatile uint32_t uring_next_deadline = 0;
+static spinlock_t uring_timer_lock = SPINLOCK_INIT("uring_timers");
+
+/* Completions the owner has not reaped yet. A cq_head the process moved
+   past cq_tail (or too far back) counts as a full queue. */
+static uint32_t uring_cq_ready(uring_t* ring) {
+    uint32_t ready = ring->cq_tail - ring->shared->cq_head;
+    return (ready > URING_CQ_ENTRIES) ? URING_CQ_ENTRIES : ready;
+}
+
+/* Post a completion for an in-flight entry. Caller holds ring->lock. */
+static void uring_post(uring_t* ring, uint32_t user_data, int32_t result) {
+    uring_cqe_t* cqe = &ring->shared->cqes[ring->cq_tail & (URING_CQ_ENTRIES - 1)];
+    cqe->user_data = user_data;
+    cqe->result = result;
+    uring_barrier();
+    ring->cq_tail++;
+    ring->shared->cq_tail = ring->cq_tail;
+    ring->inflight--;
+
+    if (ring->waiter != 0 && uring_cq_ready(ring) >= ring->wait_nr) {
+        ring->waiter->state = PROC_STATE_READY;
+        scheduler_add_process(ring->waiter);
+        ring->waiter = 0;
+    }
+}
+
+static void uring_complete(uring_t* ring, uint32_t user_data, int32_t result) {
+    uint32_t flags = spin_lock_irqsave(&ring->lock);
+    uring_post(ring, user_data, result);
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+/* Queue a sleep; it completes from uring_timer_tick() */
+static void uring_sleep(uring_t* ring, uint32_t user_data, uint32_t ticks) {
+    if (ticks == 0) {
+        uring_complete(ring, user_data, 0);
+        return;
+    }
+
+    uint32_t deadline = timer_get_ticks() + ticks;
+
+    uint32_t flags = spin_lock_irqsave(&ring->lock);
+    if (ring->nr_timeouts == URING_MAX_TIMEOUTS) {
+        uring_post(ring, user_data, -1);
+        spin_unlock_irqrestore(&ring->lock, flags);
+        return;
+    }
+    ring->timeouts[ring->nr_timeouts].deadline = deadline;
+    ring->timeouts[ring->nr_timeouts].user_data = user_data;
+    ring->nr_timeouts++;
+    spin_unlock_irqrestore(&ring->lock, flags);
+
+    /* A tick in between may already have dropped the ring from the list;
+       it is added back here either way */
+    flags = spin_lock_irqsave(&uring_timer_lock);
+    int first = (uring_timers == 0);
+    if (!ring->on_timer_list) {
+        ring->timer_next = uring_timers;
+        uring_timers = ring;
+        ring->on_timer_list = 1;
+    }
+    if (first || (int32_t)(deadline - uring_next_deadline) < 0) {
+        uring_next_deadline = deadline;
+    }
+    spin_unlock_irqrestore(&uring_timer_lock, flags);
+}
+
+/* Run one submitted entry; every path posts exactly one completion, now
+   or (for sleeps) later */
+static void uring_execute(uring_t* ring, const uring_sqe_t* sqe) {
+    int32_t result = -1;
+
+    switch (sqe->opcode) {
+    case URING_OP_NOP:
+        result = 0;
+        break;
+
+    case URING_OP_SYSCALL:
+        /* Calls that leave the process or re-enter the ring are refused */
+        if (sqe->args[0] != SYS_EXIT && sqe->args[0] != SYS_URING_SETUP &&
+            sqe->args[0] != SYS_URING_ENTER) {
+            result = syscall_dispatch(sqe->args[0], sqe->args[1], sqe->args[2],
+                                      sqe->args[3]);
+        }
+        break;
+
+    case URING_OP_SLEEP:
+        uring_sleep(ring, sqe->user_data, sqe->args[0]);
+        return;
+
+    case URING_OP_MEMSET:
+        result = fill_user(sqe->args[0], (uint8_t)sqe->args[1], sqe->args[2]);
+        break;
+
+    case URING_OP_MEMCPY:
+        result = copy_in_user(sqe->args[0], sqe->args[1], sqe->args[2]);
+        break;
+
+    default:
+        break;
+    }
+
+    uring_complete(ring, sqe->user_data, result);
+}
+
+int32_t uring_setup(void) {
+    process_t* proc = process_get_current();
+    if (proc == 0 || (proc->flags & PROC_FLAG_KERNEL) || proc->uring != 0 ||
+        vmm_get_phys_addr(URING_USER_ADDR) != 0) {
+        return -1;
+    }
+
+    uring_t* ring = (uring_t*)kmalloc(sizeof(uring_t));
+    if (ring == 0) {
+        return -1;
+    }
+
+    uint32_t frame = pmm_alloc_zeroed_frame();
+    if (frame == 0) {
+        kfree(ring);
+        return -1;
+    }
+
+    memset(ring, 0, sizeof(uring_t));
+    spin_lock_init(&ring->lock, 0);
+    ring->shared = (uring_shared_t*)vmm_phys_to_virt(frame);
+
+    /* Freed with the rest of the address space */
+    if (vmm_map_page_in(proc->page_dir, URING_USER_ADDR, frame,
+                        PAGE_PRESENT | PAGE_WRITE | PAGE_USER) != 0) {
+        pmm_free_frame(frame);
+        kfree(ring);
+        return -1;
+    }
+
+    proc->uring = ring;
+    return (int32_t)URING_USER_ADDR;
+}
+
+int32_t uring_enter(uint32_t to_submit, uint32_t min_complete) {
+    process_t* proc = process_get_current();
+    uring_t* ring = (proc != 0) ? proc->uring : 0;
+    if (ring == 0) {
+        return -1;
+    }
+    uring_shared_t* shared = ring->shared;
+
+    /* Never consume more than the process published */
+    uint32_t avail = shared->sq_tail - ring->sq_head;
+    uring_barrier();
+    if (avail > URING_SQ_ENTRIES) {
+        avail = URING_SQ_ENTRIES;
+    }
+    if (to_submit > avail) {
+        to_submit = avail;
+    }
+
+    /* Only take entries whose completions have a CQ slot. Ticks only post
+       completions already counted in inflight, so the room cannot shrink
+       under us. */
+    uint32_t flags = spin_lock_irqsave(&ring->lock);
+    uint32_t used = uring_cq_ready(ring) + ring->inflight;
+    uint32_t room = (used < URING_CQ_ENTRIES) ? URING_CQ_ENTRIES - used : 0;
+    if (to_submit > room) {
+        to_submit = room;
+    }
+    ring->inflight += to_submit;
+    spin_unlock_irqrestore(&ring->lock, flags);
+
+    for (uint32_t i = 0; i < to_submit; i++) {
+        uring_sqe_t sqe = shared->sqes[ring->sq_head & (URING_SQ_ENTRIES - 1)];
+        uring_barrier();
+        ring->sq_head++;
+        shared->sq_head = ring->sq_head;
+        uring_execute(ring, &sqe);
+    }
+
+    if (min_complete == 0) {
+        return (int32_t)to_submit;
+    }
+
+    /* Wait for completions; never for more than can still arrive */
+    flags = spin_lock_irqsave(&ring->lock);
+    uint32_t possible = uring_cq_ready(ring) + ring->inflight;
+    ring->wait_nr = (min_complete < possible) ? min_complete : possible;
+
+    /* A wakeup between the unlock and the switch leaves us runnable */
+    while (uring_cq_ready(ring) < ring->wait_nr) {
+        ring->waiter = proc;
+        proc->state = PROC_STATE_BLOCKED;
+        spin_unlock(&ring->lock);
+        schedule();
+        spin_lock(&ring->lock);
+    }
+    ring->waiter = 0;
+    spin_unlock_irqrestore(&ring->lock, flags);
+
+    return (int32_t)to_submit;
+}
+
+void uring_destroy(process_t* proc) {
+    uring_t* ring = proc->uring;
+    if (ring == 0) {
+        return;
+    }
+
+    /* Off the timer list, so no tick touches it again */
+    uint32_t flags = spin_lock_irqsave(&uring_timer_lock);
+    if (ring->on_timer_list) {
+        uring_t** link = &uring_timers;
+        while (*link != ring) {
+            link = &(*link)->timer_next;
+        }
+        *link = ring->timer_next;
+    }
+    spin_unlock_irqrestore(&uring_timer_lock, flags);
+
+    proc->uring = 0;
+    kfree(ring);
+}
+
+void uring_timer_tick(uint32_t now) {
+    if (uring_timers == 0 || (int32_t)(now - uring_next_deadline) < 0) {
+        return;
+    }
+
+    spin_lock(&uring_timer_lock);
+
+    uint32_t next = now + 0x7FFFFFFF;
+    uring_t** link = &uring_timers;
+    while (*link != 0) {
+        uring_t* ring = *link;
+
+        spin_lock(&ring->lock);
+        uint32_t i = 0;
+        while (i < ring->nr_timeouts) {
+            uring_timeout_t* t = &ring->timeouts[i];
+            if ((int32_t)(now - t->deadline) >= 0) {
+                uring_post(ring, t->user_data, 0);
+                *t = ring->timeouts[--ring->nr_timeouts];
+            } else {
+                if ((int32_t)(t->deadline - next) < 0) {
+                    next = t->deadline;
+                }
+                i++;
+            }
+        }
+        uint32_t pending = ring->nr_timeouts;
+        spin_unlock(&ring->lock);
+
+        if (pending == 0) {
+            *link = ring->timer_next;
+            ring->on_timer_list = 0;
+        } else {
+            link = &ring->timer_next;
+        }
+    }
+
+    uring_next_deadline = next;
+    spin_unlock(&uring_timer_lock);
+}
@@ -2,24 +2,126 @@
 /* Licensed under GPLv3 */
 
 #include <kernel/vga.h>
+#include <kernel/io.h>
+#include <kernel/spinlock.h>
+#include <kernel/serial.h>
+
+/* Output goes to a shadow copy of the screen in RAM. Lines that changed
+ * are marked dirty and copied to video memory, 32 bits at a time, before
+ * each print returns. Video memory is uncached MMIO, so it is only ever
+ * written, never read back. The shadow rows form a ring: scrolling moves
+ * the index of the top row and clears one row instead of moving the other
+ * 24. */
 
 /* VGA memory buffer */
 volatile unsigned short* vga_buffer = (unsigned short*)0xB8000;
 
+/* CRT controller, for the hardware cursor */
+#define VGA_CRTC_INDEX      0x3D4
+#define VGA_CRTC_DATA       0x3D5
+#define VGA_CRTC_CURSOR_START   0x0A
+#define VGA_CRTC_CURSOR_END     0x0B
+#define VGA_CRTC_CURSOR_HIGH    0x0E
+#define VGA_CRTC_CURSOR_LOW     0x0F
+
+/* Every screen line fits in the dirty mask */
+_Static_assert(VGA_HEIGHT <= 32, "dirty mask holds 32 lines");
+_Static_assert(VGA_WIDTH % 2 == 0, "lines are copied as 32-bit pairs");
+
+#define VGA_ALL_DIRTY       ((uint32_t)((1ULL << VGA_HEIGHT) - 1))
+
+/* Two cells, for filling and copying lines; may alias the 16-bit cells */
+typedef uint32_t vga_pair_t __attribute__((may_alias));
+
+/* Shadow screen; screen line y is shadow row (vga_top + y) % VGA_HEIGHT */
+static unsigned short vga_shadow[VGA_HEIGHT][VGA_WIDTH] __attribute__((aligned(4)));
+static int vga_top = 0;
+
+/* Screen lines that differ from video memory */
+static uint32_t vga_dirty = 0;
+
 /* Current cursor position */
 static int cursor_x = 0;
 static int cursor_y = 0;
 
+/* Position last given to the hardware cursor (-1: not yet set) */
+static int hw_cursor = -1;
+
 /* Current color scheme */
 static unsigned char current_color = VGA_COLOR_LIGHT_GREY;
 
+/* Serializes the cursor and the buffer between CPUs; vga_print holds it
+   for the whole string so lines from different CPUs do not interleave */
+static spinlock_t vga_lock = SPINLOCK_INIT("vga");
+
+static inline unsigned short* vga_line(int y) {
+    int row = vga_top + y;
+    if (row >= VGA_HEIGHT) {
+        row -= VGA_HEIGHT;
+    }
+    return vga_shadow[row];
+}
+
+static void vga_fill_line(unsigned short* line) {
+    uint32_t blank = (uint32_t)' ' | ((uint32_t)current_color << 8);
+    uint32_t pair = blank | (blank << 16);
+    vga_pair_t* cells = (vga_pair_t*)line;
+    for (int i = 0; i < VGA_WIDTH / 2; i++) {
+        cells[i] = pair;
+    }
+}
+
+static void vga_update_cursor(void) {
+    int pos = cursor_y * VGA_WIDTH + cursor_x;
+    if (pos == hw_cursor) {
+        return;
+    }
+
+    outb(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_HIGH);
+    outb(VGA_CRTC_DATA, (pos >> 8) & 0xFF);
+    outb(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_LOW);
+    outb(VGA_CRTC_DATA, pos & 0xFF);
+    hw_cursor = pos;
+}
+
+/* Copy dirty lines to video memory and move the cursor (vga_lock held) */
+static void vga_flush(void) {
+    uint32_t dirty = vga_dirty;
+    vga_dirty = 0;
+
+    while (dirty != 0) {
+        int y = __builtin_ctz(dirty);
+        dirty &= dirty - 1;
+
+        const vga_pair_t* src = (const vga_pair_t*)vga_line(y);
+        volatile vga_pair_t* dst = (volatile vga_pair_t*)&vga_buffer[y * VGA_WIDTH];
+        for (int i = 0; i < VGA_WIDTH / 2; i++) {
+            dst[i] = src[i];
+        }
+    }
+
+    vga_update_cursor();
+}
+
 /* Clear the screen */
 void vga_clear_screen(void) {
-    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = (unsigned short)' ' | (current_color << 8);
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    vga_top = 0;
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        vga_fill_line(vga_shadow[y]);
     }
     cursor_x = 0;
     cursor_y = 0;
+
+    /* Underline cursor in the bottom two scan lines */
+    outb(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_START);
+    outb(VGA_CRTC_DATA, 14);
+    outb(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_END);
+    outb(VGA_CRTC_DATA, 15);
+
+    vga_dirty = VGA_ALL_DIRTY;
+    vga_flush();
+    spin_unlock_irqrestore(&vga_lock, flags);
 }
 
 /* Set text color */
@@ -27,23 +129,18 @@ void vga_set_color(unsigned char fg, unsigned char bg) {
     current_color = (bg << 4) | (fg & 0x0F);
 }
 
-/* Scroll screen up one line */
+/* Scroll screen up one line: the old top row becomes the new bottom one */
 static void vga_scroll(void) {
-    /* Move all lines up */
-    for (int i = 0; i < (VGA_HEIGHT - 1) * VGA_WIDTH; i++) {
-        vga_buffer[i] = vga_buffer[i + VGA_WIDTH];
-    }
-
-    /* Clear last line */
-    for (int i = (VGA_HEIGHT - 1) * VGA_WIDTH; i < VGA_HEIGHT * VGA_WIDTH; i++) {
-        vga_buffer[i] = (unsigned short)' ' | (current_color << 8);
-    }
+    vga_fill_line(vga_line(0));
+    vga_top = (vga_top + 1 == VGA_HEIGHT) ? 0 : vga_top + 1;
 
+    /* Every line now shows a different row */
+    vga_dirty = VGA_ALL_DIRTY;
     cursor_y = VGA_HEIGHT - 1;
 }
 
-/* Put a character at current position */
-void vga_put_char(char c) {
+/* Put a character at current position (vga_lock held) */
+static void vga_put_char_locked(char c) {
     if (c == '\n') {
         cursor_x = 0;
         cursor_y++;
@@ -53,8 +150,8 @@ void vga_put_char(char c) {
         cursor_x = (cursor_x + 8) & ~7;
     } else if (c >= ' ') {
         /* Regular character */
-        int offset = cursor_y * VGA_WIDTH + cursor_x;
-        vga_buffer[offset] = (unsigned short)c | (current_color << 8);
+        vga_line(cursor_y)[cursor_x] = (unsigned short)c | (current_color << 8);
+        vga_dirty |= 1u << cursor_y;
         cursor_x++;
     }
 
@@ -68,11 +165,26 @@ void vga_put_char(char c) {
     }
 }
 
-/* Print a null-terminated string */
+void vga_put_char(char c) {
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    vga_put_char_locked(c);
+    vga_flush();
+    spin_unlock_irqrestore(&vga_lock, flags);
+
+    char str[2] = { c, '\0' };
+    serial_console_write(str);
+}
+
+/* Print a null-terminated string, mirrored to the serial console */
 void vga_print(const char* str) {
-    while (*str) {
-        vga_put_char(*str++);
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    for (const char* p = str; *p; p++) {
+        vga_put_char_locked(*p);
     }
+    vga_flush();
+    spin_unlock_irqrestore(&vga_lock, flags);
+
+    serial_console_write(str);
 }
 
 /* Print a decimal number */
@@ -83,18 +195,16 @@ void vga_print_dec(unsigned int num) {
     }
 
     char buffer[11];
-    int i = 0;
+    int i = 10;
 
-    /* Convert number to string (reversed) */
-    while (num > 0 && i < 11) {
-        buffer[i++] = '0' + (num % 10);
+    /* Convert number to string (filled from the end) */
+    buffer[i] = '\0';
+    while (num > 0 && i > 0) {
+        buffer[--i] = '0' + (num % 10);
         num /= 10;
     }
 
-    /* Print in reverse order */
-    while (i > 0) {
-        vga_put_char(buffer[--i]);
-    }
+    vga_print(&buffer[i]);
 }
 
 /* Print a hexadecimal number */
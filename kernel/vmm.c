@@ -4,13 +4,15 @@
 #include <kernel/vmm.h>
 #include <kernel/pmm.h>
 #include <kernel/vga.h>
+#include <kernel/printk.h>
+#include <kernel/process.h>
+#include <kernel/serial.h>
+#include <kernel/string.h>
+#include <kernel/trace.h>
 
 /* Kernel page directory */
 static page_directory_t* kernel_directory;
 
-/* Current page directory */
-static page_directory_t* current_directory;
-
 /* Physical address of kernel page directory */
 static uint32_t kernel_pd_phys;
 
@@ -20,6 +22,9 @@ static uint32_t kernel_pd_phys;
 /* Physical memory mapped at kernel start */
 #define KERNEL_PHYS_BASE 0x100000
 
+/* Address range covered by one page table (one directory entry) */
+#define PAGE_TABLE_SPAN 0x400000
+
 /* Get page table index from virtual address */
 static inline uint32_t get_table_index(uint32_t virt_addr) {
     return (virt_addr >> 22) & 0x3FF;
@@ -35,6 +40,13 @@ static inline uint32_t* get_pde(page_directory_t* pd, uint32_t virt_addr) {
     return &pd->entries[get_table_index(virt_addr)];
 }
 
+/* Page directory loaded in this CPU's CR3 (each CPU runs its own process) */
+static inline page_directory_t* current_directory(void) {
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return (page_directory_t*)((cr3 & 0xFFFFF000) + KERNEL_VIRT_START);
+}
+
 /* Get page table entry */
 static inline uint32_t* get_pte(page_directory_t* pd, uint32_t virt_addr) {
     uint32_t* pde = get_pde(pd, virt_addr);
@@ -46,6 +58,42 @@ static inline uint32_t* get_pte(page_directory_t* pd, uint32_t virt_addr) {
     return &pt->entries[get_page_index(virt_addr)];
 }
 
+/* Page table for virt_addr in pd, created if needed (a table for user
+   pages also allows user access). Returns 0 when out of frames. */
+static page_table_t* get_table(page_directory_t* pd, uint32_t virt_addr,
+                               uint32_t flags) {
+    uint32_t* pde = get_pde(pd, virt_addr);
+
+    if (!(*pde & PAGE_PRESENT)) {
+        /* Allocate new page table, already cleared */
+        uint32_t pt_phys = pmm_alloc_zeroed_frame();
+        if (pt_phys == 0) {
+            return 0;
+        }
+        *pde = pt_phys | PAGE_PRESENT | PAGE_WRITE;
+    }
+
+    /* The directory entry grants everything and the table entries decide:
+       otherwise whichever page came first in the 4MB would limit the
+       rest (read-only text denying writes to the data after it) */
+    if (flags & PAGE_USER) {
+        *pde |= PAGE_USER | PAGE_WRITE;
+    }
+
+    /* Convert PDE physical address to kernel virtual address */
+    return (page_table_t*)((*pde & 0xFFFFF000) + KERNEL_VIRT_START);
+}
+
+/* Boot mappings: running out of frames this early is fatal */
+static void vmm_map_boot(uint32_t virt_addr, uint32_t phys_addr) {
+    if (vmm_map_page_in(kernel_directory, virt_addr, phys_addr,
+                        PAGE_PRESENT | PAGE_WRITE) != 0) {
+        vga_print("[-] Failed to allocate page table!\n");
+        /* Halt rather than enable paging with incomplete mappings */
+        __asm__ volatile("cli; hlt");
+    }
+}
+
 /* Initialize virtual memory manager */
 void vmm_init(void) {
     vga_print("[+] Initializing Virtual Memory Manager...\n");
@@ -57,7 +105,6 @@ void vmm_init(void) {
         return;
     }
     kernel_directory = (page_directory_t*)(kernel_pd_phys + KERNEL_VIRT_START);
-    current_directory = kernel_directory;
 
     /* Clear page directory */
     for (uint32_t i = 0; i < 1024; i++) {
@@ -66,19 +113,28 @@ void vmm_init(void) {
 
     /* Map kernel space (identity mapping for first 4MB) */
     for (uint32_t i = 0; i < 0x400000; i += PAGE_SIZE) {
-        vmm_map_page(i, i, PAGE_PRESENT | PAGE_WRITE);
+        vmm_map_boot(i, i);
     }
 
     /* Map kernel to higher half (3GB+) */
     for (uint32_t i = 0x100000; i < 0x200000; i += PAGE_SIZE) {
-        vmm_map_page(i + KERNEL_VIRT_START - KERNEL_PHYS_BASE, i,
-                     PAGE_PRESENT | PAGE_WRITE);
+        vmm_map_boot(i + KERNEL_VIRT_START - KERNEL_PHYS_BASE, i);
     }
 
     /* Map frames bitmap */
     for (uint32_t i = 0x200000; i < 0x300000; i += PAGE_SIZE) {
-        vmm_map_page(i + KERNEL_VIRT_START - KERNEL_PHYS_BASE, i,
-                     PAGE_PRESENT | PAGE_WRITE);
+        vmm_map_boot(i + KERNEL_VIRT_START - KERNEL_PHYS_BASE, i);
+    }
+
+    /* Every kernel-half page table exists from here on, and no directory
+       entry above 3GB ever changes again. Process directories copy these
+       entries once, so a table added later (heap growth, MMIO) would be
+       missing from every process created before it. 256 tables, 1MB. */
+    for (uint32_t i = 768; i < 1024; i++) {
+        if (get_table(kernel_directory, i * PAGE_TABLE_SPAN, 0) == 0) {
+            vga_print("[-] Failed to allocate kernel page tables!\n");
+            __asm__ volatile("cli; hlt");
+        }
     }
 
     /* Enable paging - use the saved physical address directly */
@@ -95,47 +151,36 @@ void vmm_init(void) {
     vga_print("    Paging enabled\n");
 }
 
-/* Map a virtual page to a physical page */
-void vmm_map_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flags) {
-    uint32_t table_idx = get_table_index(virt_addr);
-    uint32_t page_idx = get_page_index(virt_addr);
-
-    /* Check if page table exists */
-    uint32_t* pde = &current_directory->entries[table_idx];
-    page_table_t* pt;
-
-    if (!(*pde & PAGE_PRESENT)) {
-        /* Allocate new page table */
-        uint32_t pt_phys = pmm_alloc_frame();
-        if (pt_phys == 0) {
-            vga_print("[-] Failed to allocate page table!\n");
-            /* Allocation failure during page table creation is fatal during boot: halt to avoid enabling paging with incomplete mappings. */
-            __asm__ volatile("cli; hlt");
-        }
-        pt = (page_table_t*)(pt_phys + KERNEL_VIRT_START);
-
-        /* Clear page table */
-        for (uint32_t i = 0; i < 1024; i++) {
-            pt->entries[i] = 0;
-        }
+/* Map a virtual page to a physical page. Kernel-half addresses go to the
+   kernel directory, whose page tables are all created in vmm_init() and
+   shared by every process directory; mapping there cannot fail. */
+int vmm_map_page(uint32_t virt_addr, uint32_t phys_addr, uint32_t flags) {
+    page_directory_t* pd = (virt_addr >= USER_SPACE_END) ? kernel_directory :
+                                                           current_directory();
+    return vmm_map_page_in(pd, virt_addr, phys_addr, flags);
+}
 
-        /* Set page directory entry */
-        *pde = pt_phys | flags | PAGE_PRESENT;
-    } else {
-        /* Convert PDE physical address to kernel virtual address */
-        pt = (page_table_t*)(((*pde) & 0xFFFFF000) + KERNEL_VIRT_START);
+/* Map a virtual page in a given page directory */
+int vmm_map_page_in(page_directory_t* pd, uint32_t virt_addr,
+                    uint32_t phys_addr, uint32_t flags) {
+    page_table_t* pt = get_table(pd, virt_addr, flags);
+    if (pt == 0) {
+        return -1;
     }
 
     /* Map the page */
-    pt->entries[page_idx] = phys_addr | flags | PAGE_PRESENT;
+    pt->entries[get_page_index(virt_addr)] = phys_addr | flags | PAGE_PRESENT;
 
-    /* Flush TLB */
-    vmm_flush_tlb(virt_addr);
+    /* Flush TLB (other directories are not loaded on this CPU) */
+    if (pd == current_directory()) {
+        vmm_flush_tlb(virt_addr);
+    }
+    return 0;
 }
 
 /* Unmap a virtual page */
 void vmm_unmap_page(uint32_t virt_addr) {
-    uint32_t* pte = get_pte(current_directory, virt_addr);
+    uint32_t* pte = get_pte(current_directory(), virt_addr);
 
     if (pte && (*pte & PAGE_PRESENT)) {
         /* Free the frame */
@@ -151,7 +196,7 @@ void vmm_unmap_page(uint32_t virt_addr) {
 
 /* Get physical address of a virtual page */
 uint32_t vmm_get_phys_addr(uint32_t virt_addr) {
-    uint32_t* pte = get_pte(current_directory, virt_addr);
+    uint32_t* pte = get_pte(current_directory(), virt_addr);
 
     if (!pte || !(*pte & PAGE_PRESENT)) {
         return 0;
@@ -160,22 +205,318 @@ uint32_t vmm_get_phys_addr(uint32_t virt_addr) {
     return (*pte & 0xFFFFF000) + (virt_addr & 0xFFF);
 }
 
+/* Page-aligned range of count pages inside user space */
+static int user_pages_ok(uint32_t virt_addr, uint32_t count) {
+    return (virt_addr & (PAGE_SIZE - 1)) == 0 &&
+           virt_addr >= USER_SPACE_START && virt_addr < USER_SPACE_END &&
+           count <= (USER_SPACE_END - virt_addr) / PAGE_SIZE;
+}
+
+/* Page table of pd shared with the kernel directory (never edited on
+   behalf of a process) */
+static int shared_table(page_directory_t* pd, uint32_t virt_addr) {
+    uint32_t pde = *get_pde(pd, virt_addr);
+    return (pde & PAGE_PRESENT) &&
+           pde == kernel_directory->entries[get_table_index(virt_addr)];
+}
+
+/* Present user page in a table of pd's own */
+static int user_page_mapped(page_directory_t* pd, uint32_t virt_addr) {
+    uint32_t* pte = get_pte(pd, virt_addr);
+    return !shared_table(pd, virt_addr) && pte != 0 &&
+           (*pte & (PAGE_PRESENT | PAGE_USER)) == (PAGE_PRESENT | PAGE_USER);
+}
+
+/* Unmapped page outside the tables shared with the kernel */
+static int user_page_free(page_directory_t* pd, uint32_t virt_addr) {
+    uint32_t* pte = get_pte(pd, virt_addr);
+    return !shared_table(pd, virt_addr) && (pte == 0 || !(*pte & PAGE_PRESENT));
+}
+
+/* Create the user page tables a range of count pages needs, so that the
+   mapping itself cannot fail halfway. Tables left empty by a later
+   failure go with the directory. */
+static int user_tables_alloc(page_directory_t* pd, uint32_t virt_addr,
+                             uint32_t count) {
+    uint32_t end = virt_addr + count * PAGE_SIZE;
+    for (uint32_t addr = virt_addr & ~(PAGE_TABLE_SPAN - 1); addr < end;
+         addr += PAGE_TABLE_SPAN) {
+        if (get_table(pd, addr, PAGE_USER) == 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Give up the references taken on the first count source frames */
+static void unref_pages(page_directory_t* pd, uint32_t virt_addr, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        pmm_free_frame(PAGE_FRAME(*get_pte(pd, virt_addr + i * PAGE_SIZE)));
+    }
+}
+
+/* Move or share user pages between address spaces by rewriting PTEs */
+static int transfer_pages(page_directory_t* from, uint32_t from_addr,
+                          page_directory_t* to, uint32_t to_addr,
+                          uint32_t count, int share) {
+    if (!user_pages_ok(from_addr, count) || !user_pages_ok(to_addr, count)) {
+        return -1;
+    }
+
+    /* Check everything first: either all pages go or none */
+    for (uint32_t i = 0; i < count; i++) {
+        if (!user_page_mapped(from, from_addr + i * PAGE_SIZE) ||
+            !user_page_free(to, to_addr + i * PAGE_SIZE)) {
+            return -1;
+        }
+    }
+
+    if (user_tables_alloc(to, to_addr, count) != 0) {
+        return -1;
+    }
+
+    /* A shared frame gains a reference for its new mapping */
+    if (share) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t* src = get_pte(from, from_addr + i * PAGE_SIZE);
+            if (pmm_ref_frame(PAGE_FRAME(*src)) != 0) {
+                unref_pages(from, from_addr, i);
+                return -1;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t src_addr = from_addr + i * PAGE_SIZE;
+        uint32_t* src = get_pte(from, src_addr);
+        uint32_t entry = *src;
+
+        if (!share) {
+            *src = 0;
+            if (from == current_directory()) {
+                vmm_flush_tlb(src_addr);
+            }
+        }
+
+        /* The table exists, so this cannot fail */
+        vmm_map_page_in(to, to_addr + i * PAGE_SIZE, PAGE_FRAME(entry),
+                        PAGE_PRESENT | PAGE_USER | (entry & PAGE_WRITE));
+    }
+
+    return 0;
+}
+
+int vmm_move_pages(page_directory_t* from, uint32_t from_addr,
+                   page_directory_t* to, uint32_t to_addr, uint32_t count) {
+    return transfer_pages(from, from_addr, to, to_addr, count, 0);
+}
+
+int vmm_share_pages(page_directory_t* from, uint32_t from_addr,
+                    page_directory_t* to, uint32_t to_addr, uint32_t count) {
+    return transfer_pages(from, from_addr, to, to_addr, count, 1);
+}
+
+/* Map frames owned elsewhere (shared memory objects) into pd */
+int vmm_map_frames(page_directory_t* pd, uint32_t virt_addr,
+                   const uint32_t* frames, uint32_t count, uint32_t flags) {
+    if (!user_pages_ok(virt_addr, count)) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!user_page_free(pd, virt_addr + i * PAGE_SIZE)) {
+            return -1;
+        }
+    }
+
+    if (user_tables_alloc(pd, virt_addr, count) != 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (pmm_ref_frame(frames[i]) != 0) {
+            while (i-- > 0) {
+                pmm_free_frame(frames[i]);
+            }
+            return -1;
+        }
+    }
+
+    /* The tables exist, so these cannot fail */
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_map_page_in(pd, virt_addr + i * PAGE_SIZE, frames[i],
+                        (flags & PAGE_WRITE) | PAGE_PRESENT | PAGE_USER);
+    }
+
+    return 0;
+}
+
+/* Unmap user pages of pd, dropping their frame references. With frames,
+   each page must map the matching frame. */
+static int unmap_pages(page_directory_t* pd, uint32_t virt_addr,
+                       const uint32_t* frames, uint32_t count) {
+    if (!user_pages_ok(virt_addr, count)) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t addr = virt_addr + i * PAGE_SIZE;
+        if (!user_page_mapped(pd, addr)) {
+            return -1;
+        }
+        if (frames != 0 && PAGE_FRAME(*get_pte(pd, addr)) != frames[i]) {
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t addr = virt_addr + i * PAGE_SIZE;
+        uint32_t* pte = get_pte(pd, addr);
+        uint32_t frame = PAGE_FRAME(*pte);
+
+        *pte = 0;
+        if (pd == current_directory()) {
+            vmm_flush_tlb(addr);
+        }
+        pmm_free_frame(frame);
+    }
+
+    return 0;
+}
+
+int vmm_unmap_pages(page_directory_t* pd, uint32_t virt_addr, uint32_t count) {
+    return unmap_pages(pd, virt_addr, 0, count);
+}
+
+int vmm_unmap_frames(page_directory_t* pd, uint32_t virt_addr,
+                     const uint32_t* frames, uint32_t count) {
+    return unmap_pages(pd, virt_addr, frames, count);
+}
+
+/* Kernel view of a physical frame */
+void* vmm_phys_to_virt(uint32_t phys_addr) {
+    return (void*)(phys_addr + KERNEL_VIRT_START);
+}
+
+/* Whole aligned pages need no head or tail handling: a fixed rep stosd or
+   rep movsd */
+void page_zero(void* page) {
+    uint32_t count = PAGE_SIZE / 4;
+    __asm__ __volatile__("rep stosl"
+                         : "+D"(page), "+c"(count) : "a"(0) : "memory");
+}
+
+void page_zero_nt(void* page) {
+    memset_nt(page, 0, PAGE_SIZE);
+}
+
+void page_copy(void* dest, const void* src) {
+    uint32_t count = PAGE_SIZE / 4;
+    __asm__ __volatile__("rep movsl"
+                         : "+D"(dest), "+S"(src), "+c"(count) : : "memory");
+}
+
+/* Page mapped with all of need. The table entry alone decides: tables
+   holding user pages are present, writable and user in the directory. */
+static int user_page_ok(page_directory_t* pd, uint32_t virt_addr, uint32_t need) {
+    uint32_t* pte = get_pte(pd, virt_addr);
+    return pte != 0 && (*pte & need) == need;
+}
+
+/* Supervisor accesses pass any page protection, so this walk is what
+   stands between a process and kernel memory. Only the process itself
+   edits its mappings, and it is in here, so they cannot change before
+   the copy. */
+int user_access_ok(uint32_t addr, uint32_t len, int write) {
+    if (addr < USER_SPACE_START || addr >= USER_SPACE_END ||
+        len > USER_SPACE_END - addr) {
+        return 0;
+    }
+
+    uint32_t need = PAGE_PRESENT | PAGE_USER | (write ? PAGE_WRITE : 0);
+    page_directory_t* pd = current_directory();
+    uint32_t end = addr + len;
+    for (uint32_t page = addr & ~(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        if (!user_page_ok(pd, page, need)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Mark the current process as inside a user copy, so that a fault the
+   walk above failed to predict kills it rather than halting */
+static void user_copy_begin(void) {
+    process_t* proc = process_get_current();
+    if (proc != 0) {
+        proc->user_copy = 1;
+    }
+}
+
+static void user_copy_end(void) {
+    process_t* proc = process_get_current();
+    if (proc != 0) {
+        proc->user_copy = 0;
+    }
+}
+
+int copy_from_user(void* dest, uint32_t src, uint32_t len) {
+    if (!user_access_ok(src, len, 0)) {
+        return -1;
+    }
+    user_copy_begin();
+    memcpy(dest, (const void*)src, len);
+    user_copy_end();
+    return 0;
+}
+
+int copy_to_user(uint32_t dest, const void* src, uint32_t len) {
+    if (!user_access_ok(dest, len, 1)) {
+        return -1;
+    }
+    user_copy_begin();
+    memcpy((void*)dest, src, len);
+    user_copy_end();
+    return 0;
+}
+
+int copy_in_user(uint32_t dest, uint32_t src, uint32_t len) {
+    if (!user_access_ok(dest, len, 1) || !user_access_ok(src, len, 0)) {
+        return -1;
+    }
+    user_copy_begin();
+    memmove((void*)dest, (const void*)src, len);
+    user_copy_end();
+    return 0;
+}
+
+int fill_user(uint32_t dest, uint8_t value, uint32_t len) {
+    if (!user_access_ok(dest, len, 1)) {
+        return -1;
+    }
+    user_copy_begin();
+    memset((void*)dest, value, len);
+    user_copy_end();
+    return 0;
+}
+
 /* Allocate a new page directory for a process */
 page_directory_t* vmm_create_page_directory(void) {
-    /* Allocate page directory */
-    uint32_t pd_phys = pmm_alloc_frame();
+    /* Allocate page directory, already cleared */
+    uint32_t pd_phys = pmm_alloc_zeroed_frame();
     if (pd_phys == 0) {
         vga_print("[-] Failed to allocate page directory!\n");
         return 0;
     }
     page_directory_t* pd = (page_directory_t*)(pd_phys + KERNEL_VIRT_START);
 
-    /* Clear page directory */
-    for (uint32_t i = 0; i < 1024; i++) {
-        pd->entries[i] = 0;
-    }
+    /* Share the identity mapped first 4MB (kernel image, boot data); it
+       stays supervisor-only and below USER_SPACE_START, so no user pointer
+       check lets a process name it */
+    pd->entries[0] = kernel_directory->entries[0];
 
-    /* Copy kernel mappings (last 256 entries, starting at 768) */
+    /* Share the kernel half (last 256 entries, starting at 768). Its
+       tables all exist and never change, so the copy stays current. */
     for (uint32_t i = 768; i < 1024; i++) {
         pd->entries[i] = kernel_directory->entries[i];
     }
@@ -183,6 +524,31 @@ page_directory_t* vmm_create_page_directory(void) {
     return pd;
 }
 
+/* Free a process page directory (user half only; kernel tables are shared) */
+void vmm_destroy_page_directory(page_directory_t* pd) {
+    if (pd == 0 || pd == kernel_directory || pd == current_directory()) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 768; i++) {
+        uint32_t pde = pd->entries[i];
+        if (!(pde & PAGE_PRESENT) || pde == kernel_directory->entries[i]) {
+            continue;  /* absent, or a table shared with the kernel */
+        }
+
+        page_table_t* pt = (page_table_t*)((pde & 0xFFFFF000) + KERNEL_VIRT_START);
+        for (uint32_t j = 0; j < 1024; j++) {
+            if (pt->entries[j] & PAGE_PRESENT) {
+                pmm_free_frame(pt->entries[j] & 0xFFFFF000);
+            }
+        }
+
+        pmm_free_frame(pde & 0xFFFFF000);
+    }
+
+    pmm_free_frame((uint32_t)pd - KERNEL_VIRT_START);
+}
+
 /* Switch to a new page directory */
 void vmm_switch_page_directory(page_directory_t* pd) {
     if (pd == 0) {
@@ -190,20 +556,37 @@ void vmm_switch_page_directory(page_directory_t* pd) {
         return;
     }
 
-    current_directory = pd;
+    /* Switches between kernel threads keep the same directory; reloading
+       CR3 would only flush the TLB */
+    if (pd == current_directory()) {
+        return;
+    }
 
     /* Calculate physical address from virtual address */
     uint32_t pd_phys = (uint32_t)pd - KERNEL_VIRT_START;
 
     /* Load CR3 with physical address */
-    __asm__ volatile("mov %0, %%cr3" : : "r"(pd_phys));
+    __asm__ volatile("mov %0, %%cr3" : : "r"(pd_phys) : "memory");
 }
 
 /* Page fault handler */
 void vmm_page_fault_handler(uint32_t error_code) {
     uint32_t fault_addr;
     __asm__ volatile("mov %%cr2, %0" : "=r"(fault_addr));
+    TRACE(TRACE_PAGE_FAULT, fault_addr, error_code, 0, 0);
+
+    /* A bad address inside a user copy is the process's fault, not ours.
+       Copies run without locks held, so it can simply exit. */
+    process_t* proc = process_get_current();
+    if (!(error_code & PF_USER) && proc != 0 && proc->user_copy) {
+        proc->user_copy = 0;
+        kprintf(KLOG_WARN, "[-] Process %s killed by bad user access at 0x%x\n",
+                proc->name, fault_addr);
+        process_exit(-1);
+    }
 
+    /* Queued log lines first, they may explain the fault */
+    klog_flush();
     vga_print("\n[-] PAGE FAULT!\n");
     vga_print("    Fault address: 0x");
     vga_print_hex(fault_addr);
@@ -239,10 +622,106 @@ void vmm_page_fault_handler(uint32_t error_code) {
     }
 
     /* Halt the system */
+    serial_flush();
     __asm__ volatile("hlt");
 }
 
 /* Get current page directory */
 page_directory_t* vmm_get_current_directory(void) {
-    return current_directory;
+    return current_directory();
+}
+
+/* Get physical address of the kernel page directory */
+uint32_t vmm_get_kernel_directory_phys(void) {
+    return kernel_pd_phys;
+}
+
+#ifdef CONFIG_SELFTEST
+/* Mapping checks run once at boot against a scratch directory */
+
+#define SELFTEST_BASE 0x10000000
+
+static int selftest_failures;
+
+static void selftest_check(int cond, const char* what) {
+    if (!cond) {
+        kprintf(KLOG_ERR, "[-] vmm selftest: %s\n", what);
+        selftest_failures++;
+    }
+}
+
+/* A read-only page first in a 4MB region, then a writable one: the second
+   must still be writable, through both its entry and the directory's */
+static void selftest_mixed_rights(page_directory_t* pd, const uint32_t* frames) {
+    uint32_t rw = PAGE_PRESENT | PAGE_USER | PAGE_WRITE;
+
+    selftest_check(vmm_map_frames(pd, SELFTEST_BASE, &frames[0], 1, 0) == 0,
+                   "read-only map failed");
+    selftest_check(vmm_map_frames(pd, SELFTEST_BASE + PAGE_SIZE, &frames[1], 1,
+                                  PAGE_WRITE) == 0,
+                   "writable map failed");
+
+    selftest_check((*get_pde(pd, SELFTEST_BASE) & rw) == rw,
+                   "directory entry does not allow user writes");
+    selftest_check(user_page_ok(pd, SELFTEST_BASE, PAGE_PRESENT | PAGE_USER) &&
+                   !user_page_ok(pd, SELFTEST_BASE, rw),
+                   "read-only page is not read-only");
+    selftest_check(user_page_ok(pd, SELFTEST_BASE + PAGE_SIZE, rw),
+                   "writable page after a read-only one is not writable");
+
+    selftest_check(vmm_unmap_pages(pd, SELFTEST_BASE, 2) == 0, "unmap failed");
+}
+
+/* Unmapping by frame list refuses pages that map other frames */
+static void selftest_unmap_frames(page_directory_t* pd, const uint32_t* frames) {
+    uint32_t swapped[2] = { frames[1], frames[0] };
+
+    selftest_check(vmm_map_frames(pd, SELFTEST_BASE, frames, 2, PAGE_WRITE) == 0,
+                   "map failed");
+    selftest_check(vmm_unmap_frames(pd, SELFTEST_BASE, swapped, 2) != 0 &&
+                   user_page_mapped(pd, SELFTEST_BASE) &&
+                   user_page_mapped(pd, SELFTEST_BASE + PAGE_SIZE),
+                   "unmap of foreign frames succeeded");
+    selftest_check(vmm_unmap_frames(pd, SELFTEST_BASE, frames, 2) == 0,
+                   "unmap of own frames failed");
+}
+
+/* Every kernel-half table is present and is the kernel directory's own */
+static void selftest_kernel_half(page_directory_t* pd) {
+    for (uint32_t i = 768; i < 1024; i++) {
+        uint32_t pde = pd->entries[i];
+        if (!(pde & PAGE_PRESENT) || pde != kernel_directory->entries[i]) {
+            selftest_check(0, "kernel-half table not shared");
+            return;
+        }
+    }
+}
+
+void vmm_selftest(void) {
+    uint32_t frames[2] = { pmm_alloc_zeroed_frame(), pmm_alloc_zeroed_frame() };
+    page_directory_t* pd = vmm_create_page_directory();
+
+    selftest_failures = 0;
+    if (pd == 0 || frames[0] == 0 || frames[1] == 0) {
+        kprintf(KLOG_ERR, "[-] vmm selftest: out of memory\n");
+        selftest_failures++;
+    } else {
+        selftest_kernel_half(pd);
+        selftest_mixed_rights(pd, frames);
+        selftest_unmap_frames(pd, frames);
+    }
+
+    if (pd != 0) {
+        vmm_destroy_page_directory(pd);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        if (frames[i] != 0) {
+            pmm_free_frame(frames[i]);
+        }
+    }
+
+    kprintf(selftest_failures ? KLOG_ERR : KLOG_INFO,
+            "[%c] vmm selftest: %d failed checks\n",
+            selftest_failures ? '-' : '+', selftest_failures);
 }
+#endif
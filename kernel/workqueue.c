@@ -0,0 +1,138 @@
+/* SYNAPSE SO - Workqueues */
+/* Licensed under GPLv3 */
+
+#include <kernel/workqueue.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <kernel/string.h>
+#include <kernel/vga.h>
+
+static workqueue_t workqueues[WORKQUEUE_MAX];
+
+/* Protects workqueue creation */
+static spinlock_t workqueues_lock = SPINLOCK_INIT("workqueues");
+
+/* Shared workqueue behind schedule_work() */
+static workqueue_t* events_wq = 0;
+
+/* A worker finds its workqueue by its own name, which is set before the
+   thread is created */
+static workqueue_t* workqueue_find_own(process_t* self) {
+    for (uint32_t i = 0; i < WORKQUEUE_MAX; i++) {
+        if (workqueues[i].in_use && strcmp(workqueues[i].name, self->name) == 0) {
+            return &workqueues[i];
+        }
+    }
+    return 0;
+}
+
+static void worker_thread(void) {
+    process_t* self = process_get_current();
+    workqueue_t* wq = workqueue_find_own(self);
+    if (wq == 0) {
+        process_exit(-1);
+    }
+
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&wq->lock);
+        wq->thread = self;
+
+        work_t* work = wq->head;
+        if (work == 0) {
+            /* Sleep until queue_work() wakes us */
+            self->state = PROC_STATE_BLOCKED;
+            spin_unlock(&wq->lock);
+            schedule();
+            irq_restore(flags);
+            continue;
+        }
+
+        wq->head = work->next;
+        if (wq->head == 0) {
+            wq->tail = 0;
+        }
+        work->next = 0;
+
+        /* Cleared before it runs, so the work may queue itself again */
+        work->pending = 0;
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        work->func(work);
+    }
+}
+
+workqueue_t* workqueue_create(const char* name) {
+    uint32_t flags = spin_lock_irqsave(&workqueues_lock);
+
+    workqueue_t* wq = 0;
+    for (uint32_t i = 0; i < WORKQUEUE_MAX; i++) {
+        if (workqueues[i].in_use && strcmp(workqueues[i].name, name) == 0) {
+            wq = 0;
+            break;
+        }
+        if (!workqueues[i].in_use && wq == 0) {
+            wq = &workqueues[i];
+        }
+    }
+
+    if (wq != 0) {
+        strncpy(wq->name, name, 31);
+        wq->name[31] = '\0';
+        spin_lock_init(&wq->lock, "workqueue");
+        wq->head = wq->tail = 0;
+        wq->thread = 0;
+        wq->in_use = 1;
+    }
+
+    spin_unlock_irqrestore(&workqueues_lock, flags);
+
+    if (wq == 0) {
+        return 0;
+    }
+
+    if (process_create(wq->name, PROC_FLAG_KERNEL | PROC_FLAG_DETACHED,
+                       worker_thread) == 0) {
+        wq->in_use = 0;
+        return 0;
+    }
+    return wq;
+}
+
+int queue_work(workqueue_t* wq, work_t* work) {
+    if (__sync_lock_test_and_set(&work->pending, 1)) {
+        return 0;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    work->next = 0;
+    if (wq->tail != 0) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+
+    process_t* thread = wq->thread;
+    if (thread != 0 && thread->state == PROC_STATE_BLOCKED) {
+        thread->state = PROC_STATE_READY;
+        scheduler_add_process(thread);
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return 1;
+}
+
+int schedule_work(work_t* work) {
+    if (events_wq == 0) {
+        return 0;
+    }
+    return queue_work(events_wq, work);
+}
+
+void workqueue_init(void) {
+    events_wq = workqueue_create("events");
+    if (events_wq == 0) {
+        vga_print("[-] Failed to start the events workqueue\n");
+    }
+}
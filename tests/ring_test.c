@@ -0,0 +1,480 @@
+/* SYNAPSE SO - Ring Buffer Host Tests */
+/* Licensed under GPLv3 */
+
+/* Runs kernel/lib/ring.c as an ordinary program (make test): batch
+ * enqueue/dequeue across the wrap of both the slot array and the 32-bit
+ * indices, the full and empty boundaries, and producers on several
+ * threads racing one consumer. "ring_test bench" measures throughput
+ * instead. Exits non-zero if any check fails. */
+
+#include <kernel/ring.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A broken ring tends to livelock the threaded tests rather than fail a
+   check; SIGALRM then ends the run with a failure status */
+#define TEST_TIMEOUT_SECONDS 60
+
+static int failures;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+/* Start an empty ring at index start, so that the free running indices
+   wrap at 2^32 during the test */
+static void spsc_start_at(ring_spsc_t* ring, uint32_t start) {
+    ring->head = ring->tail_cache = start;
+    ring->tail = ring->head_cache = start;
+}
+
+static void mpsc_start_at(ring_mpsc_t* ring, uint32_t start) {
+    uint32_t size = ring->mask + 1;
+    for (uint32_t i = 0; i < size; i++) {
+        uint32_t pos = start + i;
+        ring->slots[pos & ring->mask].seq = pos;
+    }
+    ring->head = ring->tail = start;
+}
+
+/* ------------------------------------------------------------------------
+ * Single-threaded boundaries and wrap-around
+ * ------------------------------------------------------------------------ */
+
+static void test_spsc_boundaries(void) {
+    ring_spsc_t ring;
+    uint32_t slots[8];
+    uint32_t in[16], out[16];
+
+    CHECK(ring_spsc_init(&ring, slots, 0) == -1);
+    CHECK(ring_spsc_init(&ring, slots, 6) == -1);
+    CHECK(ring_spsc_init(&ring, slots, 8) == 0);
+
+    for (uint32_t i = 0; i < 16; i++) {
+        in[i] = 100 + i;
+    }
+
+    /* Empty */
+    CHECK(ring_spsc_dequeue(&ring, out, 1) == 0);
+    CHECK(ring_spsc_count(&ring) == 0);
+
+    /* Filling past the end takes what fits, then nothing */
+    CHECK(ring_spsc_enqueue(&ring, in, 5) == 5);
+    CHECK(ring_spsc_enqueue(&ring, in + 5, 5) == 3);
+    CHECK(ring_spsc_count(&ring) == 8);
+    CHECK(ring_spsc_enqueue(&ring, in, 1) == 0);
+
+    /* Draining returns everything in order, then nothing */
+    CHECK(ring_spsc_dequeue(&ring, out, 3) == 3);
+    CHECK(ring_spsc_dequeue(&ring, out + 3, 16) == 5);
+    for (uint32_t i = 0; i < 8; i++) {
+        CHECK(out[i] == 100 + i);
+    }
+    CHECK(ring_spsc_dequeue(&ring, out, 16) == 0);
+    CHECK(ring_spsc_count(&ring) == 0);
+
+    /* Zero-length batches are no-ops */
+    CHECK(ring_spsc_enqueue(&ring, in, 0) == 0);
+    CHECK(ring_spsc_dequeue(&ring, out, 0) == 0);
+
+    /* A one-slot ring is full after one entry */
+    CHECK(ring_spsc_init(&ring, slots, 1) == 0);
+    CHECK(ring_spsc_enqueue(&ring, in, 2) == 1);
+    CHECK(ring_spsc_enqueue(&ring, in, 1) == 0);
+    CHECK(ring_spsc_dequeue(&ring, out, 2) == 1 && out[0] == in[0]);
+}
+
+/* Batches of every size from 1 to more than the ring, mixed so that the
+   queue length drifts and each boundary is hit at every offset */
+static void test_spsc_wrap(uint32_t start) {
+    ring_spsc_t ring;
+    uint32_t slots[16];
+    uint32_t in[24], out[24];
+    uint32_t next_in = 0, next_out = 0;
+
+    ring_spsc_init(&ring, slots, 16);
+    spsc_start_at(&ring, start);
+
+    for (uint32_t round = 0; round < 2000; round++) {
+        uint32_t want = 1 + round % 23;
+        for (uint32_t i = 0; i < want; i++) {
+            in[i] = next_in + i;
+        }
+        uint32_t queued = ring_spsc_count(&ring);
+        uint32_t n = ring_spsc_enqueue(&ring, in, want);
+        CHECK(n == (want < 16 - queued ? want : 16 - queued));
+        next_in += n;
+
+        want = 1 + (round * 7) % 19;
+        queued = ring_spsc_count(&ring);
+        n = ring_spsc_dequeue(&ring, out, want);
+        CHECK(n == (want < queued ? want : queued));
+        for (uint32_t i = 0; i < n; i++) {
+            CHECK(out[i] == next_out + i);
+        }
+        next_out += n;
+    }
+
+    for (uint32_t i = 0; i < 16 && ring_spsc_dequeue(&ring, out, 1) == 1; i++) {
+        CHECK(out[0] == next_out);
+        next_out++;
+    }
+    CHECK(next_out == next_in);
+}
+
+static void test_mpsc_boundaries(void) {
+    ring_mpsc_t ring;
+    ring_mpsc_slot_t slots[8];
+    uint32_t in[16], out[16];
+
+    CHECK(ring_mpsc_init(&ring, slots, 0) == -1);
+    CHECK(ring_mpsc_init(&ring, slots, 12) == -1);
+    CHECK(ring_mpsc_init(&ring, slots, 8) == 0);
+
+    for (uint32_t i = 0; i < 16; i++) {
+        in[i] = 200 + i;
+    }
+
+    CHECK(ring_mpsc_dequeue(&ring, out, 1) == 0);
+    CHECK(ring_mpsc_count(&ring) == 0);
+
+    /* enqueue takes what fits, enqueue_all all or nothing */
+    CHECK(ring_mpsc_enqueue(&ring, in, 6) == 6);
+    CHECK(ring_mpsc_enqueue_all(&ring, in + 6, 3) == 0);
+    CHECK(ring_mpsc_count(&ring) == 6);
+    CHECK(ring_mpsc_enqueue_all(&ring, in + 6, 2) == 2);
+    CHECK(ring_mpsc_enqueue(&ring, in, 1) == 0);
+    CHECK(ring_mpsc_enqueue_all(&ring, in, 1) == 0);
+    CHECK(ring_mpsc_count(&ring) == 8);
+
+    CHECK(ring_mpsc_dequeue(&ring, out, 16) == 8);
+    for (uint32_t i = 0; i < 8; i++) {
+        CHECK(out[i] == 200 + i);
+    }
+    CHECK(ring_mpsc_dequeue(&ring, out, 16) == 0);
+    CHECK(ring_mpsc_enqueue_all(&ring, in, 8) == 8);
+    CHECK(ring_mpsc_dequeue(&ring, out, 16) == 8);
+
+    /* A claimed slot that is not yet published stops the consumer, even
+       with later slots ready */
+    CHECK(ring_mpsc_enqueue(&ring, in, 3) == 3);
+    uint32_t pos = ring.head + 1;
+    ring_mpsc_slot_t* slot = &slots[pos & ring.mask];
+    slot->seq = pos;
+    CHECK(ring_mpsc_dequeue(&ring, out, 3) == 1 && out[0] == in[0]);
+    CHECK(ring_mpsc_dequeue(&ring, out, 3) == 0);
+    CHECK(ring_mpsc_count(&ring) == 2);
+    slot->seq = pos + 1;
+    CHECK(ring_mpsc_dequeue(&ring, out, 3) == 2);
+    CHECK(out[0] == in[1] && out[1] == in[2]);
+}
+
+static void test_mpsc_wrap(uint32_t start) {
+    ring_mpsc_t ring;
+    ring_mpsc_slot_t slots[16];
+    uint32_t in[24], out[24];
+    uint32_t next_in = 0, next_out = 0;
+
+    ring_mpsc_init(&ring, slots, 16);
+    mpsc_start_at(&ring, start);
+
+    for (uint32_t round = 0; round < 2000; round++) {
+        uint32_t want = 1 + round % 23;
+        for (uint32_t i = 0; i < want; i++) {
+            in[i] = next_in + i;
+        }
+        uint32_t queued = ring_mpsc_count(&ring);
+        uint32_t space = 16 - queued;
+        uint32_t n;
+        if (round & 1) {
+            n = ring_mpsc_enqueue_all(&ring, in, want);
+            CHECK(n == (want <= space ? want : 0));
+        } else {
+            n = ring_mpsc_enqueue(&ring, in, want);
+            CHECK(n == (want < space ? want : space));
+        }
+        next_in += n;
+
+        want = 1 + (round * 7) % 19;
+        queued = ring_mpsc_count(&ring);
+        n = ring_mpsc_dequeue(&ring, out, want);
+        CHECK(n == (want < queued ? want : queued));
+        for (uint32_t i = 0; i < n; i++) {
+            CHECK(out[i] == next_out + i);
+        }
+        next_out += n;
+    }
+
+    for (uint32_t i = 0; i < 16 && ring_mpsc_dequeue(&ring, out, 1) == 1; i++) {
+        CHECK(out[0] == next_out);
+        next_out++;
+    }
+    CHECK(next_out == next_in);
+}
+
+/* ------------------------------------------------------------------------
+ * Producers on several threads against one consumer. Each entry carries
+ * its producer in the top byte and a per-producer sequence number below,
+ * so the consumer can check that nothing is lost, duplicated or
+ * reordered within a producer.
+ * ------------------------------------------------------------------------ */
+
+#define STRESS_PRODUCERS    4
+#define STRESS_ITEMS        200000      /* per producer, below 2^24 */
+#define STRESS_RING_SIZE    64          /* small, so producers hit full */
+
+typedef struct {
+    ring_spsc_t* spsc;
+    ring_mpsc_t* mpsc;
+    uint32_t id;
+    uint32_t items;
+} producer_t;
+
+static void* spsc_producer(void* arg) {
+    producer_t* p = arg;
+    uint32_t batch[8];
+    uint32_t sent = 0;
+
+    while (sent < p->items) {
+        uint32_t want = 1 + sent % 8;
+        if (want > p->items - sent) {
+            want = p->items - sent;
+        }
+        for (uint32_t i = 0; i < want; i++) {
+            batch[i] = sent + i;
+        }
+        uint32_t n = ring_spsc_enqueue(p->spsc, batch, want);
+        if (n == 0) {
+            sched_yield();
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+static void* mpsc_producer(void* arg) {
+    producer_t* p = arg;
+    uint32_t batch[8];
+    uint32_t sent = 0;
+
+    while (sent < p->items) {
+        uint32_t want = 1 + (sent + p->id) % 8;
+        if (want > p->items - sent) {
+            want = p->items - sent;
+        }
+        for (uint32_t i = 0; i < want; i++) {
+            batch[i] = (p->id << 24) | (sent + i);
+        }
+        uint32_t n = (sent & 1) ?
+            ring_mpsc_enqueue_all(p->mpsc, batch, want) :
+            ring_mpsc_enqueue(p->mpsc, batch, want);
+        if (n == 0) {
+            sched_yield();
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+static void test_spsc_threads(void) {
+    static ring_spsc_t ring;
+    static uint32_t slots[STRESS_RING_SIZE];
+    producer_t producer = { &ring, 0, 0, STRESS_ITEMS };
+    pthread_t thread;
+    uint32_t out[16];
+    uint32_t expect = 0;
+
+    ring_spsc_init(&ring, slots, STRESS_RING_SIZE);
+    spsc_start_at(&ring, 0u - STRESS_ITEMS / 2);
+    pthread_create(&thread, 0, spsc_producer, &producer);
+
+    while (expect < STRESS_ITEMS) {
+        uint32_t n = ring_spsc_dequeue(&ring, out, 1 + expect % 16);
+        if (n == 0) {
+            sched_yield();
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (out[i] != expect + i) {
+                CHECK(out[i] == expect + i);
+                expect = STRESS_ITEMS;
+                break;
+            }
+        }
+        expect += n;
+    }
+
+    pthread_join(thread, 0);
+    CHECK(ring_spsc_count(&ring) == 0);
+}
+
+static void test_mpsc_threads(void) {
+    static ring_mpsc_t ring;
+    static ring_mpsc_slot_t slots[STRESS_RING_SIZE];
+    producer_t producers[STRESS_PRODUCERS];
+    pthread_t threads[STRESS_PRODUCERS];
+    uint32_t next[STRESS_PRODUCERS] = { 0 };
+    uint32_t out[16];
+    uint32_t total = 0;
+    int bad = 0;
+
+    ring_mpsc_init(&ring, slots, STRESS_RING_SIZE);
+    mpsc_start_at(&ring, 0u - STRESS_ITEMS);
+    for (uint32_t i = 0; i < STRESS_PRODUCERS; i++) {
+        producers[i] = (producer_t){ 0, &ring, i, STRESS_ITEMS };
+        pthread_create(&threads[i], 0, mpsc_producer, &producers[i]);
+    }
+
+    while (total < STRESS_PRODUCERS * STRESS_ITEMS && !bad) {
+        uint32_t n = ring_mpsc_dequeue(&ring, out, 1 + total % 16);
+        if (n == 0) {
+            sched_yield();
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t id = out[i] >> 24;
+            if (id >= STRESS_PRODUCERS || (out[i] & 0xFFFFFF) != next[id]) {
+                printf("entry 0x%08x out of order\n", out[i]);
+                bad = 1;
+                break;
+            }
+            next[id]++;
+        }
+        total += n;
+    }
+    CHECK(!bad);
+
+    for (uint32_t i = 0; i < STRESS_PRODUCERS; i++) {
+        pthread_join(threads[i], 0);
+        CHECK(bad || next[i] == STRESS_ITEMS);
+    }
+    CHECK(bad || ring_mpsc_count(&ring) == 0);
+}
+
+/* ------------------------------------------------------------------------
+ * Throughput: entries per second through a ring between threads, by
+ * batch size
+ * ------------------------------------------------------------------------ */
+
+#define BENCH_ITEMS         (1u << 24)
+#define BENCH_RING_SIZE     1024
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t bench_batch;
+
+static void* bench_spsc_producer(void* arg) {
+    ring_spsc_t* ring = arg;
+    uint32_t batch[64] = { 0 };
+
+    for (uint32_t sent = 0; sent < BENCH_ITEMS; ) {
+        uint32_t n = ring_spsc_enqueue(ring, batch, bench_batch);
+        if (n == 0) {
+            sched_yield();
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+static void* bench_mpsc_producer(void* arg) {
+    producer_t* p = arg;
+    uint32_t batch[64] = { 0 };
+
+    for (uint32_t sent = 0; sent < p->items; ) {
+        uint32_t n = ring_mpsc_enqueue(p->mpsc, batch, bench_batch);
+        if (n == 0) {
+            sched_yield();
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+/* Drain total entries in batches; returns the elapsed seconds */
+static double bench_drain(ring_spsc_t* spsc, ring_mpsc_t* mpsc, uint32_t total,
+                          double start) {
+    uint32_t out[64];
+
+    for (uint32_t got = 0; got < total; ) {
+        uint32_t n = spsc ? ring_spsc_dequeue(spsc, out, bench_batch) :
+                            ring_mpsc_dequeue(mpsc, out, bench_batch);
+        if (n == 0) {
+            sched_yield();
+        }
+        got += n;
+    }
+    return now() - start;
+}
+
+static void bench(void) {
+    static ring_spsc_t spsc;
+    static uint32_t spsc_slots[BENCH_RING_SIZE];
+    static ring_mpsc_t mpsc;
+    static ring_mpsc_slot_t mpsc_slots[BENCH_RING_SIZE];
+    static const uint32_t batches[] = { 1, 8, 32, 64 };
+
+    printf("%-6s %9s %6s %12s\n", "ring", "producers", "batch", "Mentries/s");
+
+    for (uint32_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+        pthread_t threads[STRESS_PRODUCERS];
+        bench_batch = batches[b];
+
+        ring_spsc_init(&spsc, spsc_slots, BENCH_RING_SIZE);
+        double start = now();
+        pthread_create(&threads[0], 0, bench_spsc_producer, &spsc);
+        double secs = bench_drain(&spsc, 0, BENCH_ITEMS, start);
+        pthread_join(threads[0], 0);
+        printf("%-6s %9u %6u %12.1f\n", "spsc", 1u, bench_batch,
+               BENCH_ITEMS / secs / 1e6);
+
+        for (uint32_t count = 1; count <= STRESS_PRODUCERS; count *= 2) {
+            producer_t producers[STRESS_PRODUCERS];
+            ring_mpsc_init(&mpsc, mpsc_slots, BENCH_RING_SIZE);
+            start = now();
+            for (uint32_t i = 0; i < count; i++) {
+                producers[i] = (producer_t){ 0, &mpsc, i, BENCH_ITEMS / count };
+                pthread_create(&threads[i], 0, bench_mpsc_producer, &producers[i]);
+            }
+            secs = bench_drain(0, &mpsc, BENCH_ITEMS / count * count, start);
+            for (uint32_t i = 0; i < count; i++) {
+                pthread_join(threads[i], 0);
+            }
+            printf("%-6s %9u %6u %12.1f\n", "mpsc", count, bench_batch,
+                   BENCH_ITEMS / count * count / secs / 1e6);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, 0, _IOLBF, 0);
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+        return 0;
+    }
+
+    alarm(TEST_TIMEOUT_SECONDS);
+    test_spsc_boundaries();
+    test_spsc_wrap(0);
+    test_spsc_wrap(0xFFFFFF00u);
+    test_mpsc_boundaries();
+    test_mpsc_wrap(0);
+    test_mpsc_wrap(0xFFFFFF00u);
+    test_spsc_threads();
+    test_mpsc_threads();
+
+    printf("ring_test: %s (%d failed checks)\n", failures ? "FAIL" : "ok",
+           failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
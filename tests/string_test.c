@@ -0,0 +1,326 @@
+/* SYNAPSE SO - String Library Host Tests */
+/* Licensed under GPLv3 */
+
+/* Runs kernel/lib/string.c as a 32-bit Linux program (make test). It is
+ * built like the kernel, without libc: the library's memcpy and friends
+ * would replace libc's anyway, and its inline assembly is 32-bit only.
+ * The checks compare memcpy, memcpy_nt, memset, memset_nt, memmove and
+ * memcmp against byte loops for every size from 0 to 200 at every source
+ * and destination alignment, with overlapping moves in both directions,
+ * once on the baseline dword paths and once on what string_init() picks
+ * for this CPU. "string_test bench" times them across sizes and
+ * alignments instead. Exits non-zero if any check fails. */
+
+#include <stdint.h>
+#include <kernel/cpu.h>
+#include <kernel/string.h>
+
+/* ------------------------------------------------------------------------
+ * Just enough of a runtime: entry point, write(2) and exit(2)
+ * ------------------------------------------------------------------------ */
+
+__asm__(".globl _start\n"
+        "_start:\n\t"
+        "push %esp\n\t"
+        "call start_main\n");
+
+static void sys_exit(int code) {
+    __asm__ __volatile__("int $0x80" : : "a"(1), "b"(code));
+    while (1) {
+    }
+}
+
+static void put_str(const char* s) {
+    int32_t ret;
+    __asm__ __volatile__("int $0x80"
+                         : "=a"(ret)
+                         : "a"(4), "b"(1), "c"(s), "d"(strlen(s))
+                         : "memory");
+    (void)ret;
+}
+
+/* Unsigned decimal, right-aligned in width */
+static void put_dec(uint32_t value, int width) {
+    char buf[12];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = (char)('0' + value % 10);
+        value /= 10;
+        width--;
+    } while (value != 0);
+    while (width-- > 0) {
+        buf[--i] = ' ';
+    }
+    put_str(&buf[i]);
+}
+
+/* ------------------------------------------------------------------------
+ * Correctness
+ * ------------------------------------------------------------------------ */
+
+#define MAX_SIZE    200
+#define MAX_ALIGN   8
+#define BUF_SIZE    512
+#define GUARD       0xEE
+
+static uint8_t pattern[BUF_SIZE];
+static uint8_t buf[BUF_SIZE];
+static uint8_t ref[BUF_SIZE];
+static int failures;
+
+static void fail(const char* what, uint32_t size, uint32_t dst, uint32_t src) {
+    if (failures++ < 20) {
+        put_str("string_test: ");
+        put_str(what);
+        put_str(" size ");
+        put_dec(size, 0);
+        put_str(" dst ");
+        put_dec(dst, 0);
+        put_str(" src ");
+        put_dec(src, 0);
+        put_str("\n");
+    }
+}
+
+/* Reference copy through a temporary, so it is right for any overlap.
+   The empty asm keeps the compiler from turning the loops into calls to
+   the functions under test. */
+static void ref_move(uint8_t* dest, const uint8_t* src, uint32_t n) {
+    uint8_t tmp[BUF_SIZE];
+    for (uint32_t i = 0; i < n; i++) {
+        tmp[i] = src[i];
+        __asm__ __volatile__("");
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        dest[i] = tmp[i];
+        __asm__ __volatile__("");
+    }
+}
+
+static void fill(uint8_t* p, uint8_t value) {
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        p[i] = value;
+        __asm__ __volatile__("");
+    }
+}
+
+static int same(void) {
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        if (buf[i] != ref[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int sign(int v) {
+    return (v > 0) - (v < 0);
+}
+
+static void check_copies(uint32_t n, uint32_t dst, uint32_t src) {
+    /* Destinations start inside the guard bytes, so an overrun either
+       way shows up */
+    uint8_t* d = buf + 64 + dst;
+    uint8_t* r = ref + 64 + dst;
+    const uint8_t* s = pattern + src;
+
+    fill(buf, GUARD);
+    fill(ref, GUARD);
+    ref_move(r, s, n);
+    if (memcpy(d, s, n) != d || !same()) {
+        fail("memcpy", n, dst, src);
+    }
+
+    fill(buf, GUARD);
+    if (memcpy_nt(d, s, n) != d || !same()) {
+        fail("memcpy_nt", n, dst, src);
+    }
+
+    fill(buf, GUARD);
+    if (memmove(d, s, n) != d || !same()) {
+        fail("memmove", n, dst, src);
+    }
+
+    /* Only the low byte of the value counts */
+    fill(buf, GUARD);
+    fill(ref, GUARD);
+    for (uint32_t i = 0; i < n; i++) {
+        r[i] = 0x5A;
+    }
+    if (memset(d, 0x35A, n) != d || !same()) {
+        fail("memset", n, dst, src);
+    }
+
+    fill(buf, GUARD);
+    if (memset_nt(d, 0x35A, n) != d || !same()) {
+        fail("memset_nt", n, dst, src);
+    }
+}
+
+/* Overlapping moves within one buffer, the destination below the source
+   (forward copy) and above it (backward copy), by a few distances */
+static void check_overlap(uint32_t n, uint32_t dst, uint32_t src) {
+    static const int32_t shifts[] = { -33, -9, -4, -1, 1, 4, 9, 33 };
+
+    for (uint32_t i = 0; i < sizeof(shifts) / sizeof(shifts[0]); i++) {
+        uint8_t* s = buf + 128 + src;
+        uint8_t* d = buf + 128 + dst + shifts[i];
+
+        ref_move(buf, pattern, BUF_SIZE);
+        ref_move(ref, pattern, BUF_SIZE);
+        ref_move(ref + (d - buf), ref + (s - buf), n);
+        if (memmove(d, s, n) != d || !same()) {
+            fail(shifts[i] < 0 ? "memmove down" : "memmove up", n, dst, src);
+        }
+    }
+}
+
+static void check_compare(uint32_t n, uint32_t a_off, uint32_t b_off) {
+    const uint8_t* a = pattern + a_off;
+    uint8_t* b = buf + 64 + b_off;
+
+    ref_move(b, a, n);
+    if (memcmp(a, b, n) != 0) {
+        fail("memcmp equal", n, b_off, a_off);
+    }
+
+    /* A difference at each end, either way round; bytes compare
+       unsigned */
+    if (n != 0) {
+        uint32_t where[2] = { 0, n - 1 };
+        for (uint32_t i = 0; i < 2; i++) {
+            uint8_t saved = b[where[i]];
+            b[where[i]] = (uint8_t)(a[where[i]] ^ 0x80);
+            int expect = sign(a[where[i]] - b[where[i]]);
+            if (sign(memcmp(a, b, n)) != expect ||
+                sign(memcmp(b, a, n)) != -expect) {
+                fail("memcmp differ", n, b_off, a_off);
+            }
+            b[where[i]] = saved;
+        }
+    }
+}
+
+static void run_checks(void) {
+    for (uint32_t n = 0; n <= MAX_SIZE; n++) {
+        for (uint32_t dst = 0; dst < MAX_ALIGN; dst++) {
+            for (uint32_t src = 0; src < MAX_ALIGN; src++) {
+                check_copies(n, dst, src);
+                check_overlap(n, dst, src);
+                check_compare(n, dst, src);
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------
+ * Benchmark: cycles per call, best of several runs, against a byte loop
+ * ------------------------------------------------------------------------ */
+
+#define BENCH_BUF   (256 * 1024 + 64)
+#define BENCH_RUNS  16
+
+static uint8_t bench_src[BENCH_BUF] __attribute__((aligned(64)));
+static uint8_t bench_dst[BENCH_BUF] __attribute__((aligned(64)));
+
+enum { OP_BYTES, OP_MEMCPY, OP_MEMCPY_NT, OP_MEMMOVE, OP_MEMSET, OP_MEMSET_NT, OP_COUNT };
+
+static const char* const op_names[OP_COUNT] = {
+    "bytes", "memcpy", "memcpy_nt", "memmove", "memset", "memset_nt"
+};
+
+static void byte_copy(uint8_t* dest, const uint8_t* src, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        dest[i] = src[i];
+        __asm__ __volatile__("");
+    }
+}
+
+static uint32_t bench_one(int op, uint32_t n, uint32_t dst, uint32_t src) {
+    uint8_t* d = bench_dst + dst;
+    const uint8_t* s = bench_src + src;
+    uint32_t reps = n < 4096 ? 64 : 1;
+    uint64_t best = ~0ull;
+
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+        uint64_t start = rdtsc();
+        for (uint32_t i = 0; i < reps; i++) {
+            switch (op) {
+                case OP_BYTES:      byte_copy(d, s, n); break;
+                case OP_MEMCPY:     memcpy(d, s, n); break;
+                case OP_MEMCPY_NT:  memcpy_nt(d, s, n); break;
+                case OP_MEMMOVE:    memmove(d, s, n); break;
+                case OP_MEMSET:     memset(d, 0x5A, n); break;
+                case OP_MEMSET_NT:  memset_nt(d, 0x5A, n); break;
+            }
+        }
+        uint64_t cycles = rdtsc() - start;
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    return (uint32_t)best / reps;   /* no 64-bit division without libgcc */
+}
+
+static void bench(void) {
+    static const uint32_t sizes[] = { 8, 64, 256, 1024, 4096, 65536, 262144 };
+    static const uint32_t aligns[][2] = { { 0, 0 }, { 1, 0 }, { 0, 3 }, { 5, 3 } };
+
+    put_str("ERMS: ");
+    put_str(string_has_erms() ? "yes" : "no");
+    put_str(", movnti: ");
+    put_str(string_has_movnti() ? "yes" : "no");
+    put_str("\ncycles per call (dst/src misalignment)\n");
+
+    put_str("     size dst src");
+    for (int op = 0; op < OP_COUNT; op++) {
+        put_str(" ");
+        uint32_t len = strlen(op_names[op]);
+        for (uint32_t i = len; i < 10; i++) {
+            put_str(" ");
+        }
+        put_str(op_names[op]);
+    }
+    put_str("\n");
+
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (uint32_t j = 0; j < sizeof(aligns) / sizeof(aligns[0]); j++) {
+            put_dec(sizes[i], 9);
+            put_dec(aligns[j][0], 4);
+            put_dec(aligns[j][1], 4);
+            for (int op = 0; op < OP_COUNT; op++) {
+                put_dec(bench_one(op, sizes[i], aligns[j][0], aligns[j][1]), 11);
+            }
+            put_str("\n");
+        }
+    }
+}
+
+void start_main(uint32_t* sp) {
+    uint32_t argc = sp[0];
+    char** argv = (char**)(sp + 1);
+
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        pattern[i] = (uint8_t)(i * 7 + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        string_init();
+        bench();
+        sys_exit(0);
+    }
+
+    /* Before string_init() the baseline paths run; after it, the ones
+       chosen for this CPU */
+    run_checks();
+    string_init();
+    run_checks();
+
+    put_str("string_test: ");
+    put_str(failures ? "FAIL (" : "ok (");
+    put_dec((uint32_t)failures, 0);
+    put_str(" failed checks)\n");
+    sys_exit(failures ? 1 : 0);
+}
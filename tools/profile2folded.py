@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# SYNAPSE SO - Profile Symbolizer
+# Licensed under GPLv3
+"""Turn a profiler dump captured from COM1 into folded stacks.
+
+Build with `make PROFILE=1`, run with `make run` (COM1 goes to serial.log),
+then:
+
+    tools/profile2folded.py serial.log > kernel.folded
+    flamegraph.pl kernel.folded > kernel.svg
+
+The folded format (one "outer;...;inner count" line per distinct stack)
+is also read by speedscope and Perfetto. Addresses are mapped to function
+names with the symbol table of build/kernel.elf, read through nm. Samples
+taken in ring 3 are counted as [user]. When the log holds several dumps
+the last one is used.
+"""
+
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+# kernel/include/kernel/profile.h
+PROFILE_SAMPLE_USER = 1 << 0
+
+
+class Symbols:
+    def __init__(self, elf, nm):
+        output = subprocess.run([nm, "-n", "--defined-only", elf],
+                                check=True, capture_output=True,
+                                text=True).stdout
+        self.addrs = []
+        self.names = []
+        for line in output.splitlines():
+            fields = line.split()
+            if len(fields) == 3 and fields[1] in "tTwW":
+                self.addrs.append(int(fields[0], 16))
+                self.names.append(fields[2])
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return "0x%x" % addr
+        return self.names[i]
+
+
+def parse_dump(lines):
+    """Return the samples of the last complete dump as (flags, pid, pcs),
+    pcs innermost first."""
+    result = None
+    samples = None
+    for line in lines:
+        fields = line.split()
+        if line.startswith("SYNPROF BEGIN"):
+            samples = []
+        elif samples is None or not fields:
+            continue
+        elif fields[0] == "SYNPROF" and fields[1:] == ["END"]:
+            result = samples
+            samples = None
+        elif fields[0] == "CPU":
+            lost = int(fields[3], 16)
+            if lost:
+                print("cpu %d: %d samples lost (buffer full)"
+                      % (int(fields[1], 16), lost), file=sys.stderr)
+        else:
+            try:
+                values = [int(f, 16) for f in fields]
+            except ValueError:
+                continue
+            if len(values) >= 3:
+                samples.append((values[0], values[1], values[2:]))
+    if result is None:
+        sys.exit("no complete SYNPROF dump found")
+    return result
+
+
+def fold(samples, symbols, by_pid):
+    stacks = collections.Counter()
+    for flags, pid, pcs in samples:
+        if flags & PROFILE_SAMPLE_USER:
+            frames = ["[user]"]
+        else:
+            # Return addresses point past the call; look up the call itself
+            frames = [symbols.lookup(pcs[0])]
+            frames += [symbols.lookup(pc - 1) for pc in pcs[1:]]
+        frames.reverse()
+        if by_pid:
+            frames.insert(0, "pid %d" % pid)
+        stacks[";".join(frames)] += 1
+    return stacks
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="serial log holding a SYNPROF dump")
+    parser.add_argument("--elf", default="build/kernel.elf",
+                        help="kernel image (default: build/kernel.elf)")
+    parser.add_argument("--nm", default="nm", help="nm to use")
+    parser.add_argument("--by-pid", action="store_true",
+                        help="root each stack at its process")
+    args = parser.parse_args()
+
+    with open(args.log, errors="replace") as log:
+        samples = parse_dump(log)
+    symbols = Symbols(args.elf, args.nm)
+
+    for stack, count in sorted(fold(samples, symbols, args.by_pid).items()):
+        print("%s %d" % (stack, count))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+# SYNAPSE SO - Trace Decoder
+# Licensed under GPLv3
+"""Convert a trace dump captured from COM1 into Chrome trace JSON.
+
+Build with `make TRACE=1`, run with `make run` (COM1 goes to serial.log),
+then:
+
+    tools/trace2json.py serial.log > trace.json
+
+and open trace.json in chrome://tracing or https://ui.perfetto.dev. Each
+CPU is a thread of one process: interrupts show as slices on it, the
+running process as a slice on a second track per CPU, and allocations and
+page faults as instant events. When the log holds several dumps the last
+one is used.
+"""
+
+import json
+import struct
+import sys
+
+# kernel/include/kernel/trace.h
+TRACE_IRQ_ENTRY = 1
+TRACE_IRQ_EXIT = 2
+TRACE_SWITCH = 3
+TRACE_PAGE_ALLOC = 4
+TRACE_PAGE_FREE = 5
+TRACE_KMALLOC = 6
+TRACE_KFREE = 7
+TRACE_PAGE_FAULT = 8
+
+# trace_record_t: time, event, cpu, pid, args[4]
+RECORD = struct.Struct("<QHHI4I")
+
+INSTANTS = {
+    TRACE_PAGE_ALLOC: ("page_alloc", ("frame",)),
+    TRACE_PAGE_FREE: ("page_free", ("frame",)),
+    TRACE_KMALLOC: ("kmalloc", ("ptr", "size")),
+    TRACE_KFREE: ("kfree", ("ptr",)),
+    TRACE_PAGE_FAULT: ("page_fault", ("addr", "error")),
+}
+
+
+def parse_dump(lines):
+    """Return (khz, {cpu: [records]}) for the last complete dump."""
+    result = None
+    dump = None
+    current = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("SYNTRACE BEGIN"):
+            fields = line.split()
+            dump = (int(fields[2], 16), {})
+            current = None
+        elif dump is None:
+            continue
+        elif line == "SYNTRACE END":
+            result = dump
+            dump = None
+        elif line.startswith("CPU "):
+            current = int(line.split()[1], 16)
+            dump[1][current] = []
+        elif current is not None and len(line) == RECORD.size * 2:
+            dump[1][current].append(RECORD.unpack(bytes.fromhex(line)))
+    if result is None:
+        sys.exit("no complete SYNTRACE dump found")
+    return result
+
+
+def to_us(cycles, khz):
+    return cycles * 1000.0 / khz
+
+
+def convert(khz, cpus):
+    events = []
+    base = min((recs[0][0] for recs in cpus.values() if recs), default=0)
+
+    for cpu, records in sorted(cpus.items()):
+        irq_tid = cpu * 2
+        proc_tid = cpu * 2 + 1
+        events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": irq_tid,
+                       "args": {"name": "CPU %d" % cpu}})
+        events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": proc_tid,
+                       "args": {"name": "CPU %d processes" % cpu}})
+
+        running = None      # (pid, start)
+        open_irqs = 0
+        for time, event, _, pid, a0, a1, a2, _ in records:
+            ts = to_us(time - base, khz)
+            if running is None:
+                running = (pid, ts)
+
+            if event == TRACE_IRQ_ENTRY:
+                open_irqs += 1
+                events.append({"ph": "B", "name": "irq %d" % a0, "pid": 0,
+                               "tid": irq_tid, "ts": ts})
+            elif event == TRACE_IRQ_EXIT:
+                # The ring may start inside an interrupt
+                if open_irqs > 0:
+                    open_irqs -= 1
+                    events.append({"ph": "E", "pid": 0, "tid": irq_tid, "ts": ts,
+                                   "args": {"result": a1}})
+            elif event == TRACE_SWITCH:
+                events.append({"ph": "X", "name": "pid %d" % a0, "pid": 0,
+                               "tid": proc_tid, "ts": running[1],
+                               "dur": ts - running[1], "args": {"state": a2}})
+                running = (a1, ts)
+            elif event in INSTANTS:
+                name, arg_names = INSTANTS[event]
+                args = {n: "0x%x" % v for n, v in zip(arg_names, (a0, a1))}
+                args["pid"] = pid
+                events.append({"ph": "i", "s": "t", "name": name, "pid": 0,
+                               "tid": irq_tid, "ts": ts, "args": args})
+
+        if records and running is not None:
+            end = to_us(records[-1][0] - base, khz)
+            events.append({"ph": "X", "name": "pid %d" % running[0], "pid": 0,
+                           "tid": proc_tid, "ts": running[1],
+                           "dur": end - running[1]})
+
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: %s SERIAL_LOG > trace.json" % sys.argv[0])
+
+    with open(sys.argv[1], errors="replace") as log:
+        khz, cpus = parse_dump(log)
+    if khz == 0:
+        sys.exit("dump has no clock rate")
+
+    json.dump(convert(khz, cpus), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()